@@ -21,12 +21,11 @@
 // ----------------------------------------------------------------------------------
 //   Time
 // ------------------- ---------------------------------------------------------------
+// Monotonic, see hr_clock.h.  Use hr_clock_to_wall_usec() for log stamps.
 uint64_t
 get_time_usec()
 {
-    static struct timeval _time_stamp;
-    gettimeofday(&_time_stamp, NULL);
-    return _time_stamp.tv_sec*1000000 + _time_stamp.tv_usec;
+    return hr_clock_usec();
 }
 
 
@@ -61,7 +60,8 @@ set_position(float x, float y, float z, mavlink_set_position_target_local_ned_t
 void
 set_land(mavlink_set_position_target_local_ned_t &sp)
 {
-    sp.time_boot_ms = (uint32_t) (get_time_usec()/1000);
+    // stamped with the vehicle clock when written
+    sp.time_boot_ms = 0;
 
     sp.type_mask = 0x2000;  // 0b10 0000 0000 0000
     printf("land cmd send...\n");
@@ -171,11 +171,36 @@ Autopilot_Interface(Serial_Port *serial_port_)
     autopilot_id = 0; // autopilot component id
     companion_id = 0; // companion computer component id
 
-    current_messages.sysid  = system_id;
-    current_messages.compid = autopilot_id;
+    Message_Source source;
+    source.sysid  = system_id;
+    source.compid = autopilot_id;
+    current_messages.source.store(source);
+
+    target_key  = -1; // any sender until start() picks one
+    adopted_key = -1;
+
+    hold_version                = UINT32_MAX; // none
+    watchdog_hold_version       = UINT32_MAX;
+    watchdog_prior_hold_version = UINT32_MAX;
+    written_setpoint_version    = 0;
 
     serial_port = serial_port_; // serial port management object
 
+    timesync_interval_usec = 1000000; // 1 Hz
+    last_timesync_usec     = 0;
+
+    // keep the vehicle clock estimate current
+    subscribe(MAVLINK_MSG_ID_TIMESYNC, &autopilot_interface_timesync_callback, this);
+
+    // acknowledged commands
+    commands.set_sender(&autopilot_interface_command_sender, this);
+    subscribe(MAVLINK_MSG_ID_COMMAND_ACK, &autopilot_interface_command_ack_callback, this);
+
+    // notice lost links, LOCAL_POSITION_NED once its rate is known
+    watchdog.watch(MAVLINK_MSG_ID_HEARTBEAT, 1500000);
+    watchdog.set_callback(&autopilot_interface_watchdog_callback, this);
+    position_stale_action = WATCHDOG_ACTION_NONE;
+
 }
 
 Autopilot_Interface::
@@ -186,13 +211,48 @@ Autopilot_Interface::
 // ------------------------------------------------------------------------------
 //   Update Setpoint
 // ------------------------------------------------------------------------------
-void
+uint32_t
 Autopilot_Interface::
 update_setpoint(mavlink_set_position_target_local_ned_t setpoint)
 {
-    current_setpoint = setpoint;
+    trajectory.clear();
+    current_setpoint.store(setpoint);
+
+    set_setpoint_sendstatus(true);
+
+    return current_setpoint.version();
+}
+
+bool
+Autopilot_Interface::
+push_trajectory(const Trajectory_Point *points, unsigned num_points)
+{
+    // no plan, the hold stays
+    if ( num_points == 0 )
+        return true;
+
+    bool result = trajectory.push(points, num_points, get_time_usec());
+
+    // a new plan ends a hold, like a new setpoint
+    hold_version.store(UINT32_MAX, std::memory_order_release);
 
     set_setpoint_sendstatus(true);
+
+    return result;
+}
+
+void
+Autopilot_Interface::
+clear_trajectory()
+{
+    trajectory.clear();
+}
+
+uint32_t
+Autopilot_Interface::
+get_written_setpoint_version()
+{
+    return written_setpoint_version.load(std::memory_order_acquire);
 }
 
 char
@@ -257,13 +317,9 @@ bool
 Autopilot_Interface::
 is_armed()
 {
-    Mavlink_Messages messages = current_messages;
-
     uint8_t arm_state;
-    mavlink_heartbeat_t heartbeat;
 
-    heartbeat = messages.heartbeat;
-    arm_state = heartbeat.system_status;
+    arm_state = current_messages.hot.load_field(&Hot_State::system_status);
 
     // printf("arm_state=%d\n", arm_state);
 
@@ -273,6 +329,27 @@ is_armed()
         return false;
 }
 
+// ------------------------------------------------------------------------------
+//  Check Vehicle's Landed State
+// ------------------------------------------------------------------------------
+// MAV_LANDED_STATE_*, UNDEFINED until EXTENDED_SYS_STATE has been received
+uint8_t
+Autopilot_Interface::
+get_landed_state()
+{
+    return current_messages.hot.load_field(&Hot_State::landed_state);
+}
+
+// Block until the vehicle reports landed_state, false on timeout
+bool
+Autopilot_Interface::
+wait_for_landed_state(uint8_t landed_state, uint64_t timeout_usec)
+{
+    return current_messages.wait_until([this, landed_state]() {
+            return time_to_exit || get_landed_state() == landed_state;
+        }, timeout_usec) && get_landed_state() == landed_state;
+}
+
 // ------------------------------------------------------------------------------
 //  Check Vehicle's Offboard mode state 
 // ------------------------------------------------------------------------------
@@ -280,18 +357,12 @@ bool
 Autopilot_Interface::
 is_in_offboard_mode()
 {
-    Mavlink_Messages messages = current_messages;
-
     union px4_custom_mode custom_mode;
     uint32_t mode;
-    mavlink_heartbeat_t heartbeat;
 
-    heartbeat = messages.heartbeat;
-    mode = heartbeat.custom_mode;
+    mode = current_messages.hot.load_field(&Hot_State::custom_mode);
     custom_mode = *(px4_custom_mode*)(&mode);
 
-    printf("Check OFFBOARD MODE, %d\n", custom_mode.main_mode);
-
     if (custom_mode.main_mode == PX4_CUSTOM_MAIN_MODE_OFFBOARD)
         return true;
     else 
@@ -302,171 +373,121 @@ is_in_offboard_mode()
 // ------------------------------------------------------------------------------
 //   Read Messages
 // ------------------------------------------------------------------------------
+// Blocks in the port read until the next message, then hands it on at once.
+// No batching and no sleep: a waiter must not sit in a buffer until a batch
+// completes.
 void
 Autopilot_Interface::
 read_messages()
 {
-    bool success;               // receive success flag
-    bool received_all = false;  // receive only one message
-    Time_Stamps this_timestamps;
+    // ----------------------------------------------------------------------
+    //   READ MESSAGE
+    // ----------------------------------------------------------------------
+    mavlink_message_t message;
+    bool success = serial_port->read_message(message);
+
+    // ----------------------------------------------------------------------
+    //   HANDLE MESSAGE
+    // ----------------------------------------------------------------------
+    if( success )
+        handle_message(message, get_time_usec());
+
+    return;
+}
+
+// ------------------------------------------------------------------------------
+//   Handle Message
+// ------------------------------------------------------------------------------
+void
+Autopilot_Interface::
+handle_message(const mavlink_message_t &message, uint64_t receive_time)
+{
+    // The table belongs to this thread, so the target's entry is switched
+    // to current_messages here rather than in set_target()
+    int key = target_key.load(std::memory_order_relaxed);
+    if ( key != adopted_key and key >= 0 and vehicles.adopt(key >> 8, key & 0xff, &current_messages) )
+        adopted_key = key;
+
+    // Every sender keeps its own state in the vehicle table, the target's
+    // is current_messages
+    Telemetry_Store *vehicle = vehicles.store(message, receive_time);
 
-    // Blocking wait for new data
-    while ( !received_all and !time_to_exit )
+    // link loss of every sender
+    rate_monitor.record_sequence(message);
+
+    // Until a target is chosen every sender is accepted
+    if ( is_from_target(message) )
     {
-        // ----------------------------------------------------------------------
-        //   READ MESSAGE
-        // ----------------------------------------------------------------------
-        mavlink_message_t message;
-        success = serial_port->read_message(message);
+        rate_monitor.record(message, receive_time);
+        watchdog.received(message.msgid, receive_time);
 
-        // ----------------------------------------------------------------------
-        //   HANDLE MESSAGE
-        // ----------------------------------------------------------------------
-        if( success )
+        // not decoded twice once the table has it
+        if ( vehicle != &current_messages )
         {
+            Message_Source source;
+            source.sysid  = message.sysid;
+            source.compid = message.compid;
+            current_messages.source.store(source);
 
-            // Store message sysid and compid.
-            // Note this doesn't handle multiple message sources.
-            current_messages.sysid  = message.sysid;
-            current_messages.compid = message.compid;
+            // Decode tracked messages into current_messages, the table of
+            // decoders is generated from TELEMETRY_TRACKED_MESSAGES
+            current_messages.store(message, receive_time);
 
-            // Handle Message ID
-            switch (message.msgid)
-            {
-
-                case MAVLINK_MSG_ID_HEARTBEAT:
-                {
-                    //printf("MAVLINK_MSG_ID_HEARTBEAT\n");
-                    mavlink_msg_heartbeat_decode(&message, &(current_messages.heartbeat));
-                    current_messages.time_stamps.heartbeat = get_time_usec();
-                    this_timestamps.heartbeat = current_messages.time_stamps.heartbeat;
-                    break;
-                }
-
-                case MAVLINK_MSG_ID_SYS_STATUS:
-                {
-                    //printf("MAVLINK_MSG_ID_SYS_STATUS\n");
-                    mavlink_msg_sys_status_decode(&message, &(current_messages.sys_status));
-                    current_messages.time_stamps.sys_status = get_time_usec();
-                    this_timestamps.sys_status = current_messages.time_stamps.sys_status;
-                    break;
-                }
-
-                case MAVLINK_MSG_ID_BATTERY_STATUS:
-                {
-                    //printf("MAVLINK_MSG_ID_BATTERY_STATUS\n");
-                    mavlink_msg_battery_status_decode(&message, &(current_messages.battery_status));
-                    current_messages.time_stamps.battery_status = get_time_usec();
-                    this_timestamps.battery_status = current_messages.time_stamps.battery_status;
-                    break;
-                }
-
-                case MAVLINK_MSG_ID_RADIO_STATUS:
-                {
-                    //printf("MAVLINK_MSG_ID_RADIO_STATUS\n");
-                    mavlink_msg_radio_status_decode(&message, &(current_messages.radio_status));
-                    current_messages.time_stamps.radio_status = get_time_usec();
-                    this_timestamps.radio_status = current_messages.time_stamps.radio_status;
-                    break;
-                }
-
-                case MAVLINK_MSG_ID_LOCAL_POSITION_NED:
-                {
-                    // printf("MAVLINK_MSG_ID_LOCAL_POSITION_NED\n");
-                    mavlink_msg_local_position_ned_decode(&message, &(current_messages.local_position_ned));
-                    current_messages.time_stamps.local_position_ned = get_time_usec();
-                    // printf("% .4f,% .4f,% .4f\n",  current_messages.local_position_ned.x, current_messages.local_position_ned.y, current_messages.local_position_ned.z);
-                    this_timestamps.local_position_ned = current_messages.time_stamps.local_position_ned;
-                    break;
-                }
-
-                case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
-                {
-                    //printf("MAVLINK_MSG_ID_GLOBAL_POSITION_INT\n");
-                    mavlink_msg_global_position_int_decode(&message, &(current_messages.global_position_int));
-                    current_messages.time_stamps.global_position_int = get_time_usec();
-                    this_timestamps.global_position_int = current_messages.time_stamps.global_position_int;
-                    break;
-                }
-
-                case MAVLINK_MSG_ID_POSITION_TARGET_LOCAL_NED:
-                {
-                    //printf("MAVLINK_MSG_ID_POSITION_TARGET_LOCAL_NED\n");
-                    mavlink_msg_position_target_local_ned_decode(&message, &(current_messages.position_target_local_ned));
-                    current_messages.time_stamps.position_target_local_ned = get_time_usec();
-                    this_timestamps.position_target_local_ned = current_messages.time_stamps.position_target_local_ned;
-                    break;
-                }
-
-                case MAVLINK_MSG_ID_POSITION_TARGET_GLOBAL_INT:
-                {
-                    //printf("MAVLINK_MSG_ID_POSITION_TARGET_GLOBAL_INT\n");
-                    mavlink_msg_position_target_global_int_decode(&message, &(current_messages.position_target_global_int));
-                    current_messages.time_stamps.position_target_global_int = get_time_usec();
-                    this_timestamps.position_target_global_int = current_messages.time_stamps.position_target_global_int;
-                    break;
-                }
-
-                case MAVLINK_MSG_ID_HIGHRES_IMU:
-                {
-                    //printf("MAVLINK_MSG_ID_HIGHRES_IMU\n");
-                    mavlink_msg_highres_imu_decode(&message, &(current_messages.highres_imu));
-                    current_messages.time_stamps.highres_imu = get_time_usec();
-                    this_timestamps.highres_imu = current_messages.time_stamps.highres_imu;
-                    break;
-                }
-
-                case MAVLINK_MSG_ID_ATTITUDE:
-                {
-                    //printf("MAVLINK_MSG_ID_ATTITUDE\n");
-                    mavlink_msg_attitude_decode(&message, &(current_messages.attitude));
-                    current_messages.time_stamps.attitude = get_time_usec();
-                    this_timestamps.attitude = current_messages.time_stamps.attitude;
-                    break;
-                }
-
-                case MAVLINK_MSG_ID_VFR_HUD:
-                {
-                    //printf("MAVLINK_MSG_ID_VFR_HUD, alt=%6.2f\n", current_messages.vfr_hud.alt);
-                    mavlink_msg_vfr_hud_decode(&message, &(current_messages.vfr_hud));
-                    current_messages.time_stamps.vfr_hud = get_time_usec();
-                    this_timestamps.vfr_hud = current_messages.time_stamps.vfr_hud;
-                    break;
-                }
-
-                default:
-                {
-                    // printf("Warning, did not handle message id %i\n",message.msgid);
-                    break;
-                }
-
-
-            } // end: switch msgid
-
-        } // end: if read message
-
-        // Check for receipt of all items
-        received_all =
-                this_timestamps.heartbeat                  &&
-//              this_timestamps.battery_status             &&
-//              this_timestamps.radio_status               &&
-//              this_timestamps.local_position_ned         &&
-//              this_timestamps.global_position_int        &&
-//              this_timestamps.position_target_local_ned  &&
-//              this_timestamps.position_target_global_int &&
-//              this_timestamps.highres_imu                &&
-//              this_timestamps.attitude                   &&
-                this_timestamps.sys_status
-                ;
-
-        // give the write thread time to use the port
-        if ( writing_status > false ) {
-            usleep(100); // look for components of batches at 10kHz
+            // wake anyone waiting on telemetry
+            current_messages.notify(message.msgid);
         }
+    }
 
-    } // end: while not received all
+    // hand the message to subscribers
+    subscriptions.dispatch(message, receive_time);
 
-    return;
+    rate_monitor.dump_if_requested(receive_time);
+}
+
+// ------------------------------------------------------------------------------
+//   Vehicles
+// ------------------------------------------------------------------------------
+Telemetry_Store *
+Autopilot_Interface::
+get_vehicle(int sysid, int compid)
+{
+    return vehicles.find(sysid, compid);
+}
+
+void
+Autopilot_Interface::
+set_target(int sysid, int compid)
+{
+    system_id    = sysid;
+    autopilot_id = compid;
+
+    target_key.store((sysid & 0xff) << 8 | (compid & 0xff));
+}
+
+bool
+Autopilot_Interface::
+is_from_target(const mavlink_message_t &message)
+{
+    int key = target_key.load(std::memory_order_relaxed);
+
+    return key < 0 or key == ( message.sysid << 8 | message.compid );
+}
+
+// ------------------------------------------------------------------------------
+//   Subscriptions
+// ------------------------------------------------------------------------------
+int
+Autopilot_Interface::
+subscribe(int msgid, Message_Callback callback, void *context)
+{
+    return subscriptions.subscribe(msgid, callback, context);
+}
+
+void
+Autopilot_Interface::
+unsubscribe(int handle)
+{
+    subscriptions.unsubscribe(handle);
 }
 
 // ------------------------------------------------------------------------------
@@ -497,12 +518,25 @@ write_setpoint()
     //   PACK PAYLOAD
     // --------------------------------------------------------------------------
 
-    // pull from position target
-    mavlink_set_position_target_local_ned_t sp = current_setpoint;
+    // pull from position target, with the version it belongs to
+    mavlink_set_position_target_local_ned_t sp;
+    uint32_t version;
+    do {
+        version = current_setpoint.version();
+        sp      = current_setpoint.load();
+    } while ( version != current_setpoint.version() );
+
+    // no update since the hold
+    if ( version == hold_version.load(std::memory_order_acquire) )
+        make_hold_setpoint(sp);
+
+    // else the queued trajectory, if it has begun
+    else
+        trajectory.sample(get_time_usec(), sp);
 
     // double check some system parameters
     if ( not sp.time_boot_ms )
-        sp.time_boot_ms = (uint32_t) (get_time_usec()/1000);
+        sp.time_boot_ms = get_vehicle_time_boot_ms();
     sp.target_system    = system_id;
     sp.target_component = autopilot_id;
 
@@ -524,6 +558,8 @@ write_setpoint()
     // check the write
     if ( len <= 0 )
         fprintf(stderr,"WARNING: could not send POSITION_TARGET_LOCAL_NED \n");
+    else
+        written_setpoint_version.store(version, std::memory_order_release);
     //  else
     //      printf("%lu POSITION_TARGET  = [ %f , %f , %f ] \n", write_count, position_target.x, position_target.y, position_target.z);
 
@@ -538,7 +574,7 @@ write_set_att()
     mavlink_set_attitude_target_t att_sp/* = attitude_setpoint*/;
 
     // if ( not att_sp.time_boot_ms )
-     att_sp.time_boot_ms = (uint32_t) (get_time_usec()/1000);
+     att_sp.time_boot_ms = get_vehicle_time_boot_ms();
     
     att_sp.target_system    = system_id;
     att_sp.target_component = autopilot_id;
@@ -558,6 +594,201 @@ write_set_att()
 
 
 
+// ------------------------------------------------------------------------------
+//   Setpoint Stream
+// ------------------------------------------------------------------------------
+/*
+ * Any thread may hold, so it does not write current_setpoint: the write
+ * thread sends the hold instead of the current version, until the control
+ * code updates the setpoint again.
+ */
+void
+Autopilot_Interface::
+hold_setpoint()
+{
+    hold_version.store(current_setpoint.version(), std::memory_order_release);
+}
+
+void
+Autopilot_Interface::
+make_hold_setpoint(mavlink_set_position_target_local_ned_t &sp)
+{
+    memset(&sp, 0, sizeof(sp));
+    sp.type_mask = MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_VELOCITY &
+                   MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_YAW_RATE;
+    sp.coordinate_frame = MAV_FRAME_LOCAL_NED;
+    sp.vx       = 0.0;
+    sp.vy       = 0.0;
+    sp.vz       = 0.0;
+    sp.yaw_rate = 0.0;
+}
+
+// One period of the outgoing stream, the write thread calls this every write_scheduler period
+void
+Autopilot_Interface::
+write_stream(uint64_t now)
+{
+    write_setpoint();
+
+    // refresh the vehicle clock estimate
+    if ( now - last_timesync_usec >= timesync_interval_usec )
+    {
+        write_timesync();
+        last_timesync_usec = now;
+    }
+
+    // also when nothing is being received
+    rate_monitor.dump_if_requested(now);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Stale Telemetry
+// ------------------------------------------------------------------------------
+void
+Autopilot_Interface::
+handle_watchdog(uint8_t msgid, bool stale, Watchdog_Action action, uint64_t age_usec)
+{
+    const mavlink_message_info_t *info = get_message_info(msgid);
+    const char *name = info ? info->name : "?";
+
+    char wall[HR_CLOCK_WALL_FORMAT_SIZE];
+    hr_clock_format_wall(get_time_usec(), wall, sizeof(wall));
+
+    if ( not stale )
+    {
+        printf("%s %s RECOVERED\n", wall, name);
+
+        // end our hold, unless the setpoint has been updated since
+        if ( action == WATCHDOG_ACTION_HOLD )
+        {
+            uint32_t held = watchdog_hold_version.load();
+            if ( hold_version.compare_exchange_strong(held, watchdog_prior_hold_version.load()) )
+                printf("%s %s resuming setpoint\n", wall, name);
+        }
+        return;
+    }
+
+    fprintf(stderr,"%s WARNING: no %s for %llu ms\n", wall, name, (unsigned long long)(age_usec / 1000));
+
+    switch ( action )
+    {
+        case WATCHDOG_ACTION_HOLD:
+            fprintf(stderr,"%s WARNING: holding position\n", wall);
+            watchdog_prior_hold_version.store(hold_version.load());
+            hold_setpoint();
+            watchdog_hold_version.store(hold_version.load());
+            break;
+
+        case WATCHDOG_ACTION_DISABLE_OFFBOARD:
+            // this thread must not wait for the ACK, the engine retransmits
+            // and the callback clears control_status once it is accepted
+            if ( control_status == true )
+            {
+                mavlink_command_long_t com = { 0 };
+                com.target_system    = system_id;
+                com.target_component = autopilot_id;
+                com.command          = MAV_CMD_NAV_GUIDED_ENABLE;
+                com.param1           = 0.0f;
+
+                commands.send(com, NULL, &autopilot_interface_offboard_disabled_callback, this);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/*
+ * Watch LOCAL_POSITION_NED with a deadline from its measured rate, a fixed
+ * deadline would fire all the time on a slow radio stream.  Waits for a few
+ * messages first.
+ */
+void
+Autopilot_Interface::
+watch_position()
+{
+    uint8_t msgid = MAVLINK_MSG_ID_LOCAL_POSITION_NED;
+
+    current_messages.wait_until([this, msgid]() {
+            Rate_Stats stats;
+            return time_to_exit || ( rate_monitor.get_stats(msgid, stats) &&
+                                     stats.count >= POSITION_RATE_SAMPLES );
+        }, POSITION_RATE_WAIT_USEC);
+
+    uint64_t deadline = POSITION_STALE_FALLBACK_USEC;
+
+    Rate_Stats stats;
+    if ( rate_monitor.get_stats(msgid, stats) && stats.count >= 2 )
+    {
+        deadline = (uint64_t)(POSITION_STALE_GAPS * stats.mean_gap_usec);
+        if ( deadline < POSITION_STALE_MIN_USEC )
+            deadline = POSITION_STALE_MIN_USEC;
+    }
+
+    printf("LOCAL_POSITION_NED DEADLINE %llu ms%s\n", (unsigned long long)(deadline / 1000),
+           position_stale_action == WATCHDOG_ACTION_HOLD ? ", HOLD WHEN STALE" : "");
+    printf("\n");
+
+    watchdog.watch(msgid, deadline, position_stale_action);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Time Synchronization
+// ------------------------------------------------------------------------------
+void
+Autopilot_Interface::
+write_timesync()
+{
+    mavlink_timesync_t timesync;
+    time_sync.make_request(get_time_usec(), timesync);
+
+    mavlink_message_t message;
+    mavlink_msg_timesync_encode(system_id, companion_id, &message, &timesync);
+
+    int len = write_message(message);
+
+    if ( len <= 0 )
+        fprintf(stderr,"WARNING: could not send TIMESYNC \n");
+}
+
+void
+Autopilot_Interface::
+handle_timesync(const mavlink_message_t &message, uint64_t time_usec)
+{
+    // only the target's clock is tracked
+    if ( not is_from_target(message) )
+        return;
+
+    mavlink_timesync_t timesync, reply;
+    mavlink_msg_timesync_decode(&message, &timesync);
+
+    // the vehicle is syncing to us, answer with our time
+    if ( time_sync.handle_timesync(timesync, time_usec, reply) )
+    {
+        mavlink_message_t answer;
+        mavlink_msg_timesync_encode(system_id, companion_id, &answer, &reply);
+        write_message(answer);
+    }
+}
+
+// Vehicle boot time now, falls back to host time until the clocks are synced
+uint32_t
+Autopilot_Interface::
+get_vehicle_time_boot_ms()
+{
+    uint64_t now = get_time_usec();
+
+    if ( time_sync.is_valid() )
+        return (uint32_t) (time_sync.host_to_vehicle_usec(now)/1000);
+
+    return (uint32_t) (now/1000);
+}
+
+
 // ------------------------------------------------------------------------------
 //   Start Off-Board Mode
 // ------------------------------------------------------------------------------
@@ -572,34 +803,27 @@ enable_offboard_control()
     {
         printf("Enable Offboaed Mode...\n");
 
-        //   Toggle Offboard Mode
-        int success = -1;
-
         // Sends the command to go off-board
         while(enable_trytimes--){
             
-            success = toggle_offboard_control( true );
-            if(success < 0){
+            // returns with the COMMAND_ACK, one round trip
+            int result = toggle_offboard_control( true );
+            if(result == COMMAND_RESULT_SEND_FAILED){
 
                 printf("Offboard Command Send failed!\n");
                 throw EXIT_FAILURE;
             }
 
-            usleep(400000);
-
-            // success = toggle_offboard_control( true );
-            // if(success < 0){
-
-            //     printf("Offboard Command Send failed!\n");
-            //     throw EXIT_FAILURE;
-            // }
-             // usleep(300000);
-
-            if (is_in_offboard_mode()){
+            if ( result == MAV_RESULT_ACCEPTED || is_in_offboard_mode() )
+            {
                 control_status = true;   /* In offboard mode*/
                 break;
             }
 
+            // refused, e.g. no setpoints seen yet, try again once a
+            // heartbeat came or 400 ms passed
+            current_messages.wait_for_message(MAVLINK_MSG_ID_HEARTBEAT, 400000);
+
         }
 
         if(!control_status){
@@ -633,14 +857,14 @@ disable_offboard_control()
         // ----------------------------------------------------------------------
 
         // Sends the command to stop off-board
-        int success = toggle_offboard_control( false );
+        int result = toggle_offboard_control( false );
 
-        // Check the command was written
-        if ( success )
+        // Check the command was accepted
+        if ( result == MAV_RESULT_ACCEPTED )
             control_status = false;
         else
         {
-            fprintf(stderr,"Error: off-board mode not set, could not write message\n");
+            fprintf(stderr,"Error: off-board mode not left, result %d\n", result);
             //throw EXIT_FAILURE;
         }
 
@@ -661,7 +885,7 @@ vehicle_armed()
     printf("Switch Vehicle to Armed...\n");
 
     // Sends the command to armed
-    int success  = -1, armed_trytimes = 50;
+    int armed_trytimes = 50;
     bool armed = false;
     
     while(armed_trytimes--){
@@ -671,14 +895,26 @@ vehicle_armed()
             break;
         }
 
-        success = toggle_arm_disarm( true );
-         if(success < 0){
+        // returns with the COMMAND_ACK, one round trip
+        int result = toggle_arm_disarm( true );
+         if(result == COMMAND_RESULT_SEND_FAILED){
 
                 printf("Armed Command Send failed!\n");
                 throw EXIT_FAILURE;
         }
 
-        usleep(200000);
+        if ( result == MAV_RESULT_ACCEPTED )
+        {
+            armed = true;
+            break;
+        }
+
+        // refused, try again once a heartbeat came or 200 ms passed
+        if ( current_messages.wait_until([this]() { return is_armed(); }, 200000) )
+        {
+            armed = true;
+            break;
+        }
 
     }
 
@@ -688,12 +924,6 @@ vehicle_armed()
         throw EXIT_FAILURE;
     }
 
-
-    // Check the command was written
-    if ( !success ) {
-        fprintf(stderr,"Error: armed failed, could not write message\n");
-    }
-
     printf("\n");
 
 
@@ -709,12 +939,12 @@ vehicle_disarm()
     // Should only send this command once
     printf("DISARM MODE\n");
 
-    // Sends the command to go off-board
-    int success = toggle_arm_disarm( false );
+    // Sends the command to disarm
+    int result = toggle_arm_disarm( false );
 
-    // Check the command was written
-    if ( !success ) {
-        fprintf(stderr,"Error: disarm failed could not write message\n");
+    // Check the command was accepted
+    if ( result != MAV_RESULT_ACCEPTED ) {
+        fprintf(stderr,"Error: disarm failed, result %d\n", result);
     }
 
     printf("\n");
@@ -734,18 +964,10 @@ toggle_offboard_control( bool flag )
     com.target_system    = system_id;
     com.target_component = autopilot_id;
     com.command          = MAV_CMD_NAV_GUIDED_ENABLE;
-    com.confirmation     = true;
     com.param1           = (float) flag; // flag >0.5 => start, <0.5 => stop
 
-    // Encode
-    mavlink_message_t message;
-    mavlink_msg_command_long_encode(system_id, companion_id, &message, &com);
-
-    // Send the message
-    int len = serial_port->write_message(message);
-
-    // Done!
-    return len;
+    // Send, retransmit until acknowledged
+    return commands.execute(com);
 }
 
 int
@@ -757,18 +979,10 @@ toggle_land_control( bool flag )
     com.target_system    = system_id;
     com.target_component = autopilot_id;
     com.command          = MAV_CMD_NAV_LAND;
-    com.confirmation     = true;
     com.param1           = (float) flag; // flag >0.5 => start, <0.5 => stop
 
-    // Encode
-    mavlink_message_t message;
-    mavlink_msg_command_long_encode(system_id, companion_id, &message, &com);
-
-    // Send the message
-    int len = serial_port->write_message(message);
-
-    // Done!
-    return len;
+    // Send, retransmit until acknowledged
+    return commands.execute(com);
 }
 
 int
@@ -780,18 +994,10 @@ toggle_return_control( bool flag )
     com.target_system    = system_id;
     com.target_component = autopilot_id;
     com.command          = MAV_CMD_NAV_RETURN_TO_LAUNCH;
-    com.confirmation     = true;
     com.param1           = (float) flag; // flag >0.5 => start, <0.5 => stop
 
-    // Encode
-    mavlink_message_t message;
-    mavlink_msg_command_long_encode(system_id, companion_id, &message, &com);
-
-    // Send the message
-    int len = serial_port->write_message(message);
-
-    // Done!
-    return len;
+    // Send, retransmit until acknowledged
+    return commands.execute(com);
 }
 
 // ------------------------------------------------------------------------------
@@ -806,18 +1012,10 @@ toggle_arm_disarm( bool flag )
     com.target_system    = system_id;
     com.target_component = autopilot_id;
     com.command          = MAV_CMD_COMPONENT_ARM_DISARM;
-    com.confirmation     = true;
     com.param1           = (float) flag; // flag >0.5 => start, <0.5 => stop
 
-    // Encode
-    mavlink_message_t message;
-    mavlink_msg_command_long_encode(system_id, companion_id, &message, &com);
-
-    // Send the message
-    int len = serial_port->write_message(message);
-
-    // Done!
-    return len;
+    // Send, retransmit until acknowledged
+    return commands.execute(com);
 }
 
 // ------------------------------------------------------------------------------
@@ -840,13 +1038,26 @@ start()
     }
 
 
+    // --------------------------------------------------------------------------
+    //   LOCK MEMORY
+    // --------------------------------------------------------------------------
+
+    // before the threads, so their stacks are locked as well
+    if ( realtime.lock_memory )
+        realtime_lock_memory();
+
+    // retransmits run on the command engine's own thread
+    commands.set_thread_config(realtime.command_thread);
+    commands.start();
+
+
     // --------------------------------------------------------------------------
     //   READ THREAD
     // --------------------------------------------------------------------------
 
     printf("START READ THREAD \n");
 
-    result = pthread_create( &read_tid, NULL, &start_autopilot_interface_read_thread, this );
+    result = realtime_create_thread( &read_tid, realtime.read_thread, &start_autopilot_interface_read_thread, this );
     if ( result ) throw result;
 
     // now we're reading messages
@@ -859,12 +1070,12 @@ start()
 
     printf("CHECK FOR MESSAGES\n");
 
-    while ( not current_messages.sysid )
-    {
-        if ( time_to_exit )
-            return;
-        usleep(500000); // check at 2Hz
-    }
+    current_messages.wait_until([this]() {
+            return time_to_exit || current_messages.source.load_field(&Message_Source::sysid);
+        }, TELEMETRY_WAIT_FOREVER);
+
+    if ( time_to_exit )
+        return;
 
     printf("Found\n");
 
@@ -882,44 +1093,49 @@ start()
     // In which case set the id's manually.
 
     // System ID
+    Message_Source source = current_messages.source.load();
+
     if ( not system_id )
     {
-        system_id = current_messages.sysid;
-        printf("GOT VEHICLE SYSTEM ID: %i\n", system_id );
+        system_id = source.sysid;
+        printf("GOT VEHICLE SYSTEM ID: %i\n", system_id.load() );
     }
 
     // Component ID
     if ( not autopilot_id )
     {
-        autopilot_id = current_messages.compid;
-        printf("GOT AUTOPILOT COMPONENT ID: %i\n", autopilot_id);
+        autopilot_id = source.compid;
+        printf("GOT AUTOPILOT COMPONENT ID: %i\n", autopilot_id.load());
         printf("\n");
     }
 
+    // from now on current_messages only follows this vehicle
+    set_target(system_id, autopilot_id);
+
 
     // --------------------------------------------------------------------------
     //   GET INITIAL POSITION
     // --------------------------------------------------------------------------
 
     // Wait for initial position ned
-    while ( not ( current_messages.time_stamps.local_position_ned &&
-                  current_messages.time_stamps.attitude            )  )
-    {
-        if ( time_to_exit )
-            return;
-        usleep(500000);
-    }
+    current_messages.wait_until([this]() {
+            Hot_State hot = current_messages.hot.load();
+            return time_to_exit || ( hot.position_usec && hot.attitude_usec );
+        }, TELEMETRY_WAIT_FOREVER);
+
+    if ( time_to_exit )
+        return;
 
     // copy initial position ned
-    Mavlink_Messages local_data = current_messages;
-    initial_position.x        = local_data.local_position_ned.x;
-    initial_position.y        = local_data.local_position_ned.y;
-    initial_position.z        = local_data.local_position_ned.z;
-    initial_position.vx       = local_data.local_position_ned.vx;
-    initial_position.vy       = local_data.local_position_ned.vy;
-    initial_position.vz       = local_data.local_position_ned.vz;
-    initial_position.yaw      = local_data.attitude.yaw;
-    initial_position.yaw_rate = local_data.attitude.yawspeed;
+    Hot_State hot = current_messages.hot.load();
+    initial_position.x        = hot.x;
+    initial_position.y        = hot.y;
+    initial_position.z        = hot.z;
+    initial_position.vx       = hot.vx;
+    initial_position.vy       = hot.vy;
+    initial_position.vz       = hot.vz;
+    initial_position.yaw      = hot.yaw;
+    initial_position.yaw_rate = hot.yawspeed;
 
     printf("INITIAL POSITION XYZ = [ %.4f , %.4f , %.4f ] \n", initial_position.x, initial_position.y, initial_position.z);
     printf("INITIAL POSITION YAW = %.4f \n", initial_position.yaw);
@@ -933,7 +1149,7 @@ start()
     // --------------------------------------------------------------------------
     printf("START WRITE THREAD \n");
 
-    result = pthread_create( &write_tid, NULL, &start_autopilot_interface_write_thread, this );
+    result = realtime_create_thread( &write_tid, realtime.write_thread, &start_autopilot_interface_write_thread, this );
     if ( result ) throw result;
 
     // wait for it to be started
@@ -944,12 +1160,59 @@ start()
     printf("\n");
 
 
+    // --------------------------------------------------------------------------
+    //   WATCHDOG
+    // --------------------------------------------------------------------------
+
+    // streams are flowing now, from here on gaps are reported
+    if ( not watchdog.is_watched(MAVLINK_MSG_ID_LOCAL_POSITION_NED) )
+        watch_position();
+
+    watchdog.start(realtime.watchdog_thread);
+
+    // what the system actually granted
+    realtime_print_thread(stdout, "read",     read_tid);
+    realtime_print_thread(stdout, "write",    write_tid);
+    realtime_print_thread(stdout, "watchdog", watchdog.get_thread());
+    realtime_print_thread(stdout, "command",  commands.get_thread());
+    printf("\n");
+
+
     // Done!
     return;
 
 }
 
 
+// ------------------------------------------------------------------------------
+//   Event Loop Session
+// ------------------------------------------------------------------------------
+/*
+ * Prepare to be driven by an event loop (see Swarm_Manager) instead of our
+ * own threads.  The target must be known since there is no discovery.
+ */
+void
+Autopilot_Interface::
+start_session()
+{
+    if ( not system_id or not autopilot_id )
+    {
+        fprintf(stderr,"ERROR: session needs system and component id\n");
+        throw EXIT_FAILURE;
+    }
+
+    set_target(system_id, autopilot_id);
+    hold_setpoint();
+
+    // nothing measured yet, the loop arms the watchdog right away
+    if ( not watchdog.is_watched(MAVLINK_MSG_ID_LOCAL_POSITION_NED) )
+        watchdog.watch(MAVLINK_MSG_ID_LOCAL_POSITION_NED, POSITION_STALE_FALLBACK_USEC, position_stale_action);
+
+    reading_status = true;
+    writing_status = true;
+}
+
+
 // ------------------------------------------------------------------------------
 //   SHUTDOWN
 // ------------------------------------------------------------------------------
@@ -965,9 +1228,17 @@ stop()
     // signal exit
     time_to_exit = true;
 
-    // wait for exit
-    pthread_join(read_tid ,NULL);
-    pthread_join(write_tid,NULL);
+    // release anyone blocked waiting on telemetry
+    current_messages.notify_all();
+
+    watchdog.stop();
+    commands.stop();
+
+    // wait for exit, a session has no threads of its own
+    if ( read_tid )
+        pthread_join(read_tid ,NULL);
+    if ( write_tid )
+        pthread_join(write_tid,NULL);
 
     // now the read and write threads are closed
     printf("\n");
@@ -1048,13 +1319,13 @@ void
 Autopilot_Interface::
 read_thread()
 {
+    if ( realtime.lock_memory )
+        realtime_prefault_stack(realtime.read_thread.stack_size);
+
     reading_status = true;
 
     while ( ! time_to_exit )
-    {
         read_messages();
-        usleep(100000); // Read batches at 10Hz
-    }
 
     reading_status = false;
 
@@ -1069,21 +1340,14 @@ void
 Autopilot_Interface::
 write_thread(void)
 {
+    if ( realtime.lock_memory )
+        realtime_prefault_stack(realtime.write_thread.stack_size);
+
     // signal startup
     writing_status = 2;
 
     // prepare an initial setpoint, just stay put
-    mavlink_set_position_target_local_ned_t sp;
-    sp.type_mask = MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_VELOCITY &
-                   MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_YAW_RATE;
-    sp.coordinate_frame = MAV_FRAME_LOCAL_NED;
-    sp.vx       = 0.0;
-    sp.vy       = 0.0;
-    sp.vz       = 0.0;
-    sp.yaw_rate = 0.0;
-
-    // set position target
-    current_setpoint = sp;
+    hold_setpoint();
 
     // write a message and signal writing
     write_setpoint();
@@ -1092,11 +1356,14 @@ write_thread(void)
     // Pixhawk needs to see off-board commands at minimum 2Hz,
     // otherwise it will go into fail safe
     int cnt = 0;
+    write_scheduler.start();
     while ( !time_to_exit )
     {
-        write_setpoint();
-        usleep(200000);   // Stream at 10Hz, need to > 2Hz
-        
+        write_stream(get_time_usec());
+
+        // on absolute deadlines, the write time does not add to the period
+        write_scheduler.wait();
+
         // cnt++;
         // if(cnt % 5 == 0){
         //     printf("set att...\n");
@@ -1144,5 +1411,58 @@ start_autopilot_interface_write_thread(void *args)
     return NULL;
 }
 
+void
+autopilot_interface_watchdog_callback(uint8_t msgid, bool stale, Watchdog_Action action,
+                                      uint64_t age_usec, void *args)
+{
+    // takes an autopilot object argument
+    Autopilot_Interface *autopilot_interface = (Autopilot_Interface *)args;
+
+    autopilot_interface->handle_watchdog(msgid, stale, action, age_usec);
+}
+
+void
+autopilot_interface_command_ack_callback(const mavlink_message_t &message, uint64_t time_usec, void *args)
+{
+    // takes an autopilot object argument
+    Autopilot_Interface *autopilot_interface = (Autopilot_Interface *)args;
+
+    autopilot_interface->commands.handle_command_ack(message, time_usec);
+}
+
+void
+autopilot_interface_offboard_disabled_callback(const Command_Result &result, void *args)
+{
+    // takes an autopilot object argument
+    Autopilot_Interface *autopilot_interface = (Autopilot_Interface *)args;
+
+    if ( result.result == MAV_RESULT_ACCEPTED )
+        autopilot_interface->control_status = false;
+    else
+        fprintf(stderr,"Error: off-board mode not left, result %d\n", result.result);
+}
+
+int
+autopilot_interface_command_sender(const mavlink_command_long_t &command, void *args)
+{
+    // takes an autopilot object argument
+    Autopilot_Interface *autopilot_interface = (Autopilot_Interface *)args;
+
+    mavlink_message_t message;
+    mavlink_msg_command_long_encode(autopilot_interface->system_id, autopilot_interface->companion_id,
+                                    &message, &command);
+
+    return autopilot_interface->write_message(message);
+}
+
+void
+autopilot_interface_timesync_callback(const mavlink_message_t &message, uint64_t time_usec, void *args)
+{
+    // takes an autopilot object argument
+    Autopilot_Interface *autopilot_interface = (Autopilot_Interface *)args;
+
+    autopilot_interface->handle_timesync(message, time_usec);
+}
+
 
 
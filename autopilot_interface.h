@@ -15,10 +15,20 @@
 // ------------------------------------------------------------------------------
 
 #include "serial_port.h"
+#include "telemetry_store.h"
+#include "message_dispatcher.h"
+#include "time_sync.h"
+#include "hr_clock.h"
+#include "vehicle_table.h"
+#include "rate_monitor.h"
+#include "freshness_watchdog.h"
+#include "command_engine.h"
+#include "periodic_scheduler.h"
+#include "realtime.h"
+#include "setpoint_trajectory.h"
 
 #include <signal.h>
 #include <time.h>
-#include <sys/time.h>
 
 #include <common/mavlink.h>
 
@@ -84,6 +94,18 @@
 #define MAVLINK_MSG_SET_ATTITUDE_TARGET_ATTITUDE     0b01111111
 
 
+/*
+ * Default LOCAL_POSITION_NED deadline of the watchdog: this many of the gaps
+ * measured at start(), at least the minimum.  The gaps are measured over up
+ * to POSITION_RATE_SAMPLES messages or POSITION_RATE_WAIT_USEC, whichever
+ * comes first; with fewer than two messages the fallback is taken.
+ */
+#define POSITION_STALE_GAPS          5
+#define POSITION_STALE_MIN_USEC      100000
+#define POSITION_STALE_FALLBACK_USEC 3000000
+#define POSITION_RATE_SAMPLES        10
+#define POSITION_RATE_WAIT_USEC      3000000
+
 
 /*
  Bitmask to indicate which dimensions should be ignored by the vehicle: 
@@ -150,103 +172,12 @@ void set_land( mavlink_set_position_target_local_ned_t &sp);
 
 void* start_autopilot_interface_read_thread(void *args);
 void* start_autopilot_interface_write_thread(void *args);
-
-
-// ------------------------------------------------------------------------------
-//   Data Structures
-// ------------------------------------------------------------------------------
-
-struct Time_Stamps
-{
-	Time_Stamps()
-	{
-		reset_timestamps();
-	}
-
-	uint64_t heartbeat;
-	uint64_t sys_status;
-	uint64_t battery_status;
-	uint64_t radio_status;
-	uint64_t local_position_ned;
-	uint64_t global_position_int;
-	uint64_t position_target_local_ned;
-	uint64_t position_target_global_int;
-	uint64_t highres_imu;
-	uint64_t attitude;
-	uint64_t vfr_hud;
-
-	void
-	reset_timestamps()
-	{
-		heartbeat = 0;
-		sys_status = 0;
-		battery_status = 0;
-		radio_status = 0;
-		local_position_ned = 0;
-		global_position_int = 0;
-		position_target_local_ned = 0;
-		position_target_global_int = 0;
-		highres_imu = 0;
-		attitude = 0;
-		vfr_hud = 0;
-	}
-
-};
-
-
-// Struct containing information on the MAV we are currently connected to
-
-struct Mavlink_Messages {
-
-	int sysid;
-	int compid;
-
-	// Heartbeat
-	mavlink_heartbeat_t heartbeat;
-
-	// System Status
-	mavlink_sys_status_t sys_status;
-
-	// Battery Status
-	mavlink_battery_status_t battery_status;
-
-	// Radio Status
-	mavlink_radio_status_t radio_status;
-
-	// Local Position
-	mavlink_local_position_ned_t local_position_ned;
-
-	// Global Position
-	mavlink_global_position_int_t global_position_int;
-
-	// Local Position Target
-	mavlink_position_target_local_ned_t position_target_local_ned;
-
-	// Global Position Target
-	mavlink_position_target_global_int_t position_target_global_int;
-
-	// HiRes IMU
-	mavlink_highres_imu_t highres_imu;
-
-	// Attitude
-	mavlink_attitude_t attitude;
-
-	// VFR_HUD
-	mavlink_vfr_hud_t vfr_hud;
-
-	// System Parameters?
-
-
-	// Time Stamps
-	Time_Stamps time_stamps;
-
-	void
-	reset_timestamps()
-	{
-		time_stamps.reset_timestamps();
-	}
-
-};
+void  autopilot_interface_timesync_callback(const mavlink_message_t &message, uint64_t time_usec, void *args);
+void  autopilot_interface_command_ack_callback(const mavlink_message_t &message, uint64_t time_usec, void *args);
+int   autopilot_interface_command_sender(const mavlink_command_long_t &command, void *args);
+void  autopilot_interface_offboard_disabled_callback(const Command_Result &result, void *args);
+void  autopilot_interface_watchdog_callback(uint8_t msgid, bool stale, Watchdog_Action action,
+                                            uint64_t age_usec, void *args);
 
 
 // ----------------------------------------------------------------------------------
@@ -281,17 +212,103 @@ public:
 	char setpoint_send_status;
 	uint64_t write_count;
 
-    	int system_id;
-	int autopilot_id;
+    	// the target, set_target() may change them while the threads run
+	std::atomic<int> system_id;
+	std::atomic<int> autopilot_id;
 	int companion_id;
 
-	Mavlink_Messages current_messages;
+	Telemetry_Store current_messages;
 	mavlink_set_position_target_local_ned_t initial_position;
 
-	void update_setpoint(mavlink_set_position_target_local_ned_t setpoint);
+	/*
+		Telemetry of every sender on the link.  current_messages follows
+		the target only, which start() picks from the first sender heard
+		unless set_target() was called before.  Once picked, the target's
+		entry in the table is current_messages itself.
+	*/
+	Vehicle_Table    vehicles;
+
+	// Arrival rate and jitter of the target's messages, link loss of every sender
+	Rate_Monitor rate_monitor;
+
+	/*
+		Deadlines of the target's streams.  By default gaps are only
+		reported: a heartbeat gap of 1.5 s, and a LOCAL_POSITION_NED gap of
+		POSITION_STALE_GAPS times its gap measured by start() (a fixed
+		POSITION_STALE_FALLBACK_USEC in a session).  Set
+		position_stale_action to WATCHDOG_ACTION_HOLD to also hold until
+		the stream recovers.  Change with watchdog.watch() before start().
+	*/
+	Freshness_Watchdog watchdog;
+	Watchdog_Action    position_stale_action;
+	void handle_watchdog(uint8_t msgid, bool stale, Watchdog_Action action, uint64_t age_usec);
+	Telemetry_Store *get_vehicle(int sysid, int compid);
+	void             set_target(int sysid, int compid);
+
+	/*
+		COMMAND_LONG to the target, matched with its COMMAND_ACK and
+		retransmitted until acknowledged.  The toggle_*() functions
+		return its result, MAV_RESULT_* or COMMAND_RESULT_*.
+	*/
+	Command_Engine commands;
+
+	/*
+		Paces the write thread, 10 Hz by default.  PX4 leaves offboard
+		below 2 Hz.  Change with write_scheduler.set_rate(), also while
+		running.
+	*/
+	Periodic_Scheduler write_scheduler;
+
+	/*
+		Scheduling of the read, write, watchdog and command threads and
+		memory locking, set before start().  start() prints what was
+		applied.
+	*/
+	Realtime_Config realtime;
+
+	// Vehicle clock estimate, kept up to date by the write thread
+	Time_Sync time_sync;
+	uint64_t  timesync_interval_usec;
+	uint32_t  get_vehicle_time_boot_ms();
+	void      handle_timesync(const mavlink_message_t &message, uint64_t time_usec);
+
+	/*
+		Hand a setpoint to the write thread without blocking either
+		side.  Call from one thread only.  Returns its version, which
+		get_written_setpoint_version() reaches once it was sent.
+	*/
+	uint32_t update_setpoint(mavlink_set_position_target_local_ned_t setpoint);
+	uint32_t get_written_setpoint_version();
+
+	/*
+		Queue timed setpoints instead, see Setpoint_Trajectory.  The
+		write thread sends the point interpolated for the time of each
+		write, at its own rate.  In effect until clear_trajectory() or
+		update_setpoint(), call from the same thread as that.
+	*/
+	bool push_trajectory(const Trajectory_Point *points, unsigned num_points);
+	void clear_trajectory();
 	void read_messages();
 	int  write_message(mavlink_message_t message);
 
+	/*
+		Event loop mode, see Swarm_Manager.  start_session() replaces
+		start(): no threads are started, the loop passes every received
+		message to handle_message() and calls write_stream() periodically.
+	*/
+	void start_session();
+	Serial_Port *get_serial_port() { return serial_port; }
+	void handle_message(const mavlink_message_t &message, uint64_t receive_time);
+	void write_stream(uint64_t now);
+
+	/*
+		Receive every message with this id (or MESSAGE_DISPATCH_ALL) on the
+		read thread, rather than only the latest copy in current_messages.
+		Returns a handle for unsubscribe().
+	*/
+	int  subscribe(int msgid, Message_Callback callback, void *context);
+	void unsubscribe(int handle);
+
 	/*
 		Set paramters of PX4 instead of qgroundcontrol
 
@@ -322,6 +339,8 @@ public:
 	void vehicle_armed();
 	void vehicle_disarm();
 	bool is_armed();
+	uint8_t get_landed_state();
+	bool wait_for_landed_state(uint8_t landed_state, uint64_t timeout_usec);
 
 	void start();
 	void stop();
@@ -342,7 +361,28 @@ private:
 	pthread_t read_tid;
 	pthread_t write_tid;
 
-	mavlink_set_position_target_local_ned_t current_setpoint;
+	// written by update_setpoint() only, the write thread never sees it torn
+	Seqlock<mavlink_set_position_target_local_ned_t> current_setpoint;
+
+	// version of current_setpoint that hold_setpoint() overrides, until the next update
+	std::atomic<uint32_t> hold_version;
+	std::atomic<uint32_t> written_setpoint_version;
+
+	// hold_version the watchdog set, and the one it replaced, for the recovery
+	std::atomic<uint32_t> watchdog_hold_version;
+	std::atomic<uint32_t> watchdog_prior_hold_version;
+
+	Setpoint_Trajectory trajectory;
+
+	Message_Dispatcher subscriptions;
+
+	// sysid << 8 | compid of the target, -1 for any
+	std::atomic<int> target_key;
+	int              adopted_key;   // read thread, target_key vehicles adopted
+	bool is_from_target(const mavlink_message_t &message);
+
+	uint64_t last_timesync_usec;
+	void write_timesync();
 
 	void read_thread();
 	void write_thread(void);
@@ -350,6 +390,9 @@ private:
 	int toggle_offboard_control( bool flag );
 	int toggle_arm_disarm( bool flag );
 	void write_setpoint();
+	void hold_setpoint();
+	void watch_position();
+	static void make_hold_setpoint(mavlink_set_position_target_local_ned_t &sp);
 
 };
 
@@ -0,0 +1,827 @@
+/**
+ * @file command_engine.cpp
+ *
+ * @brief Acknowledged COMMAND_LONG, functions
+ *
+ * COMMAND_ACK matching, RTT based retransmits, futures and callbacks
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "command_engine.h"
+#include "hr_clock.h"
+#include "realtime.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// retransmit timeout before the first round trip was measured
+#define COMMAND_INITIAL_TIMEOUT_USEC 500000
+
+// the thread looks at least this often
+#define COMMAND_IDLE_USEC 1000000
+
+
+// ------------------------------------------------------------------------------
+//   Helper Functions
+// ------------------------------------------------------------------------------
+
+// Whether an ACK for one could be taken for the other
+static bool
+conflicts(const mavlink_command_long_t &a, const mavlink_command_long_t &b)
+{
+	return a.command       == b.command       and
+	       a.target_system == b.target_system and
+	       ( a.target_component == b.target_component or
+	         a.target_component == 0 or b.target_component == 0 );
+}
+
+
+// ----------------------------------------------------------------------------------
+//   Command Engine Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Command_Engine::
+Command_Engine()
+{
+	max_retries              = 5;
+	min_timeout_usec         = 50000;    // 50 ms
+	max_timeout_usec         = 1500000;  // 1.5 s
+	in_progress_timeout_usec = 10000000; // 10 s
+
+	sender         = NULL;
+	sender_context = NULL;
+
+	memset(pending, 0, sizeof(pending));
+	num_completions   = 0;
+	num_transmissions = 0;
+	next_order        = 0;
+
+	memset(round_trips, 0, sizeof(round_trips));
+
+	thread_tid   = 0;
+	time_to_exit = false;
+
+	wheel         = NULL;
+	timer_usec    = UINT64_MAX;
+	wake_loop     = false;
+	waker         = NULL;
+	waker_context = NULL;
+	timer.callback = &check;
+	timer.context  = this;
+
+	// waits on the monotonic clock, like every timestamp
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+	int result = realtime_mutex_init(&lock);
+	if ( result == 0 )
+		result = pthread_cond_init(&changed, &attr);
+
+	pthread_condattr_destroy(&attr);
+
+	if ( result != 0 )
+	{
+		printf("\n command engine init failed\n");
+		throw 1;
+	}
+}
+
+Command_Engine::
+~Command_Engine()
+{
+	stop();
+
+	pthread_cond_destroy(&changed);
+	pthread_mutex_destroy(&lock);
+}
+
+void
+Command_Engine::
+set_sender(Command_Sender sender_, void *context_)
+{
+	sender         = sender_;
+	sender_context = context_;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Send
+// ------------------------------------------------------------------------------
+bool
+Command_Engine::
+send(const mavlink_command_long_t &command, Command_Future *future,
+     Command_Callback callback, void *context)
+{
+	uint64_t now = hr_clock_usec();
+
+	if ( future )
+		future->done.store(false);
+
+	pthread_mutex_lock(&lock);
+
+	Pending *slot = NULL;
+	for (int i = 0; i < COMMAND_ENGINE_MAX_PENDING and slot == NULL; i++)
+		if ( not pending[i].used )
+			slot = &pending[i];
+
+	// first send of a thread-less engine
+	if ( slot and not thread_tid and not wheel )
+		start_thread();
+
+	Pending entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.used         = true;
+	entry.command      = command;
+	entry.future       = future;
+	entry.callback     = callback;
+	entry.context      = context;
+	entry.order        = next_order++;
+	entry.rtt          = round_trip(command.target_system, command.target_component);
+	entry.command.confirmation = 0;
+
+	bool started = false;
+
+	if ( slot == NULL )
+	{
+		fprintf(stderr,"WARNING: %d commands outstanding, command %u dropped\n",
+		        COMMAND_ENGINE_MAX_PENDING, command.command);
+		complete(entry, COMMAND_RESULT_BUSY, now);
+	}
+
+	// an ACK could not tell the two apart, wait for the one before
+	else if ( is_blocked(command) )
+	{
+		entry.queued = true;
+		*slot   = entry;
+		started = true;
+	}
+
+	// a failed write completes it with COMMAND_RESULT_SEND_FAILED
+	else
+	{
+		*slot = entry;
+		transmit(*slot, now);
+		started = true;
+	}
+
+	pthread_cond_broadcast(&changed);
+
+	run_deferred();
+
+	pthread_mutex_unlock(&lock);
+
+	return started;
+}
+
+// Count the attempt, set its deadline and queue the write for run_deferred(),
+// lock held
+void
+Command_Engine::
+transmit(Pending &entry, uint64_t now_usec)
+{
+	entry.command.confirmation = (uint8_t)std::min(entry.attempts, 255u);
+	entry.attempts++;
+	entry.sent_usec     = now_usec;
+	entry.deadline_usec = now_usec + entry.rtt->rto_usec;
+
+	// the loop's timer is set for later, have it moved
+	if ( wheel and entry.deadline_usec < timer_usec )
+	{
+		timer_usec = entry.deadline_usec;
+		wake_loop  = true;
+	}
+
+	// a command is sent at most once between two run_deferred()
+	Transmission &transmission = transmissions[num_transmissions++];
+	transmission.slot    = (int)(&entry - pending);
+	transmission.order   = entry.order;
+	transmission.command = entry.command;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Queue
+// ------------------------------------------------------------------------------
+
+// Whether a command conflicting with this one is outstanding or queued, lock held
+bool
+Command_Engine::
+is_blocked(const mavlink_command_long_t &command) const
+{
+	for (int i = 0; i < COMMAND_ENGINE_MAX_PENDING; i++)
+		if ( pending[i].used and conflicts(pending[i].command, command) )
+			return true;
+
+	return false;
+}
+
+// A command completed, send every queued one it held up that is not still
+// held up by another outstanding one or an older queued one, e.g. both
+// components waiting on a broadcast, lock held
+void
+Command_Engine::
+start_next(const mavlink_command_long_t &command, uint64_t now_usec)
+{
+	if ( time_to_exit )
+		return;
+
+	for (int i = 0; i < COMMAND_ENGINE_MAX_PENDING; i++)
+	{
+		Pending &next = pending[i];
+		if ( not next.used or not next.queued or not conflicts(next.command, command) )
+			continue;
+
+		bool held = false;
+		for (int j = 0; j < COMMAND_ENGINE_MAX_PENDING and not held; j++)
+		{
+			const Pending &other = pending[j];
+			held = j != i and other.used and conflicts(other.command, next.command) and
+			       ( not other.queued or (int32_t)(other.order - next.order) < 0 );
+		}
+
+		if ( held )
+			continue;
+
+		next.queued = false;
+		transmit(next, now_usec);
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Complete
+// ------------------------------------------------------------------------------
+
+// Settle the future now and queue the callback, lock held
+void
+Command_Engine::
+complete(Pending &entry, int result, uint64_t now_usec)
+{
+	Command_Result outcome;
+	outcome.command  = entry.command.command;
+	outcome.result   = result;
+	outcome.attempts = entry.attempts;
+	outcome.rtt_usec = entry.attempts ? now_usec - entry.sent_usec : 0;
+
+	if ( entry.future )
+	{
+		entry.future->result = outcome;
+		entry.future->done.store(true, std::memory_order_release);
+	}
+
+	if ( entry.callback and num_completions < COMMAND_ENGINE_MAX_PENDING )
+	{
+		Completion &completion = completions[num_completions++];
+		completion.callback = entry.callback;
+		completion.context  = entry.context;
+		completion.result   = outcome;
+	}
+
+	entry.used = false;
+
+	if ( not entry.queued )
+		start_next(entry.command, now_usec);
+
+	pthread_cond_broadcast(&changed);
+}
+
+// Writes and callbacks run without the lock, so a slow port never holds up
+// the read thread and callbacks may send() again, lock held
+void
+Command_Engine::
+run_deferred()
+{
+	while ( num_transmissions or num_completions or wake_loop )
+	{
+		Transmission writes[COMMAND_ENGINE_MAX_PENDING];
+		unsigned num_writes = num_transmissions;
+		memcpy(writes, transmissions, num_writes * sizeof(Transmission));
+		num_transmissions = 0;
+
+		Completion ready[COMMAND_ENGINE_MAX_PENDING];
+		unsigned num_ready = num_completions;
+		memcpy(ready, completions, num_ready * sizeof(Completion));
+		num_completions = 0;
+
+		Command_Sender send_command = sender;
+		void          *send_context = sender_context;
+
+		Command_Waker wake_command = wake_loop ? waker : NULL;
+		void         *wake_context = waker_context;
+		wake_loop = false;
+
+		pthread_mutex_unlock(&lock);
+
+		if ( wake_command )
+			wake_command(wake_context);
+
+		bool failed[COMMAND_ENGINE_MAX_PENDING];
+		for (unsigned i = 0; i < num_writes; i++)
+			failed[i] = ( send_command == NULL or send_command(writes[i].command, send_context) <= 0 );
+
+		for (unsigned i = 0; i < num_ready; i++)
+			ready[i].callback(ready[i].result, ready[i].context);
+
+		pthread_mutex_lock(&lock);
+
+		uint64_t now = hr_clock_usec();
+		for (unsigned i = 0; i < num_writes; i++)
+		{
+			if ( not failed[i] )
+				continue;
+
+			fprintf(stderr,"WARNING: could not send command %u\n", writes[i].command.command);
+
+			// unless it completed while the lock was released
+			Pending &entry = pending[writes[i].slot];
+			if ( entry.used and entry.order == writes[i].order )
+				complete(entry, COMMAND_RESULT_SEND_FAILED, now);
+		}
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Wait / Cancel
+// ------------------------------------------------------------------------------
+bool
+Command_Engine::
+wait(Command_Future &future, uint64_t timeout_usec)
+{
+	uint64_t end_usec = ( timeout_usec == COMMAND_WAIT_FOREVER ) ?
+	                    COMMAND_WAIT_FOREVER : hr_clock_usec() + timeout_usec;
+
+	struct timespec deadline;
+	hr_clock_monotonic_timespec(end_usec, deadline);
+
+	pthread_mutex_lock(&lock);
+
+	while ( not future.done.load(std::memory_order_acquire) )
+	{
+		int result;
+		if ( end_usec == COMMAND_WAIT_FOREVER )
+			result = pthread_cond_wait(&changed, &lock);
+		else
+			result = pthread_cond_timedwait(&changed, &lock, &deadline);
+
+		if ( result == ETIMEDOUT )
+			break;
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	if ( not future.done.load(std::memory_order_acquire) )
+		cancel(future);
+
+	// it may have completed just before the cancel
+	return future.result.result != COMMAND_RESULT_CANCELLED;
+}
+
+void
+Command_Engine::
+cancel(Command_Future &future)
+{
+	uint64_t now = hr_clock_usec();
+
+	pthread_mutex_lock(&lock);
+
+	for (int i = 0; i < COMMAND_ENGINE_MAX_PENDING; i++)
+		if ( pending[i].used and pending[i].future == &future )
+			complete(pending[i], COMMAND_RESULT_CANCELLED, now);
+
+	run_deferred();
+
+	pthread_mutex_unlock(&lock);
+}
+
+int
+Command_Engine::
+execute(const mavlink_command_long_t &command, uint64_t timeout_usec, Command_Result *result)
+{
+	Command_Future future;
+
+	send(command, &future);
+	wait(future, timeout_usec);
+
+	if ( result )
+		*result = future.result;
+
+	return future.result.result;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Receive
+// ------------------------------------------------------------------------------
+
+// The outstanding command an ACK from sysid / compid answers, lock held
+Command_Engine::Pending *
+Command_Engine::
+find(uint16_t command, int sysid, int compid)
+{
+	for (int i = 0; i < COMMAND_ENGINE_MAX_PENDING; i++)
+	{
+		Pending &entry = pending[i];
+
+		if ( entry.used and not entry.queued and entry.command.command == command and
+		     entry.command.target_system == sysid and
+		     ( entry.command.target_component == 0 or entry.command.target_component == compid ) )
+			return &entry;
+	}
+
+	return NULL;
+}
+
+void
+Command_Engine::
+handle_command_ack(const mavlink_message_t &message, uint64_t time_usec)
+{
+	mavlink_command_ack_t ack;
+	mavlink_msg_command_ack_decode(&message, &ack);
+
+	pthread_mutex_lock(&lock);
+
+	Pending *entry = find(ack.command, message.sysid, message.compid);
+	if ( entry )
+	{
+		// a retransmitted command's ACK could answer any of the copies
+		if ( entry->attempts == 1 and not entry->in_progress )
+			rtt_sample(*entry->rtt, time_usec - entry->sent_usec);
+
+		if ( ack.result == MAV_RESULT_IN_PROGRESS )
+		{
+			entry->in_progress   = true;
+			entry->deadline_usec = time_usec + in_progress_timeout_usec;
+			pthread_cond_broadcast(&changed);
+		}
+		else
+			complete(*entry, ack.result, time_usec);
+	}
+
+	run_deferred();
+
+	pthread_mutex_unlock(&lock);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Retransmit Thread
+// ------------------------------------------------------------------------------
+void
+Command_Engine::
+set_thread_config(const Realtime_Thread_Config &config)
+{
+	pthread_mutex_lock(&lock);
+	thread_config = config;
+	pthread_mutex_unlock(&lock);
+}
+
+// Unless armed on a loop
+void
+Command_Engine::
+start()
+{
+	pthread_mutex_lock(&lock);
+
+	if ( not thread_tid and not wheel )
+		start_thread();
+
+	pthread_mutex_unlock(&lock);
+}
+
+pthread_t
+Command_Engine::
+get_thread()
+{
+	pthread_mutex_lock(&lock);
+	pthread_t tid = thread_tid;
+	pthread_mutex_unlock(&lock);
+
+	return tid;
+}
+
+void
+Command_Engine::
+stop()
+{
+	pthread_mutex_lock(&lock);
+
+	pthread_t tid = thread_tid;
+	time_to_exit  = true;
+	pthread_cond_broadcast(&changed);
+
+	pthread_mutex_unlock(&lock);
+
+	if ( tid )
+		pthread_join(tid, NULL);
+
+	pthread_mutex_lock(&lock);
+
+	thread_tid = 0;
+
+	// nothing retransmits them any more
+	uint64_t now = hr_clock_usec();
+	for (int i = 0; i < COMMAND_ENGINE_MAX_PENDING; i++)
+		if ( pending[i].used )
+			complete(pending[i], COMMAND_RESULT_CANCELLED, now);
+
+	run_deferred();
+
+	pthread_mutex_unlock(&lock);
+}
+
+void
+Command_Engine::
+run_thread()
+{
+	pthread_mutex_lock(&lock);
+	size_t stack_size = thread_config.stack_size;
+	pthread_mutex_unlock(&lock);
+
+	if ( realtime_memory_locked() )
+		realtime_prefault_stack(stack_size);
+
+	pthread_mutex_lock(&lock);
+
+	while ( not time_to_exit )
+	{
+		uint64_t now  = hr_clock_usec();
+		uint64_t next = std::min(retransmit(now), now + COMMAND_IDLE_USEC);
+
+		run_deferred();
+
+		if ( time_to_exit )
+			break;
+
+		struct timespec deadline;
+		hr_clock_monotonic_timespec(next, deadline);
+
+		pthread_cond_timedwait(&changed, &lock, &deadline);
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+// The retransmit thread, lock held
+void
+Command_Engine::
+start_thread()
+{
+	time_to_exit = false;
+
+	if ( realtime_create_thread(&thread_tid, thread_config, &start_command_engine_thread, this) )
+	{
+		thread_tid = 0;
+		pthread_mutex_unlock(&lock);
+		fprintf(stderr,"ERROR: could not start the command engine thread\n");
+		throw 1;
+	}
+}
+
+// Repeat or time out the overdue commands, returns the next deadline or
+// UINT64_MAX, lock held
+uint64_t
+Command_Engine::
+retransmit(uint64_t now_usec)
+{
+	uint64_t next = UINT64_MAX;
+
+	for (int i = 0; i < COMMAND_ENGINE_MAX_PENDING; i++)
+	{
+		Pending &entry = pending[i];
+		if ( not entry.used or entry.queued )
+			continue;
+
+		if ( now_usec >= entry.deadline_usec )
+		{
+			if ( entry.in_progress or entry.attempts > max_retries )
+			{
+				complete(entry, COMMAND_RESULT_TIMEOUT, now_usec);
+				continue;
+			}
+
+			rtt_backoff(*entry.rtt);
+			transmit(entry, now_usec);
+		}
+
+		next = std::min(next, entry.deadline_usec);
+	}
+
+	return next;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Event Loop
+// ------------------------------------------------------------------------------
+void
+Command_Engine::
+arm(Timer_Wheel *wheel_, Command_Waker waker_, void *waker_context_)
+{
+	pthread_mutex_lock(&lock);
+
+	if ( thread_tid )
+	{
+		pthread_mutex_unlock(&lock);
+		fprintf(stderr,"ERROR: command engine thread already running\n");
+		return;
+	}
+
+	wheel         = wheel_;
+	waker         = waker_;
+	waker_context = waker_context_;
+
+	// commands sent before are looked at right away
+	timer_usec = hr_clock_usec();
+
+	pthread_mutex_unlock(&lock);
+
+	wheel_->schedule(&timer, timer_usec);
+}
+
+void
+Command_Engine::
+disarm()
+{
+	pthread_mutex_lock(&lock);
+
+	Timer_Wheel *wheel_ = wheel;
+	wheel      = NULL;
+	timer_usec = UINT64_MAX;
+	wake_loop  = false;
+
+	// outstanding commands go on from our own thread
+	bool outstanding = false;
+	for (int i = 0; i < COMMAND_ENGINE_MAX_PENDING; i++)
+		outstanding = outstanding or pending[i].used;
+
+	if ( wheel_ and outstanding and not thread_tid )
+		start_thread();
+
+	pthread_mutex_unlock(&lock);
+
+	if ( wheel_ )
+		wheel_->cancel(&timer);
+}
+
+// After the waker was called, on the loop's thread
+void
+Command_Engine::
+reschedule()
+{
+	pthread_mutex_lock(&lock);
+	Timer_Wheel *wheel_ = wheel;
+	uint64_t     next   = timer_usec;
+	pthread_mutex_unlock(&lock);
+
+	if ( wheel_ == NULL )
+		return;
+
+	if ( next == UINT64_MAX )
+		wheel_->cancel(&timer);
+	else
+		wheel_->schedule(&timer, next);
+}
+
+void
+Command_Engine::
+check(Wheel_Timer *timer_, uint64_t now_usec, void *context)
+{
+	Command_Engine *engine = (Command_Engine *)context;
+
+	pthread_mutex_lock(&engine->lock);
+
+	// queued commands started on the way lower it again
+	engine->timer_usec = UINT64_MAX;
+	uint64_t next = engine->retransmit(now_usec);
+	engine->timer_usec = std::min(engine->timer_usec, next);
+
+	// this is the loop, it reschedules itself
+	engine->wake_loop = false;
+
+	engine->run_deferred();
+
+	next = engine->timer_usec;
+	Timer_Wheel *wheel_ = engine->wheel;
+
+	pthread_mutex_unlock(&engine->lock);
+
+	if ( wheel_ and next != UINT64_MAX )
+		wheel_->schedule(timer_, next);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Round Trip Estimate
+// ------------------------------------------------------------------------------
+
+// The estimate of one target, a new one if there is room, lock held
+Command_Engine::Round_Trip *
+Command_Engine::
+round_trip(uint8_t target_system, uint8_t target_component)
+{
+	for (int i = 0; i < COMMAND_ENGINE_MAX_TARGETS; i++)
+	{
+		Round_Trip &rtt = round_trips[i];
+
+		if ( not rtt.used )
+		{
+			rtt.used             = true;
+			rtt.target_system    = target_system;
+			rtt.target_component = target_component;
+			rtt.srtt_usec        = 0;
+			rtt.rttvar_usec      = 0;
+			rtt.rto_usec         = COMMAND_INITIAL_TIMEOUT_USEC;
+			return &rtt;
+		}
+
+		if ( rtt.target_system == target_system and rtt.target_component == target_component )
+			return &rtt;
+	}
+
+	// out of room, share the last one
+	return &round_trips[COMMAND_ENGINE_MAX_TARGETS - 1];
+}
+
+// Jacobson / Karels, as TCP, lock held
+void
+Command_Engine::
+rtt_sample(Round_Trip &rtt, uint64_t rtt_usec)
+{
+	if ( rtt.srtt_usec == 0 )
+	{
+		rtt.srtt_usec   = rtt_usec;
+		rtt.rttvar_usec = rtt_usec / 2;
+	}
+	else
+	{
+		uint64_t error = rtt_usec > rtt.srtt_usec ? rtt_usec - rtt.srtt_usec : rtt.srtt_usec - rtt_usec;
+		rtt.rttvar_usec = ( 3 * rtt.rttvar_usec + error ) / 4;
+		rtt.srtt_usec   = ( 7 * rtt.srtt_usec + rtt_usec ) / 8;
+	}
+
+	rtt.rto_usec = std::max(min_timeout_usec, std::min(max_timeout_usec, rtt.srtt_usec + 4 * rtt.rttvar_usec));
+}
+
+void
+Command_Engine::
+rtt_backoff(Round_Trip &rtt)
+{
+	rtt.rto_usec = std::min(max_timeout_usec, 2 * rtt.rto_usec);
+}
+
+uint64_t
+Command_Engine::
+get_timeout_usec(uint8_t target_system, uint8_t target_component)
+{
+	pthread_mutex_lock(&lock);
+	uint64_t result = round_trip(target_system, target_component)->rto_usec;
+	pthread_mutex_unlock(&lock);
+
+	return result;
+}
+
+uint64_t
+Command_Engine::
+get_srtt_usec(uint8_t target_system, uint8_t target_component)
+{
+	pthread_mutex_lock(&lock);
+	uint64_t result = round_trip(target_system, target_component)->srtt_usec;
+	pthread_mutex_unlock(&lock);
+
+	return result;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Pthread Starter Helper Function
+// ------------------------------------------------------------------------------
+void*
+start_command_engine_thread(void *args)
+{
+	// takes a command engine object argument
+	Command_Engine *engine = (Command_Engine *)args;
+
+	// run the object's retransmit loop
+	engine->run_thread();
+
+	// done!
+	return NULL;
+}
+
@@ -0,0 +1,248 @@
+/**
+ * @file command_engine.h
+ *
+ * @brief Acknowledged COMMAND_LONG, definition
+ *
+ * Sends commands, matches their COMMAND_ACK and retransmits lost ones.
+ */
+
+#ifndef COMMAND_ENGINE_H_
+#define COMMAND_ENGINE_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "timer_wheel.h"
+#include "realtime.h"
+
+#include <atomic>
+#include <pthread.h>
+#include <stdint.h>
+
+#include <common/mavlink.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// commands outstanding or queued at once
+#define COMMAND_ENGINE_MAX_PENDING 32
+
+// components with a round trip estimate of their own
+#define COMMAND_ENGINE_MAX_TARGETS 16
+
+// timeout for Command_Engine::wait() that never expires
+#define COMMAND_WAIT_FOREVER UINT64_MAX
+
+// Command_Result::result beyond MAV_RESULT_*
+#define COMMAND_RESULT_TIMEOUT     -1   // no final COMMAND_ACK after every retry
+#define COMMAND_RESULT_SEND_FAILED -2   // could not be written
+#define COMMAND_RESULT_BUSY        -3   // too many commands outstanding
+#define COMMAND_RESULT_CANCELLED   -4   // cancel(), or wait() gave up
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+struct Command_Result
+{
+	uint16_t command;      // MAV_CMD_*
+	int      result;       // MAV_RESULT_* or COMMAND_RESULT_*
+	unsigned attempts;     // times sent
+	uint64_t rtt_usec;     // last send to COMMAND_ACK
+};
+
+// Filled in when the command completes, see Command_Engine::wait()
+struct Command_Future
+{
+	std::atomic<bool> done;
+	Command_Result    result;
+
+	Command_Future() : done(false) { }
+};
+
+// Completion, on the read thread or the engine's thread
+typedef void (*Command_Callback)(const Command_Result &result, void *context);
+
+// Writes one COMMAND_LONG, returns the bytes written
+typedef int (*Command_Sender)(const mavlink_command_long_t &command, void *context);
+
+// Wakes the event loop the engine is armed on, from any thread, see arm()
+typedef void (*Command_Waker)(void *context);
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+void* start_command_engine_thread(void *args);
+
+
+// ----------------------------------------------------------------------------------
+//   Command Engine Class
+// ----------------------------------------------------------------------------------
+/*
+ * Command Engine Class
+ *
+ * Each command is outstanding until a COMMAND_ACK for the same command id
+ * comes from the system (and component, unless broadcast) it was sent to.
+ * Without one it is sent again with confirmation incremented, after a
+ * timeout that follows the measured round trip (srtt + 4 x rttvar, as TCP,
+ * doubled on every loss), at most max_retries times.  The round trip is
+ * measured per target component.  MAV_RESULT_IN_PROGRESS
+ * stops the retransmits, the final ACK then has in_progress_timeout_usec to
+ * arrive.
+ *
+ * The result is delivered to a Command_Future, a callback, or both; the
+ * future must stay in scope until the command completes or is cancelled.
+ *
+ * Commands to different components, or different commands to the same
+ * one, are outstanding at the same time, so a slow gimbal never holds up
+ * the autopilot.  A COMMAND_ACK cannot tell two of the same command to the
+ * same component apart, so such a command waits in a queue until the one
+ * before it completes; they are sent in the order given.  A broadcast
+ * (component 0) conflicts with every component.
+ *
+ * Retransmits run on a thread of the engine's own, started on the first
+ * send(), or on an event loop's timer wheel given to arm().  A command sent
+ * from another thread then calls the waker, and the loop calls reschedule()
+ * on its own thread, since the wheel is not thread safe.
+ */
+class Command_Engine
+{
+
+public:
+
+	Command_Engine();
+	~Command_Engine();
+
+	unsigned max_retries;                // default 5
+	uint64_t min_timeout_usec;           // default 50 ms
+	uint64_t max_timeout_usec;           // default 1.5 s
+	uint64_t in_progress_timeout_usec;   // default 10 s
+
+	void set_sender(Command_Sender sender_, void *context_);
+
+	// Start or queue a command, false if there was no room for it (busy)
+	bool send(const mavlink_command_long_t &command, Command_Future *future = NULL,
+	          Command_Callback callback = NULL, void *context = NULL);
+
+	// Block until the command completes, cancels it on timeout
+	bool wait(Command_Future &future, uint64_t timeout_usec);
+	void cancel(Command_Future &future);
+
+	// send() and wait(), returns the result
+	int execute(const mavlink_command_long_t &command, uint64_t timeout_usec = COMMAND_WAIT_FOREVER,
+	            Command_Result *result = NULL);
+
+	void handle_command_ack(const mavlink_message_t &message, uint64_t time_usec);
+
+	// of one target, see Command_Engine class comment
+	uint64_t get_timeout_usec(uint8_t target_system, uint8_t target_component);
+	uint64_t get_srtt_usec(uint8_t target_system, uint8_t target_component);
+
+	// Own retransmit thread, also started by the first send()
+	void set_thread_config(const Realtime_Thread_Config &config);
+	void start();
+	void stop();
+	void run_thread();
+	pthread_t get_thread();
+
+	// Or somebody else's wheel, from the thread that advances it
+	void arm(Timer_Wheel *wheel_, Command_Waker waker_, void *waker_context_);
+	void disarm();
+	void reschedule();
+
+private:
+
+	struct Round_Trip
+	{
+		bool     used;
+		uint8_t  target_system;
+		uint8_t  target_component;
+		uint64_t srtt_usec;
+		uint64_t rttvar_usec;
+		uint64_t rto_usec;
+	};
+
+	struct Pending
+	{
+		bool                   used;
+		mavlink_command_long_t command;
+		Command_Future        *future;
+		Command_Callback       callback;
+		void                  *context;
+		unsigned               attempts;
+		bool                   in_progress;
+		bool                   queued;       // behind a conflicting command
+		uint32_t               order;        // queue position, tells writes apart
+		Round_Trip            *rtt;          // of the target
+		uint64_t               sent_usec;
+		uint64_t               deadline_usec;
+	};
+
+	struct Completion
+	{
+		Command_Callback callback;
+		void            *context;
+		Command_Result   result;
+	};
+
+	struct Transmission
+	{
+		int                    slot;    // in pending
+		uint32_t               order;   // of the command, it may complete meanwhile
+		mavlink_command_long_t command;
+	};
+
+	Command_Sender sender;
+	void          *sender_context;
+
+	// guarded by lock
+	Pending    pending[COMMAND_ENGINE_MAX_PENDING];
+	Completion completions[COMMAND_ENGINE_MAX_PENDING];
+	unsigned   num_completions;
+	Transmission transmissions[COMMAND_ENGINE_MAX_PENDING];
+	unsigned     num_transmissions;
+	uint32_t   next_order;
+
+	Round_Trip round_trips[COMMAND_ENGINE_MAX_TARGETS];
+
+	pthread_t              thread_tid;
+	Realtime_Thread_Config thread_config;
+	bool                   time_to_exit;
+	pthread_mutex_t lock;
+	pthread_cond_t  changed;
+
+	// event loop, wheel guarded by lock, timer by the loop's thread
+	Timer_Wheel  *wheel;
+	Wheel_Timer   timer;
+	uint64_t      timer_usec;   // when the timer should fire, UINT64_MAX idle
+	bool          wake_loop;    // timer_usec moved earlier, see transmit()
+	Command_Waker waker;
+	void         *waker_context;
+
+	Pending *find(uint16_t command, int sysid, int compid);
+	void     transmit(Pending &entry, uint64_t now_usec);
+	bool     is_blocked(const mavlink_command_long_t &command) const;
+	void     start_next(const mavlink_command_long_t &command, uint64_t now_usec);
+	void     complete(Pending &entry, int result, uint64_t now_usec);
+	void     run_deferred();
+	uint64_t retransmit(uint64_t now_usec);
+	void     start_thread();
+
+	static void check(Wheel_Timer *timer_, uint64_t now_usec, void *context);
+
+	Round_Trip *round_trip(uint8_t target_system, uint8_t target_component);
+	void rtt_sample(Round_Trip &rtt, uint64_t rtt_usec);
+	void rtt_backoff(Round_Trip &rtt);
+
+	Command_Engine(const Command_Engine &);
+	Command_Engine &operator=(const Command_Engine &);
+
+};
+
+#endif // COMMAND_ENGINE_H_
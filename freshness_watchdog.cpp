@@ -0,0 +1,299 @@
+/**
+ * @file freshness_watchdog.cpp
+ *
+ * @brief Telemetry freshness watchdog, functions
+ *
+ * Per stream deadlines on a timer wheel, lazily re-armed
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "freshness_watchdog.h"
+#include "hr_clock.h"
+#include "realtime.h"
+
+#include <stdio.h>
+#include <time.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// own thread's wheel resolution
+#define WATCHDOG_TICK_USEC 1000
+
+
+// ----------------------------------------------------------------------------------
+//   Freshness Watchdog Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Freshness_Watchdog::
+Freshness_Watchdog()
+	: own_wheel(WATCHDOG_TICK_USEC)
+{
+	num_streams = 0;
+	for (int i = 0; i < 256; i++)
+		stream_of[i] = -1;
+
+	callback = NULL;
+	context  = NULL;
+	wheel    = NULL;
+
+	thread_tid        = 0;
+	thread_stack_size = 0;
+	time_to_exit      = false;
+
+	// sleeps on the monotonic clock, like every timestamp
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+	int result = realtime_mutex_init(&lock);
+	if ( result == 0 )
+		result = pthread_cond_init(&wake, &attr);
+
+	pthread_condattr_destroy(&attr);
+
+	if ( result != 0 )
+	{
+		printf("\n watchdog init failed\n");
+		throw 1;
+	}
+}
+
+Freshness_Watchdog::
+~Freshness_Watchdog()
+{
+	stop();
+	disarm();
+
+	pthread_cond_destroy(&wake);
+	pthread_mutex_destroy(&lock);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Configuration
+// ------------------------------------------------------------------------------
+bool
+Freshness_Watchdog::
+watch(uint8_t msgid, uint64_t deadline_usec, Watchdog_Action action)
+{
+	if ( wheel )
+	{
+		fprintf(stderr,"ERROR: watchdog already armed\n");
+		return false;
+	}
+
+	// watched already, change its deadline
+	int index = stream_of[msgid];
+	if ( index < 0 )
+	{
+		if ( num_streams == WATCHDOG_MAX_STREAMS )
+		{
+			fprintf(stderr,"ERROR: watchdog can watch at most %d streams\n", WATCHDOG_MAX_STREAMS);
+			return false;
+		}
+
+		index = num_streams++;
+		stream_of[msgid] = (int8_t)index;
+	}
+
+	Stream &stream = streams[index];
+	stream.msgid         = msgid;
+	stream.deadline_usec = deadline_usec;
+	stream.action        = action;
+	stream.last_usec.store(0);
+	stream.stale.store(false);
+	stream.armed_usec    = 0;
+	stream.owner         = this;
+	stream.timer.callback = &check;
+	stream.timer.context  = &stream;
+
+	return true;
+}
+
+void
+Freshness_Watchdog::
+set_callback(Watchdog_Callback callback_, void *context_)
+{
+	callback = callback_;
+	context  = context_;
+}
+
+bool
+Freshness_Watchdog::
+is_stale(uint8_t msgid) const
+{
+	int index = stream_of[msgid];
+	if ( index < 0 )
+		return false;
+
+	return streams[index].stale.load(std::memory_order_acquire);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Arm / Disarm
+// ------------------------------------------------------------------------------
+void
+Freshness_Watchdog::
+arm(Timer_Wheel *wheel_, uint64_t now_usec)
+{
+	wheel = wheel_;
+
+	for (unsigned i = 0; i < num_streams; i++)
+	{
+		streams[i].armed_usec = now_usec;
+		wheel->schedule(&streams[i].timer, now_usec + streams[i].deadline_usec);
+	}
+}
+
+void
+Freshness_Watchdog::
+disarm()
+{
+	if ( wheel == NULL )
+		return;
+
+	for (unsigned i = 0; i < num_streams; i++)
+		wheel->cancel(&streams[i].timer);
+
+	wheel = NULL;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Deadline Check
+// ------------------------------------------------------------------------------
+void
+Freshness_Watchdog::
+check(Wheel_Timer *timer, uint64_t now_usec, void *context)
+{
+	Stream &stream = *(Stream *)context;
+	Freshness_Watchdog *owner = stream.owner;
+
+	uint64_t last = stream.last_usec.load(std::memory_order_acquire);
+	uint64_t since = last > stream.armed_usec ? last : stream.armed_usec;
+	uint64_t expiry = since + stream.deadline_usec;
+
+	// newer messages moved the deadline, follow it
+	if ( now_usec < expiry )
+	{
+		owner->wheel->schedule(timer, expiry);
+		return;
+	}
+
+	// keep checking while stale, the receive path raises the recovery
+	owner->wheel->schedule(timer, now_usec + stream.deadline_usec);
+
+	if ( stream.stale.exchange(true) )
+		return;
+
+	if ( owner->callback )
+		owner->callback(stream.msgid, true, stream.action, now_usec - since, owner->context);
+}
+
+void
+Freshness_Watchdog::
+recover(Stream &stream)
+{
+	if ( not stream.stale.exchange(false) )
+		return;
+
+	if ( callback )
+		callback(stream.msgid, false, stream.action, 0, context);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Own Thread
+// ------------------------------------------------------------------------------
+void
+Freshness_Watchdog::
+start(const Realtime_Thread_Config &config)
+{
+	if ( thread_tid )
+		return;
+
+	time_to_exit      = false;
+	thread_stack_size = config.stack_size;
+	arm(&own_wheel, hr_clock_usec());
+
+	int result = realtime_create_thread( &thread_tid, config, &start_freshness_watchdog_thread, this );
+	if ( result ) throw result;
+}
+
+void
+Freshness_Watchdog::
+stop()
+{
+	if ( not thread_tid )
+		return;
+
+	pthread_mutex_lock(&lock);
+	time_to_exit = true;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+
+	pthread_join(thread_tid, NULL);
+	thread_tid = 0;
+
+	disarm();
+}
+
+void
+Freshness_Watchdog::
+run_thread()
+{
+	if ( realtime_memory_locked() )
+		realtime_prefault_stack(thread_stack_size);
+
+	pthread_mutex_lock(&lock);
+
+	while ( !time_to_exit )
+	{
+		pthread_mutex_unlock(&lock);
+		own_wheel.advance(hr_clock_usec());
+		uint64_t next = own_wheel.next_deadline();
+		pthread_mutex_lock(&lock);
+
+		if ( time_to_exit )
+			break;
+
+		if ( next == UINT64_MAX )
+			next = hr_clock_usec() + 1000000;
+
+		struct timespec deadline;
+		hr_clock_monotonic_timespec(next, deadline);
+
+		pthread_cond_timedwait(&wake, &lock, &deadline);
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Pthread Starter Helper Function
+// ------------------------------------------------------------------------------
+void*
+start_freshness_watchdog_thread(void *args)
+{
+	// takes a watchdog object argument
+	Freshness_Watchdog *watchdog = (Freshness_Watchdog *)args;
+
+	// run the object's timer loop
+	watchdog->run_thread();
+
+	// done!
+	return NULL;
+}
+
@@ -0,0 +1,159 @@
+/**
+ * @file freshness_watchdog.h
+ *
+ * @brief Telemetry freshness watchdog, definition
+ *
+ * Notices when a message stream stops arriving, within its deadline.
+ */
+
+#ifndef FRESHNESS_WATCHDOG_H_
+#define FRESHNESS_WATCHDOG_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "timer_wheel.h"
+#include "realtime.h"
+
+#include <atomic>
+#include <pthread.h>
+#include <stdint.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// streams one watchdog can watch
+#define WATCHDOG_MAX_STREAMS 16
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+// What the owner should do when a stream goes stale
+enum Watchdog_Action
+{
+	WATCHDOG_ACTION_NONE = 0,
+	WATCHDOG_ACTION_HOLD,               // stay put
+	WATCHDOG_ACTION_DISABLE_OFFBOARD,   // hand control back to the autopilot
+};
+
+/*
+ * Staleness / recovery event.  Stale events are raised on the watchdog's
+ * timer thread, recovery events on the receive path, so a handler must not
+ * block either.  age_usec is the time since the last message.
+ */
+typedef void (*Watchdog_Callback)(uint8_t msgid, bool stale, Watchdog_Action action,
+                                  uint64_t age_usec, void *context);
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+void* start_freshness_watchdog_thread(void *args);
+
+
+// ----------------------------------------------------------------------------------
+//   Freshness Watchdog Class
+// ----------------------------------------------------------------------------------
+/*
+ * Freshness Watchdog Class
+ *
+ * Each watched stream has a deadline.  The receive path only stores the
+ * arrival time of its messages (received()), it never touches a timer.  Each
+ * stream has one timer on a Timer_Wheel, armed for last arrival + deadline;
+ * when it fires early because newer messages came in, it is re-armed for
+ * the new expiry, so a 30 Hz stream with a 200 ms deadline costs one timer
+ * operation per 200 ms rather than one per message.  When it fires and
+ * nothing arrived, the stream is stale and the callback runs; it keeps
+ * checking once per deadline.  The first message afterwards raises the
+ * recovery event.
+ *
+ * The wheel is either the watchdog's own, run by a thread from start(), or
+ * an event loop's, given to arm() on that loop's thread.
+ */
+class Freshness_Watchdog
+{
+
+public:
+
+	Freshness_Watchdog();
+	~Freshness_Watchdog();
+
+	// Configuration, before start() / arm()
+	bool watch(uint8_t msgid, uint64_t deadline_usec, Watchdog_Action action = WATCHDOG_ACTION_NONE);
+	void set_callback(Watchdog_Callback callback_, void *context_);
+
+	// Receive path: a message with this id arrived
+	void
+	received(uint8_t msgid, uint64_t time_usec)
+	{
+		int index = stream_of[msgid];
+		if ( index < 0 )
+			return;
+
+		Stream &stream = streams[index];
+		stream.last_usec.store(time_usec, std::memory_order_release);
+
+		if ( stream.stale.load(std::memory_order_relaxed) )
+			recover(stream);
+	}
+
+	bool is_stale(uint8_t msgid) const;
+	bool is_watched(uint8_t msgid) const { return stream_of[msgid] >= 0; }
+
+	// Own timer thread, with the scheduling of config
+	void start(const Realtime_Thread_Config &config = Realtime_Thread_Config());
+	void stop();
+	void run_thread();
+	pthread_t get_thread() const { return thread_tid; }
+
+	// Or somebody else's wheel, from the thread that advances it
+	void arm(Timer_Wheel *wheel_, uint64_t now_usec);
+	void disarm();
+
+private:
+
+	struct Stream
+	{
+		uint8_t                msgid;
+		uint64_t               deadline_usec;
+		Watchdog_Action        action;
+		std::atomic<uint64_t>  last_usec;
+		std::atomic<bool>      stale;
+		uint64_t               armed_usec;    // expiry counts from here before the first message
+		Wheel_Timer            timer;
+		Freshness_Watchdog    *owner;
+	};
+
+	Stream   streams[WATCHDOG_MAX_STREAMS];
+	unsigned num_streams;
+	int8_t   stream_of[256];
+
+	Watchdog_Callback callback;
+	void             *context;
+
+	Timer_Wheel *wheel;
+
+	// own thread
+	Timer_Wheel      own_wheel;
+	pthread_t        thread_tid;
+	size_t           thread_stack_size;
+	bool             time_to_exit;
+	pthread_mutex_t  lock;
+	pthread_cond_t   wake;
+
+	void recover(Stream &stream);
+	static void check(Wheel_Timer *timer, uint64_t now_usec, void *context);
+
+	Freshness_Watchdog(const Freshness_Watchdog &);
+	Freshness_Watchdog &operator=(const Freshness_Watchdog &);
+
+};
+
+#endif // FRESHNESS_WATCHDOG_H_
+
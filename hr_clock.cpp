@@ -0,0 +1,214 @@
+/**
+ * @file hr_clock.cpp
+ *
+ * @brief Monotonic high resolution clock, functions
+ *
+ * CLOCK_MONOTONIC with optional TSC fast path, wall-clock mapping
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "hr_clock.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <time.h>
+
+// the scaling needs 128 bit products, so x86-64 only
+#if defined(HR_CLOCK_USE_TSC) && defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HR_CLOCK_HAVE_TSC 1
+#endif
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// wall-clock offset is taken from the tightest of this many bracketed reads
+#define HR_CLOCK_WALL_SAMPLES 8
+
+// TSC calibration interval
+#define HR_CLOCK_TSC_CALIBRATION_NSEC 20000000
+
+
+// ------------------------------------------------------------------------------
+//   Helper Functions
+// ------------------------------------------------------------------------------
+
+static uint64_t
+read_clock_nsec(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// wall usec minus monotonic usec, stored as two's complement
+static std::atomic<uint64_t> wall_offset_usec(0);
+static std::atomic<bool>     wall_calibrated(false);
+
+
+#ifdef HR_CLOCK_HAVE_TSC
+
+/*
+ * nsec = base_nsec + ((tsc - base_tsc) * mult) >> 32
+ *
+ * Written once during calibration, which is serialized by the function
+ * local static in tsc_clock().
+ */
+struct Tsc_Clock
+{
+	bool     usable;
+	uint64_t base_tsc;
+	uint64_t base_nsec;
+	uint64_t mult;
+
+	Tsc_Clock()
+	{
+		usable = false;
+
+		// invariant TSC: CPUID 0x80000007, EDX bit 8
+		unsigned a, b, c, d;
+		if ( not __get_cpuid(0x80000000, &a, &b, &c, &d) || a < 0x80000007 )
+			return;
+		__get_cpuid(0x80000007, &a, &b, &c, &d);
+		if ( not (d & (1u << 8)) )
+			return;
+
+		uint64_t nsec0 = read_clock_nsec(CLOCK_MONOTONIC);
+		uint64_t tsc0  = __rdtsc();
+
+		uint64_t nsec1;
+		do
+			nsec1 = read_clock_nsec(CLOCK_MONOTONIC);
+		while ( nsec1 - nsec0 < HR_CLOCK_TSC_CALIBRATION_NSEC );
+		uint64_t tsc1 = __rdtsc();
+
+		if ( tsc1 <= tsc0 )
+			return;
+
+		base_tsc  = tsc1;
+		base_nsec = nsec1;
+		mult      = ( (nsec1 - nsec0) << 32 ) / (tsc1 - tsc0);
+		usable    = true;
+	}
+
+	uint64_t
+	nsec() const
+	{
+		unsigned __int128 ticks = __rdtsc() - base_tsc;
+		return base_nsec + (uint64_t)( (ticks * mult) >> 32 );
+	}
+};
+
+static const Tsc_Clock &
+tsc_clock()
+{
+	static const Tsc_Clock clock;
+	return clock;
+}
+
+#endif // HR_CLOCK_HAVE_TSC
+
+
+// ------------------------------------------------------------------------------
+//   Monotonic Time
+// ------------------------------------------------------------------------------
+uint64_t
+hr_clock_nsec()
+{
+#ifdef HR_CLOCK_HAVE_TSC
+	const Tsc_Clock &tsc = tsc_clock();
+	if ( tsc.usable )
+		return tsc.nsec();
+#endif
+
+	// vDSO call, no system call on Linux
+	return read_clock_nsec(CLOCK_MONOTONIC);
+}
+
+uint64_t
+hr_clock_usec()
+{
+	return hr_clock_nsec() / 1000;
+}
+
+void
+hr_clock_monotonic_timespec(uint64_t deadline_usec, struct timespec &deadline)
+{
+	uint64_t now  = hr_clock_usec();
+	uint64_t wait = deadline_usec > now ? deadline_usec - now : 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	uint64_t nsec = (uint64_t)deadline.tv_nsec + (wait % 1000000) * 1000;
+	deadline.tv_sec  += wait / 1000000 + nsec / 1000000000;
+	deadline.tv_nsec  = nsec % 1000000000;
+}
+
+bool
+hr_clock_uses_tsc()
+{
+#ifdef HR_CLOCK_HAVE_TSC
+	return tsc_clock().usable;
+#else
+	return false;
+#endif
+}
+
+
+// ------------------------------------------------------------------------------
+//   Wall Clock Mapping
+// ------------------------------------------------------------------------------
+void
+hr_clock_calibrate_wall()
+{
+	// bracket each wall-clock read between two monotonic reads and keep
+	// the tightest bracket, so a preemption does not skew the offset
+	uint64_t best_width = UINT64_MAX;
+	uint64_t best_offset = 0;
+
+	for (int i = 0; i < HR_CLOCK_WALL_SAMPLES; i++)
+	{
+		uint64_t before = hr_clock_nsec();
+		uint64_t wall   = read_clock_nsec(CLOCK_REALTIME);
+		uint64_t after  = hr_clock_nsec();
+
+		if ( after - before < best_width )
+		{
+			best_width  = after - before;
+			best_offset = wall / 1000 - (before + (after - before) / 2) / 1000;
+		}
+	}
+
+	wall_offset_usec.store(best_offset, std::memory_order_relaxed);
+	wall_calibrated.store(true, std::memory_order_release);
+}
+
+uint64_t
+hr_clock_to_wall_usec(uint64_t mono_usec)
+{
+	if ( not wall_calibrated.load(std::memory_order_acquire) )
+		hr_clock_calibrate_wall();
+
+	return mono_usec + wall_offset_usec.load(std::memory_order_relaxed);
+}
+
+
+void
+hr_clock_format_wall(uint64_t mono_usec, char *buffer, size_t size)
+{
+	uint64_t wall = hr_clock_to_wall_usec(mono_usec);
+
+	time_t seconds = (time_t)(wall / 1000000);
+	struct tm local;
+	localtime_r(&seconds, &local);
+
+	snprintf(buffer, size, "%02d:%02d:%02d.%03u",
+	         local.tm_hour, local.tm_min, local.tm_sec, (unsigned)(wall % 1000000 / 1000));
+}
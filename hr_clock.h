@@ -0,0 +1,71 @@
+/**
+ * @file hr_clock.h
+ *
+ * @brief Monotonic high resolution clock, definition
+ *
+ * Timestamps for everything the interface records or compares, plus a
+ * mapping to wall-clock time for logs.
+ */
+
+#ifndef HR_CLOCK_H_
+#define HR_CLOCK_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+/*
+ * Build with -DHR_CLOCK_USE_TSC on x86-64 hosts with an invariant TSC to read
+ * the time stamp counter directly instead of going through clock_gettime.
+ * The counter is calibrated against CLOCK_MONOTONIC on first use.  Without
+ * an invariant TSC the flag is ignored at run time.
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+/*
+ * Monotonic time since an arbitrary point (usually boot).  Never jumps when
+ * the wall clock is set or slewed by NTP, never allocates, and is safe to
+ * call from any thread.
+ */
+uint64_t hr_clock_nsec();
+uint64_t hr_clock_usec();
+
+/*
+ * An hr_clock_usec() deadline as a CLOCK_MONOTONIC timespec, for
+ * pthread_cond_timedwait() on a condition set to that clock.  With the TSC
+ * the two clocks drift apart, so the time left is carried over rather than
+ * the value.
+ */
+void hr_clock_monotonic_timespec(uint64_t deadline_usec, struct timespec &deadline);
+
+// Monotonic timestamp to wall-clock usec since the epoch, for logs only
+uint64_t hr_clock_to_wall_usec(uint64_t mono_usec);
+
+// The same as local time of day, "HH:MM:SS.mmm", for log lines
+#define HR_CLOCK_WALL_FORMAT_SIZE 16
+void hr_clock_format_wall(uint64_t mono_usec, char *buffer, size_t size);
+
+/*
+ * Re-measure the monotonic to wall-clock offset, e.g. after NTP has stepped
+ * the wall clock.  Done automatically on first use.
+ */
+void hr_clock_calibrate_wall();
+
+// True if hr_clock_nsec() reads the TSC
+bool hr_clock_uses_tsc();
+
+#endif // HR_CLOCK_H_
+
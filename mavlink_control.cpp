@@ -23,6 +23,10 @@ enum takeoff_mode{
 
 
 static int takeoff_mode = TAKE_OFF_MANUAL_OR_GCS;
+static float setpoint_rate = 10.0f; // Hz, need > 2Hz
+static int   rt_priority   = 0;     // SCHED_FIFO for the link threads if > 0
+static int   rt_cpu        = -1;    // pin the link threads to this CPU
+static bool  hold_on_stale = false; // hold position while LOCAL_POSITION_NED is stale
 // ------------------------------------------------------------------------------
 //   TOP
 // ------------------------------------------------------------------------------
@@ -79,6 +83,31 @@ top (int argc, char **argv)
      *
      */
     Autopilot_Interface autopilot_interface(&serial_port);
+    if ( not autopilot_interface.write_scheduler.set_rate(setpoint_rate) )
+        throw EXIT_FAILURE;
+
+    // setpoints go out first, so the write thread gets the higher priority,
+    // the watchdog holds the vehicle through it and shares its priority, the
+    // command retransmits rank with the read thread that takes their ACKs
+    Realtime_Config &realtime = autopilot_interface.realtime;
+    if ( rt_priority > 0 )
+    {
+        realtime.lock_memory           = true;
+        realtime.write_thread.policy   = SCHED_FIFO;
+        realtime.write_thread.priority = rt_priority;
+        realtime.read_thread.policy    = SCHED_FIFO;
+        realtime.read_thread.priority  = rt_priority > 1 ? rt_priority - 1 : 1;
+        realtime.watchdog_thread       = realtime.write_thread;
+        realtime.command_thread        = realtime.read_thread;
+    }
+    realtime.write_thread.cpu    = rt_cpu;
+    realtime.read_thread.cpu     = rt_cpu;
+    realtime.watchdog_thread.cpu = rt_cpu;
+    realtime.command_thread.cpu  = rt_cpu;
+
+    // stale position is only reported unless asked for
+    if ( hold_on_stale )
+        autopilot_interface.position_stale_action = WATCHDOG_ACTION_HOLD;
 
     /*
      * Setup interrupt signal handler
@@ -92,6 +121,9 @@ top (int argc, char **argv)
     autopilot_interface_quit = &autopilot_interface;
     signal(SIGINT,quit_handler);
 
+    // kill -USR1 prints message rates and link loss
+    signal(SIGUSR1,dump_handler);
+
     /*
      * Start the port and autopilot_interface
      * This is where the port is opened, and read and write threads are started.
@@ -120,6 +152,9 @@ top (int argc, char **argv)
     autopilot_interface.stop();
     serial_port.stop();
 
+    printf("SETPOINT STREAM ");
+    autopilot_interface.write_scheduler.print(stdout);
+
 
     // --------------------------------------------------------------------------
     //   DONE
@@ -152,15 +187,19 @@ commands(Autopilot_Interface &api)
     mavlink_set_position_target_local_ned_t sp;
     mavlink_set_position_target_local_ned_t ip = api.initial_position;
 
-    api.set_parameters("MC_YAWRATE_MAX", 80.0, MAV_PARAM_TYPE_REAL32);
-    printf("set MC_YAWRATE_MAX done...\n");
+    // confirmed by the autopilot's PARAM_VALUE answer
+    Parameter_Manager parameters(&api);
+    if ( parameters.set("MC_YAWRATE_MAX", 80.0, MAV_PARAM_TYPE_REAL32, 3000000) )
+        printf("set MC_YAWRATE_MAX done...\n");
+    else
+        fprintf(stderr,"WARNING: MC_YAWRATE_MAX not confirmed\n");
 
     // autopilot_interface.h provides some helper functions to build the command
    
     /**
     * Switch to Offboard mode Now
     */
-    // messages = api.current_messages;    // copy current messages
+    // messages = api.current_messages.snapshot();    // copy current messages
 
     if(takeoff_mode == TAKE_OFF_MANUAL_OR_GCS){
 
@@ -170,9 +209,8 @@ commands(Autopilot_Interface &api)
         
         //  Switch to Offboard mode
         printf("Waiting for Vehicle to be armed...\n");
-        while(!api.is_armed()){
-            usleep(100000);
-        }
+        api.current_messages.wait_until([&api]() { return api.is_armed(); },
+                                        TELEMETRY_WAIT_FOREVER);
         
         printf("Vehicle is armed! Now switch to offboard mode...\n");
         sleep(5);
@@ -241,13 +279,13 @@ commands(Autopilot_Interface &api)
     {
         loop_cnt++;
 
-        mavlink_local_position_ned_t pos = api.current_messages.local_position_ned;
+        Hot_State pos = api.current_messages.hot.load();
         printf("Current Position = [ % .4f , % .4f , % .4f ]  , d=% .4f\n", pos.x, pos.y, pos.z, 
             distance(pos.x, pos.y, pos.z, sp.x, sp.y, sp.z));
 
         i = 20;
         while(i >= 0){
-            pos = api.current_messages.local_position_ned;
+            pos = api.current_messages.hot.load();
              printf("Current Position = [ % .4f , % .4f , % .4f ]  , d=% .4f\n", pos.x, pos.y, pos.z, 
                 distance(pos.x, pos.y, pos.z, sp.x, sp.y, sp.z));
              
@@ -264,7 +302,7 @@ commands(Autopilot_Interface &api)
 
         i = 20;
         while(i >= 0){
-            pos = api.current_messages.local_position_ned;
+            pos = api.current_messages.hot.load();
             printf("Current Position = [ % .4f , % .4f , % .4f ]  , d=% .4f\n", pos.x, pos.y, pos.z, 
                 distance(pos.x, pos.y, pos.z, sp.x, sp.y, sp.z));
             printf("Arrival to setpoint, loiter here %2ds", i);
@@ -279,7 +317,7 @@ commands(Autopilot_Interface &api)
 
         i = 20;
         while(i >= 0){
-            pos = api.current_messages.local_position_ned;
+            pos = api.current_messages.hot.load();
             printf("Current Position = [ % .4f , % .4f , % .4f ]  , d=% .4f\n", pos.x, pos.y, pos.z, 
                 distance(pos.x, pos.y, pos.z, sp.x, sp.y, sp.z));
             printf("Arrival to setpoint, loiter here %2ds", i);
@@ -296,7 +334,7 @@ commands(Autopilot_Interface &api)
         while(1){
             land_delay--;
             sleep(1);
-            pos = api.current_messages.local_position_ned;
+            pos = api.current_messages.hot.load();
             printf("Current Position = [ % .4f , % .4f , % .4f ]  , d=% .4f\n", pos.x, pos.y, pos.z, 
                 distance(pos.x, pos.y, pos.z, sp.x, sp.y, sp.z));
 
@@ -356,7 +394,7 @@ parse_commandline(int argc, char **argv, char *&uart_name, int &baudrate)
 {
 
     // string for command line usage
-    const char *commandline_usage = "usage: mavlink_serial -d <devicename> -b <baudrate> -m <takeoff_mode>";
+    const char *commandline_usage = "usage: mavlink_serial -d <devicename> -b <baudrate> -m <takeoff_mode> [-r <setpoint_hz>] [-p <rt_priority>] [-c <cpu>] [-s]";
     static bool mode_enable = false;
     // Read input arguments
     for (int i = 1; i < argc; i++) { // argv[0] is "mavlink"
@@ -389,6 +427,44 @@ parse_commandline(int argc, char **argv, char *&uart_name, int &baudrate)
             }
         }
 
+        // Setpoint rate
+        if (strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--rate") == 0) {
+            if (argc > i + 1) {
+                setpoint_rate = atof(argv[i + 1]);
+
+            } else {
+                printf("%s\n",commandline_usage);
+                throw EXIT_FAILURE;
+            }
+        }
+
+        // Real-time priority
+        if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--priority") == 0) {
+            if (argc > i + 1) {
+                rt_priority = atoi(argv[i + 1]);
+
+            } else {
+                printf("%s\n",commandline_usage);
+                throw EXIT_FAILURE;
+            }
+        }
+
+        // CPU
+        if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--cpu") == 0) {
+            if (argc > i + 1) {
+                rt_cpu = atoi(argv[i + 1]);
+
+            } else {
+                printf("%s\n",commandline_usage);
+                throw EXIT_FAILURE;
+            }
+        }
+
+        // Hold on stale position
+        if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--hold-on-stale") == 0) {
+            hold_on_stale = true;
+        }
+
         // Takeoff Mode
         if (strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--mode") == 0) {
 
@@ -450,6 +526,17 @@ quit_handler( int sig )
 }
 
 
+// ------------------------------------------------------------------------------
+//   Rate Report Handler
+// ------------------------------------------------------------------------------
+void
+dump_handler( int sig )
+{
+    // only sets a flag, the report is printed from the interface's threads
+    autopilot_interface_quit->rate_monitor.request_dump();
+}
+
+
 // ------------------------------------------------------------------------------
 //   Main
 // ------------------------------------------------------------------------------
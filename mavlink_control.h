@@ -32,6 +32,7 @@ using namespace std;
 
 #include "autopilot_interface.h"
 #include "serial_port.h"
+#include "parameter_manager.h"
 
 #undef DEBUG
 
@@ -50,3 +51,6 @@ Autopilot_Interface *autopilot_interface_quit;
 Serial_Port *serial_port_quit;
 void quit_handler( int sig );
 
+// rate report on SIGUSR1
+void dump_handler( int sig );
+
@@ -0,0 +1,247 @@
+/**
+ * @file message_dispatcher.cpp
+ *
+ * @brief Per-message subscription callbacks, functions
+ *
+ * Lock-free dispatch of received messages to registered callbacks
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "message_dispatcher.h"
+#include "realtime.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// polls of the dispatch in progress before sleeping between polls
+#define DISPATCHER_SPIN_LIMIT 100
+
+// sleep between further polls
+#define DISPATCHER_SLEEP_NSEC 10000
+
+
+// ----------------------------------------------------------------------------------
+//   Message Dispatcher Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Message_Dispatcher::
+Message_Dispatcher()
+{
+	for (int i = 0; i <= MESSAGE_DISPATCH_ALL; i++)
+		table[i].store(NULL);
+
+	generation.store(0);
+	dispatch_thread.store(pthread_t());
+	next_handle = 1;
+
+	int result = realtime_mutex_init(&lock);
+	if ( result != 0 )
+	{
+		printf("\n dispatcher mutex init failed\n");
+		throw 1;
+	}
+}
+
+Message_Dispatcher::
+~Message_Dispatcher()
+{
+	// the read thread is gone by now
+	for (int i = 0; i <= MESSAGE_DISPATCH_ALL; i++)
+		free(table[i].load());
+
+	for (size_t i = 0; i < retired.size(); i++)
+		free(retired[i]);
+
+	pthread_mutex_destroy(&lock);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Subscribe
+// ------------------------------------------------------------------------------
+int
+Message_Dispatcher::
+subscribe(int msgid, Message_Callback callback, void *context)
+{
+	if ( msgid < 0 || msgid > MESSAGE_DISPATCH_ALL || callback == NULL )
+	{
+		fprintf(stderr,"WARNING: can not subscribe to message id %d\n", msgid);
+		return -1;
+	}
+
+	pthread_mutex_lock(&lock);
+
+	// copy the current list with the new subscriber appended
+	Subscriber_List *old_list = table[msgid].load();
+	int count = old_list ? old_list->count : 0;
+
+	Subscriber_List *new_list = allocate_list(count + 1);
+	for (int i = 0; i < count; i++)
+		new_list->entries[i] = old_list->entries[i];
+
+	int handle = next_handle++;
+	new_list->entries[count].callback = callback;
+	new_list->entries[count].context  = context;
+	new_list->entries[count].handle   = handle;
+	new_list->count = count + 1;
+
+	table[msgid].store(new_list);
+
+	if ( old_list )
+		retired.push_back(old_list);
+	reclaim();
+
+	pthread_mutex_unlock(&lock);
+
+	return handle;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Unsubscribe
+// ------------------------------------------------------------------------------
+void
+Message_Dispatcher::
+unsubscribe(int handle)
+{
+	pthread_mutex_lock(&lock);
+
+	for (int msgid = 0; msgid <= MESSAGE_DISPATCH_ALL; msgid++)
+	{
+		Subscriber_List *old_list = table[msgid].load();
+		if ( old_list == NULL )
+			continue;
+
+		int found = -1;
+		for (int i = 0; i < old_list->count; i++)
+			if ( old_list->entries[i].handle == handle )
+				found = i;
+
+		if ( found < 0 )
+			continue;
+
+		// copy the current list without this subscriber
+		Subscriber_List *new_list = NULL;
+		if ( old_list->count > 1 )
+		{
+			new_list = allocate_list(old_list->count - 1);
+			int n = 0;
+			for (int i = 0; i < old_list->count; i++)
+				if ( i != found )
+					new_list->entries[n++] = old_list->entries[i];
+			new_list->count = n;
+		}
+
+		table[msgid].store(new_list);
+		retired.push_back(old_list);
+		break;
+	}
+
+	reclaim();
+
+	pthread_mutex_unlock(&lock);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Dispatch
+// ------------------------------------------------------------------------------
+void
+Message_Dispatcher::
+dispatch(const mavlink_message_t &message, uint64_t time_usec)
+{
+	dispatch_thread.store(pthread_self(), std::memory_order_relaxed);
+	generation.fetch_add(1);
+
+	call_list(table[message.msgid].load(), message, time_usec);
+	call_list(table[MESSAGE_DISPATCH_ALL].load(), message, time_usec);
+
+	generation.fetch_add(1, std::memory_order_release);
+}
+
+void
+Message_Dispatcher::
+call_list(const Subscriber_List *list, const mavlink_message_t &message, uint64_t time_usec)
+{
+	if ( list == NULL )
+		return;
+
+	for (int i = 0; i < list->count; i++)
+		list->entries[i].callback(message, time_usec, list->entries[i].context);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Allocate Subscriber List
+// ------------------------------------------------------------------------------
+Message_Dispatcher::Subscriber_List *
+Message_Dispatcher::
+allocate_list(int count)
+{
+	size_t size = sizeof(Subscriber_List) + (count - 1) * sizeof(Subscriber);
+
+	Subscriber_List *list = (Subscriber_List*) malloc(size);
+	if ( list == NULL )
+	{
+		fprintf(stderr,"ERROR: out of memory for subscriber list\n");
+		throw 1;
+	}
+
+	list->count = 0;
+	return list;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Free Retired Lists
+// ------------------------------------------------------------------------------
+// Called with the lock held, after the table entries were swapped
+void
+Message_Dispatcher::
+reclaim()
+{
+	if ( retired.empty() )
+		return;
+
+	uint32_t seen = generation.load();
+
+	if ( seen & 1 )
+	{
+		// called from a callback, the dispatch in progress is our own caller,
+		// try again on the next change
+		if ( pthread_equal(dispatch_thread.load(std::memory_order_relaxed), pthread_self()) )
+			return;
+
+		// wait for the dispatch in progress to let go of the old list,
+		// any later dispatch already sees the new one.  Sleep once spinning
+		// did not do: a SCHED_FIFO caller above the read thread on its CPU
+		// would never let it run, sched_yield() only gives way to threads
+		// of the same priority.
+		for (unsigned tries = 0; generation.load() == seen; tries++)
+		{
+			if ( tries < DISPATCHER_SPIN_LIMIT )
+				continue;
+
+			struct timespec pause = { 0, DISPATCHER_SLEEP_NSEC };
+			nanosleep(&pause, NULL);
+		}
+	}
+
+	for (size_t i = 0; i < retired.size(); i++)
+		free(retired[i]);
+	retired.clear();
+}
+
@@ -0,0 +1,111 @@
+/**
+ * @file message_dispatcher.h
+ *
+ * @brief Per-message subscription callbacks, definition
+ *
+ * Lets callers see every received MAVLink message instead of only the latest
+ * copy left in the telemetry store.
+ */
+
+#ifndef MESSAGE_DISPATCHER_H_
+#define MESSAGE_DISPATCHER_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <atomic>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+
+#include <common/mavlink.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// msgid for Message_Dispatcher::subscribe() that matches every message
+#define MESSAGE_DISPATCH_ALL 256
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+/*
+ * Subscription callback
+ *
+ * Runs on the read thread with the decoded frame and the host time it was
+ * received.  Keep it short, the next message is not read until it returns.
+ */
+typedef void (*Message_Callback)(const mavlink_message_t &message, uint64_t time_usec, void *context);
+
+
+// ----------------------------------------------------------------------------------
+//   Message Dispatcher Class
+// ----------------------------------------------------------------------------------
+/*
+ * Message Dispatcher Class
+ *
+ * A 256 entry table, one subscriber list per message id, plus one list for
+ * subscribers to all messages.  dispatch() only loads a pointer per table
+ * entry, it never takes a lock, so subscribing and unsubscribing does not
+ * stop the read thread.  Changes copy the affected list and swap the pointer;
+ * the old list is freed once the read thread is no longer walking it.
+ *
+ * dispatch() must only ever be called from one thread, the receive path.
+ */
+class Message_Dispatcher
+{
+
+public:
+
+	Message_Dispatcher();
+	~Message_Dispatcher();
+
+	// returns a handle for unsubscribe(), or -1 on a bad msgid
+	int  subscribe(int msgid, Message_Callback callback, void *context);
+
+	// once this returns the callback will not be called again, unless it is
+	// called from inside a callback, where the current dispatch completes
+	void unsubscribe(int handle);
+
+	void dispatch(const mavlink_message_t &message, uint64_t time_usec);
+
+private:
+
+	struct Subscriber
+	{
+		Message_Callback callback;
+		void            *context;
+		int              handle;
+	};
+
+	struct Subscriber_List
+	{
+		int        count;
+		Subscriber entries[1]; // actually count entries
+	};
+
+	std::atomic<Subscriber_List*> table[MESSAGE_DISPATCH_ALL + 1];
+
+	// odd while dispatch() is running
+	std::atomic<uint32_t> generation;
+	std::atomic<pthread_t> dispatch_thread;
+
+	// serializes subscribe() and unsubscribe()
+	pthread_mutex_t lock;
+	int             next_handle;
+
+	std::vector<Subscriber_List*> retired;
+
+	static Subscriber_List *allocate_list(int count);
+	void call_list(const Subscriber_List *list, const mavlink_message_t &message, uint64_t time_usec);
+	void reclaim();
+
+};
+
+#endif // MESSAGE_DISPATCHER_H_
+
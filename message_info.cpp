@@ -0,0 +1,120 @@
+/**
+ * @file message_info.cpp
+ *
+ * @brief MAVLink message metadata helpers, functions
+ *
+ * Lookups into the metadata the MAVLink generator emits for every message
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "message_info.h"
+
+#include <string.h>
+
+
+// ------------------------------------------------------------------------------
+//   Metadata Table
+// ------------------------------------------------------------------------------
+
+// MAVLink 1 message ids are one byte, the table has one entry for each
+static const mavlink_message_info_t message_info_table[256] = MAVLINK_MESSAGE_INFO;
+
+
+// ------------------------------------------------------------------------------
+//   Lookups
+// ------------------------------------------------------------------------------
+const mavlink_message_info_t *
+get_message_info(uint8_t msgid)
+{
+	const mavlink_message_info_t *info = &message_info_table[msgid];
+
+	// unused ids are filled with an empty entry
+	if ( info->name == NULL || info->num_fields == 0 )
+		return NULL;
+
+	return info;
+}
+
+const mavlink_field_info_t *
+get_message_field(const mavlink_message_info_t *info, const char *name)
+{
+	if ( info == NULL )
+		return NULL;
+
+	for (unsigned i = 0; i < info->num_fields; i++)
+		if ( strcmp(info->fields[i].name, name) == 0 )
+			return &info->fields[i];
+
+	return NULL;
+}
+
+size_t
+get_field_type_size(mavlink_message_type_t type)
+{
+	switch (type)
+	{
+		case MAVLINK_TYPE_CHAR:
+		case MAVLINK_TYPE_UINT8_T:
+		case MAVLINK_TYPE_INT8_T:
+			return 1;
+
+		case MAVLINK_TYPE_UINT16_T:
+		case MAVLINK_TYPE_INT16_T:
+			return 2;
+
+		case MAVLINK_TYPE_UINT32_T:
+		case MAVLINK_TYPE_INT32_T:
+		case MAVLINK_TYPE_FLOAT:
+			return 4;
+
+		case MAVLINK_TYPE_UINT64_T:
+		case MAVLINK_TYPE_INT64_T:
+		case MAVLINK_TYPE_DOUBLE:
+			return 8;
+	}
+
+	return 0;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Field Decoding
+// ------------------------------------------------------------------------------
+
+// The payload is little endian, like every host this runs on, so elements
+// are copied out as they are
+
+double
+get_field_value(const mavlink_field_info_t *field, const void *payload, unsigned index)
+{
+	size_t size = get_field_type_size(field->type);
+	const uint8_t *element = (const uint8_t*)payload + field->wire_offset + index * size;
+
+	return field_element_to_double(field->type, element);
+}
+
+double
+field_element_to_double(mavlink_message_type_t type, const void *element)
+{
+	switch (type)
+	{
+		case MAVLINK_TYPE_CHAR:     { char     v; memcpy(&v, element, sizeof(v)); return v; }
+		case MAVLINK_TYPE_UINT8_T:  { uint8_t  v; memcpy(&v, element, sizeof(v)); return v; }
+		case MAVLINK_TYPE_INT8_T:   { int8_t   v; memcpy(&v, element, sizeof(v)); return v; }
+		case MAVLINK_TYPE_UINT16_T: { uint16_t v; memcpy(&v, element, sizeof(v)); return v; }
+		case MAVLINK_TYPE_INT16_T:  { int16_t  v; memcpy(&v, element, sizeof(v)); return v; }
+		case MAVLINK_TYPE_UINT32_T: { uint32_t v; memcpy(&v, element, sizeof(v)); return v; }
+		case MAVLINK_TYPE_INT32_T:  { int32_t  v; memcpy(&v, element, sizeof(v)); return v; }
+		case MAVLINK_TYPE_UINT64_T: { uint64_t v; memcpy(&v, element, sizeof(v)); return (double)v; }
+		case MAVLINK_TYPE_INT64_T:  { int64_t  v; memcpy(&v, element, sizeof(v)); return (double)v; }
+		case MAVLINK_TYPE_FLOAT:    { float    v; memcpy(&v, element, sizeof(v)); return v; }
+		case MAVLINK_TYPE_DOUBLE:   { double   v; memcpy(&v, element, sizeof(v)); return v; }
+	}
+
+	return 0.0;
+}
+
@@ -0,0 +1,43 @@
+/**
+ * @file message_info.h
+ *
+ * @brief MAVLink message metadata helpers, definition
+ *
+ * Field names, types and offsets of every message, taken from the
+ * MAVLINK_MESSAGE_INFO tables in the generated MAVLink headers.
+ */
+
+#ifndef MESSAGE_INFO_H_
+#define MESSAGE_INFO_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <common/mavlink.h>
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+// Metadata for a message id, NULL if the dialect does not define it
+const mavlink_message_info_t *get_message_info(uint8_t msgid);
+
+// Field of a message by name, NULL if there is none
+const mavlink_field_info_t *get_message_field(const mavlink_message_info_t *info, const char *name);
+
+// Size in bytes of one element of a field type
+size_t get_field_type_size(mavlink_message_type_t type);
+
+// Read one element of a field from wire order payload bytes, as a double
+double get_field_value(const mavlink_field_info_t *field, const void *payload, unsigned index);
+
+// Convert one element stored as a field type to a double
+double field_element_to_double(mavlink_message_type_t type, const void *element);
+
+#endif // MESSAGE_INFO_H_
+
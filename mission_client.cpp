@@ -0,0 +1,852 @@
+/**
+ * @file mission_client.cpp
+ *
+ * @brief MAVLink mission protocol client, functions
+ *
+ * Upload answered from the read thread, windowed download, RTT based timeouts
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "mission_client.h"
+#include "hr_clock.h"
+#include "realtime.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// retransmit timeout before the first round trip was measured
+#define MISSION_INITIAL_TIMEOUT_USEC 1000000
+
+
+// ----------------------------------------------------------------------------------
+//   Mission Client Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Mission_Client::
+Mission_Client(Autopilot_Interface *api_)
+{
+	api = api_;
+
+	max_in_flight    = 8;
+	max_retries      = 5;
+	min_timeout_usec = 50000;   // 50 ms
+	max_timeout_usec = 3000000; // 3 s
+
+	transfer     = TRANSFER_IDLE;
+	known_valid  = false;
+	first_seq    = 0;
+	last_seq     = 0;
+	sent_seq     = -1;
+	max_sent_seq = -1;
+	sent_usec    = 0;
+	tries        = 0;
+	ack_received = false;
+	ack_type     = MAV_MISSION_ACCEPTED;
+	legacy_request = false;
+	count        = -1;
+	received     = 0;
+
+	srtt_usec   = 0;
+	rttvar_usec = 0;
+	rto_usec    = MISSION_INITIAL_TIMEOUT_USEC;
+
+	// waits on the monotonic clock, like every timestamp
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+	int result = realtime_mutex_init(&lock);
+	if ( result == 0 )
+		result = pthread_cond_init(&changed, &attr);
+
+	pthread_condattr_destroy(&attr);
+
+	if ( result != 0 )
+	{
+		printf("\n mission client init failed\n");
+		throw 1;
+	}
+
+	const int msgids[MISSION_CLIENT_MESSAGES] = {
+		MAVLINK_MSG_ID_MISSION_REQUEST,
+		MAVLINK_MSG_ID_MISSION_REQUEST_INT,
+		MAVLINK_MSG_ID_MISSION_COUNT,
+		MAVLINK_MSG_ID_MISSION_ITEM_INT,
+		MAVLINK_MSG_ID_MISSION_ACK,
+	};
+
+	for (int i = 0; i < MISSION_CLIENT_MESSAGES; i++)
+		subscriptions[i] = api->subscribe(msgids[i], &mission_client_message_callback, this);
+}
+
+Mission_Client::
+~Mission_Client()
+{
+	for (int i = 0; i < MISSION_CLIENT_MESSAGES; i++)
+		api->unsubscribe(subscriptions[i]);
+
+	pthread_cond_destroy(&changed);
+	pthread_mutex_destroy(&lock);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Upload
+// ------------------------------------------------------------------------------
+bool
+Mission_Client::
+upload(const std::vector<mavlink_mission_item_int_t> &items_, uint64_t timeout_usec)
+{
+	uint64_t end_usec = hr_clock_usec() + timeout_usec;
+
+	pthread_mutex_lock(&lock);
+
+	if ( transfer != TRANSFER_IDLE )
+	{
+		pthread_mutex_unlock(&lock);
+		fprintf(stderr,"ERROR: mission transfer already in progress\n");
+		return false;
+	}
+
+	items = items_;
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		items[i].seq              = (uint16_t)i;
+		items[i].target_system    = api->system_id;
+		items[i].target_component = api->autopilot_id;
+	}
+
+	unsigned num_items = items.size();
+	bool partial = false;
+
+	// only a range changed, send just that
+	if ( known_valid and known.size() == num_items and num_items > 0 )
+	{
+		unsigned first = 0, last = num_items;
+		while ( first < num_items and memcmp(&items[first], &known[first], sizeof(items[first])) == 0 )
+			first++;
+		while ( last > first and memcmp(&items[last-1], &known[last-1], sizeof(items[last-1])) == 0 )
+			last--;
+
+		if ( first == num_items )
+		{
+			pthread_mutex_unlock(&lock);
+			return true;
+		}
+
+		first_seq = first;
+		last_seq  = last - 1;
+		partial   = ( last - first < num_items );
+	}
+
+	bool result = partial and run_upload(true, end_usec);
+
+	if ( not result )
+	{
+		first_seq = 0;
+		last_seq  = num_items ? num_items - 1 : 0;
+		result = run_upload(false, end_usec);
+	}
+
+	if ( not result )
+		fprintf(stderr,"WARNING: mission upload failed, result %d\n", ack_type);
+
+	known       = items;
+	known_valid = result;
+
+	pthread_mutex_unlock(&lock);
+
+	return result;
+}
+
+// The vehicle asks for the items itself, see handle_message(), lock held
+bool
+Mission_Client::
+run_upload(bool partial, uint64_t end_usec)
+{
+	transfer     = TRANSFER_UPLOAD;
+	ack_received = false;
+	sent_seq     = -1;
+	max_sent_seq = -1;
+	tries        = 1;
+	sent_usec    = hr_clock_usec();
+	legacy_request = false;
+
+	std::vector<mavlink_message_t> sends(1, pack_upload_start(partial));
+
+	bool result = false;
+
+	while ( true )
+	{
+		if ( not sends.empty() )
+			send(sends);
+
+		if ( ack_received )
+		{
+			result = ( ack_type == MAV_MISSION_ACCEPTED );
+			break;
+		}
+
+		uint64_t now = hr_clock_usec();
+		if ( now >= end_usec )
+			break;
+
+		// PX4 ignores MISSION_WRITE_PARTIAL_LIST, so that gets two timeouts
+		// and no retries before the whole list goes out
+		bool     unanswered   = ( partial and sent_seq < 0 );
+		uint64_t timeout_usec = unanswered ? 2 * rto_usec : rto_usec;
+
+		// nothing heard, repeat what we sent last
+		if ( now - sent_usec >= timeout_usec )
+		{
+			if ( unanswered or tries > max_retries )
+				break;
+
+			rtt_backoff();
+			tries++;
+
+			if ( sent_seq < 0 )
+				sends.push_back(pack_upload_start(partial));
+			else
+				sends.push_back(pack_item(sent_seq));
+
+			sent_usec = now;
+			continue;
+		}
+
+		wait(std::min(end_usec, sent_usec + timeout_usec));
+	}
+
+	transfer = TRANSFER_IDLE;
+
+	return result;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Download
+// ------------------------------------------------------------------------------
+bool
+Mission_Client::
+download(std::vector<mavlink_mission_item_int_t> &items_, uint64_t timeout_usec)
+{
+	uint64_t end_usec = hr_clock_usec() + timeout_usec;
+
+	pthread_mutex_lock(&lock);
+
+	if ( transfer != TRANSFER_IDLE )
+	{
+		pthread_mutex_unlock(&lock);
+		fprintf(stderr,"ERROR: mission transfer already in progress\n");
+		return false;
+	}
+
+	transfer = TRANSFER_DOWNLOAD;
+	count    = -1;
+	received = 0;
+	tries    = 1;
+	sent_usec = hr_clock_usec();
+
+	std::vector<mavlink_message_t> sends(1, pack_request_list());
+	std::vector<unsigned> in_flight;
+	unsigned cursor = 0;   // next item to request
+	bool     result = false;
+
+	while ( true )
+	{
+		if ( not sends.empty() )
+			send(sends);
+
+		uint64_t now = hr_clock_usec();
+
+		if ( count >= 0 and received == (unsigned)count )
+		{
+			result = true;
+			break;
+		}
+
+		if ( now >= end_usec )
+			break;
+
+		uint64_t wake_usec = end_usec;
+
+		// ----------------------------------------------------------------------
+		//   COUNT
+		// ----------------------------------------------------------------------
+		if ( count < 0 )
+		{
+			if ( now - sent_usec >= rto_usec )
+			{
+				if ( tries > max_retries )
+					break;
+
+				rtt_backoff();
+				tries++;
+				sends.push_back(pack_request_list());
+				sent_usec = now;
+			}
+
+			wake_usec = std::min(wake_usec, sent_usec + rto_usec);
+		}
+
+		// ----------------------------------------------------------------------
+		//   ITEMS
+		// ----------------------------------------------------------------------
+		else
+		{
+			bool failed = false, backed_off = false;
+
+			// retire answered requests, repeat overdue ones
+			for (size_t i = 0; i < in_flight.size(); )
+			{
+				unsigned seq = in_flight[i];
+
+				if ( request_tries[seq] == 0 )
+				{
+					in_flight[i] = in_flight.back();
+					in_flight.pop_back();
+					continue;
+				}
+
+				if ( now - requested_usec[seq] >= rto_usec )
+				{
+					if ( request_tries[seq] > max_retries )
+					{
+						failed = true;
+						break;
+					}
+
+					// one loss, one backoff, however many were in flight
+					if ( not backed_off )
+						rtt_backoff();
+					backed_off = true;
+
+					sends.push_back(pack_request(seq));
+					requested_usec[seq] = now;
+					request_tries[seq]++;
+				}
+
+				wake_usec = std::min(wake_usec, requested_usec[seq] + rto_usec);
+				i++;
+			}
+
+			if ( failed )
+				break;
+
+			// keep the window full
+			while ( in_flight.size() < max_in_flight and cursor < (unsigned)count )
+			{
+				unsigned seq = cursor++;
+
+				sends.push_back(pack_request(seq));
+				requested_usec[seq] = now;
+				request_tries[seq]  = 1;
+				in_flight.push_back(seq);
+
+				wake_usec = std::min(wake_usec, now + rto_usec);
+			}
+		}
+
+		// the answers may come in while these are written
+		if ( not sends.empty() )
+			continue;
+
+		wait(wake_usec);
+	}
+
+	mavlink_message_t ack;
+
+	if ( result )
+	{
+		ack = pack_ack(MAV_MISSION_ACCEPTED);
+
+		items_      = items;
+		known       = items;
+		known_valid = true;
+	}
+	else
+		fprintf(stderr,"WARNING: mission download failed, %u of %d items\n", received, count);
+
+	transfer = TRANSFER_IDLE;
+
+	pthread_mutex_unlock(&lock);
+
+	if ( result )
+		api->write_message(ack);
+
+	return result;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Clear
+// ------------------------------------------------------------------------------
+bool
+Mission_Client::
+clear(uint64_t timeout_usec)
+{
+	uint64_t end_usec = hr_clock_usec() + timeout_usec;
+
+	pthread_mutex_lock(&lock);
+
+	if ( transfer != TRANSFER_IDLE )
+	{
+		pthread_mutex_unlock(&lock);
+		fprintf(stderr,"ERROR: mission transfer already in progress\n");
+		return false;
+	}
+
+	mavlink_mission_clear_all_t clear_all;
+	clear_all.target_system    = api->system_id;
+	clear_all.target_component = api->autopilot_id;
+
+	mavlink_message_t message;
+	mavlink_msg_mission_clear_all_encode(api->system_id, api->companion_id, &message, &clear_all);
+
+	transfer     = TRANSFER_CLEAR;
+	ack_received = false;
+	tries        = 0;
+	sent_usec    = 0;
+
+	std::vector<mavlink_message_t> sends;
+	bool result = false;
+
+	while ( true )
+	{
+		if ( not sends.empty() )
+			send(sends);
+
+		if ( ack_received )
+		{
+			result = ( ack_type == MAV_MISSION_ACCEPTED );
+			break;
+		}
+
+		uint64_t now = hr_clock_usec();
+		if ( now >= end_usec )
+			break;
+
+		if ( now - sent_usec >= rto_usec )
+		{
+			if ( tries > max_retries )
+				break;
+
+			if ( tries )
+				rtt_backoff();
+			tries++;
+
+			sends.push_back(message);
+			sent_usec = now;
+			continue;
+		}
+
+		wait(std::min(end_usec, sent_usec + rto_usec));
+	}
+
+	if ( result )
+	{
+		known.clear();
+		known_valid = true;
+	}
+
+	transfer = TRANSFER_IDLE;
+
+	pthread_mutex_unlock(&lock);
+
+	return result;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Receive
+// ------------------------------------------------------------------------------
+void
+Mission_Client::
+handle_message(const mavlink_message_t &message, uint64_t time_usec)
+{
+	if ( message.sysid != api->system_id or message.compid != api->autopilot_id )
+		return;
+
+	mavlink_message_t reply;
+	bool     reply_pending = false;
+	unsigned reply_seq     = 0;
+
+	pthread_mutex_lock(&lock);
+
+	switch (message.msgid)
+	{
+
+		// ----------------------------------------------------------------------
+		//   UPLOAD, the vehicle asks for an item
+		// ----------------------------------------------------------------------
+		case MAVLINK_MSG_ID_MISSION_REQUEST:
+		case MAVLINK_MSG_ID_MISSION_REQUEST_INT:
+		{
+			unsigned seq;
+			if ( message.msgid == MAVLINK_MSG_ID_MISSION_REQUEST )
+				seq = mavlink_msg_mission_request_get_seq(&message);
+			else
+				seq = mavlink_msg_mission_request_int_get_seq(&message);
+
+			if ( transfer != TRANSFER_UPLOAD or seq < first_seq or seq > last_seq or
+			     seq >= items.size() )
+				break;
+
+			// a request for the next item answers the last one sent
+			if ( tries == 1 and (int)seq > max_sent_seq )
+				rtt_sample(time_usec - sent_usec);
+
+			// answered right here, the vehicle is waiting for it, in the
+			// form it asked for; retransmits keep that form
+			legacy_request = ( message.msgid == MAVLINK_MSG_ID_MISSION_REQUEST );
+			reply         = pack_item(seq);
+			reply_pending = true;
+			reply_seq     = seq;
+
+			tries        = ( (int)seq <= max_sent_seq ) ? 2 : 1;
+			sent_seq     = seq;
+			max_sent_seq = std::max(max_sent_seq, (int)seq);
+			sent_usec    = time_usec;
+
+			pthread_cond_broadcast(&changed);
+			break;
+		}
+
+		case MAVLINK_MSG_ID_MISSION_ACK:
+		{
+			if ( transfer != TRANSFER_UPLOAD and transfer != TRANSFER_CLEAR )
+				break;
+
+			if ( tries == 1 )
+				rtt_sample(time_usec - sent_usec);
+
+			ack_received = true;
+			ack_type     = mavlink_msg_mission_ack_get_type(&message);
+
+			pthread_cond_broadcast(&changed);
+			break;
+		}
+
+		// ----------------------------------------------------------------------
+		//   DOWNLOAD
+		// ----------------------------------------------------------------------
+		case MAVLINK_MSG_ID_MISSION_COUNT:
+		{
+			if ( transfer != TRANSFER_DOWNLOAD or count >= 0 )
+				break;
+
+			if ( tries == 1 )
+				rtt_sample(time_usec - sent_usec);
+
+			count = mavlink_msg_mission_count_get_count(&message);
+
+			items.assign(count, mavlink_mission_item_int_t());
+			requested_usec.assign(count, 0);
+			request_tries.assign(count, 0);
+
+			pthread_cond_broadcast(&changed);
+			break;
+		}
+
+		case MAVLINK_MSG_ID_MISSION_ITEM_INT:
+		{
+			if ( transfer != TRANSFER_DOWNLOAD or count < 0 )
+				break;
+
+			mavlink_mission_item_int_t item;
+			mavlink_msg_mission_item_int_decode(&message, &item);
+
+			// not asked for, or a duplicate
+			if ( item.seq >= count or request_tries[item.seq] == 0 )
+				break;
+
+			if ( request_tries[item.seq] == 1 )
+				rtt_sample(time_usec - requested_usec[item.seq]);
+
+			items[item.seq] = item;
+			request_tries[item.seq] = 0;
+			received++;
+
+			pthread_cond_broadcast(&changed);
+			break;
+		}
+
+		default:
+			break;
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	if ( reply_pending and api->write_message(reply) <= 0 )
+		fprintf(stderr,"WARNING: could not send mission item %u\n", reply_seq);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Send
+// ------------------------------------------------------------------------------
+
+// Messages are packed with the lock held and written by send() without it
+mavlink_message_t
+Mission_Client::
+pack_upload_start(bool partial)
+{
+	mavlink_message_t message;
+
+	if ( partial )
+	{
+		mavlink_mission_write_partial_list_t list;
+		list.target_system    = api->system_id;
+		list.target_component = api->autopilot_id;
+		list.start_index      = (int16_t)first_seq;
+		list.end_index        = (int16_t)last_seq;
+
+		mavlink_msg_mission_write_partial_list_encode(api->system_id, api->companion_id, &message, &list);
+	}
+	else
+	{
+		mavlink_mission_count_t mission_count;
+		mission_count.target_system    = api->system_id;
+		mission_count.target_component = api->autopilot_id;
+		mission_count.count            = (uint16_t)items.size();
+
+		mavlink_msg_mission_count_encode(api->system_id, api->companion_id, &message, &mission_count);
+	}
+
+	return message;
+}
+
+// MISSION_ITEM_INT, or MISSION_ITEM if the vehicle asked with MISSION_REQUEST
+mavlink_message_t
+Mission_Client::
+pack_item(unsigned seq)
+{
+	const mavlink_mission_item_int_t &item = items[seq];
+	mavlink_message_t message;
+
+	if ( not legacy_request )
+	{
+		mavlink_msg_mission_item_int_encode(api->system_id, api->companion_id, &message, &item);
+		return message;
+	}
+
+	// x and y are degrees * 1e7 in global frames, meters * 1e4 in local
+	// ones, and plain params 5 and 6 otherwise
+	double scale = 1.0;
+	switch (item.frame)
+	{
+		case MAV_FRAME_GLOBAL:
+		case MAV_FRAME_GLOBAL_INT:
+		case MAV_FRAME_GLOBAL_RELATIVE_ALT:
+		case MAV_FRAME_GLOBAL_RELATIVE_ALT_INT:
+		case MAV_FRAME_GLOBAL_TERRAIN_ALT:
+		case MAV_FRAME_GLOBAL_TERRAIN_ALT_INT:
+			scale = 1e-7;
+			break;
+
+		case MAV_FRAME_LOCAL_NED:
+		case MAV_FRAME_LOCAL_ENU:
+		case MAV_FRAME_LOCAL_OFFSET_NED:
+		case MAV_FRAME_BODY_NED:
+		case MAV_FRAME_BODY_OFFSET_NED:
+			scale = 1e-4;
+			break;
+
+		default:
+			break;
+	}
+
+	mavlink_mission_item_t legacy;
+	legacy.param1           = item.param1;
+	legacy.param2           = item.param2;
+	legacy.param3           = item.param3;
+	legacy.param4           = item.param4;
+	legacy.x                = (float)( item.x * scale );
+	legacy.y                = (float)( item.y * scale );
+	legacy.z                = item.z;
+	legacy.seq              = item.seq;
+	legacy.command          = item.command;
+	legacy.target_system    = item.target_system;
+	legacy.target_component = item.target_component;
+	legacy.frame            = item.frame;
+	legacy.current          = item.current;
+	legacy.autocontinue     = item.autocontinue;
+	legacy.mission_type     = item.mission_type;
+
+	mavlink_msg_mission_item_encode(api->system_id, api->companion_id, &message, &legacy);
+
+	return message;
+}
+
+mavlink_message_t
+Mission_Client::
+pack_request(unsigned seq)
+{
+	mavlink_mission_request_int_t request;
+	request.target_system    = api->system_id;
+	request.target_component = api->autopilot_id;
+	request.seq              = (uint16_t)seq;
+
+	mavlink_message_t message;
+	mavlink_msg_mission_request_int_encode(api->system_id, api->companion_id, &message, &request);
+
+	return message;
+}
+
+mavlink_message_t
+Mission_Client::
+pack_request_list()
+{
+	mavlink_mission_request_list_t request;
+	request.target_system    = api->system_id;
+	request.target_component = api->autopilot_id;
+
+	mavlink_message_t message;
+	mavlink_msg_mission_request_list_encode(api->system_id, api->companion_id, &message, &request);
+
+	return message;
+}
+
+mavlink_message_t
+Mission_Client::
+pack_ack(uint8_t type)
+{
+	mavlink_mission_ack_t ack;
+	ack.target_system    = api->system_id;
+	ack.target_component = api->autopilot_id;
+	ack.type             = type;
+
+	mavlink_message_t message;
+	mavlink_msg_mission_ack_encode(api->system_id, api->companion_id, &message, &ack);
+
+	return message;
+}
+
+// Lock held, released while writing so the read thread is never stuck behind
+// a slow port
+void
+Mission_Client::
+send(std::vector<mavlink_message_t> &messages)
+{
+	pthread_mutex_unlock(&lock);
+
+	for (size_t i = 0; i < messages.size(); i++)
+	{
+		if ( api->write_message(messages[i]) <= 0 )
+			fprintf(stderr,"WARNING: could not send mission message %u\n", (unsigned)messages[i].msgid);
+	}
+
+	pthread_mutex_lock(&lock);
+
+	messages.clear();
+}
+
+
+// ------------------------------------------------------------------------------
+//   Round Trip Estimate
+// ------------------------------------------------------------------------------
+
+// Jacobson / Karels, as TCP, lock held
+void
+Mission_Client::
+rtt_sample(uint64_t rtt_usec)
+{
+	if ( srtt_usec == 0 )
+	{
+		srtt_usec   = rtt_usec;
+		rttvar_usec = rtt_usec / 2;
+	}
+	else
+	{
+		uint64_t error = rtt_usec > srtt_usec ? rtt_usec - srtt_usec : srtt_usec - rtt_usec;
+		rttvar_usec = ( 3 * rttvar_usec + error ) / 4;
+		srtt_usec   = ( 7 * srtt_usec + rtt_usec ) / 8;
+	}
+
+	rto_usec = std::max(min_timeout_usec, std::min(max_timeout_usec, srtt_usec + 4 * rttvar_usec));
+}
+
+void
+Mission_Client::
+rtt_backoff()
+{
+	rto_usec = std::min(max_timeout_usec, 2 * rto_usec);
+}
+
+uint8_t
+Mission_Client::
+get_result()
+{
+	pthread_mutex_lock(&lock);
+	uint8_t result = ack_type;
+	pthread_mutex_unlock(&lock);
+
+	return result;
+}
+
+uint64_t
+Mission_Client::
+get_timeout_usec()
+{
+	pthread_mutex_lock(&lock);
+	uint64_t result = rto_usec;
+	pthread_mutex_unlock(&lock);
+
+	return result;
+}
+
+uint64_t
+Mission_Client::
+get_srtt_usec()
+{
+	pthread_mutex_lock(&lock);
+	uint64_t result = srtt_usec;
+	pthread_mutex_unlock(&lock);
+
+	return result;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Wait
+// ------------------------------------------------------------------------------
+
+// Until something is received or wake_usec, lock held
+void
+Mission_Client::
+wait(uint64_t wake_usec)
+{
+	struct timespec deadline;
+	hr_clock_monotonic_timespec(wake_usec, deadline);
+
+	pthread_cond_timedwait(&changed, &lock, &deadline);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Subscription Helper Function
+// ------------------------------------------------------------------------------
+void
+mission_client_message_callback(const mavlink_message_t &message, uint64_t time_usec, void *args)
+{
+	// takes a mission client object argument
+	Mission_Client *mission = (Mission_Client *)args;
+
+	// run the transfer
+	mission->handle_message(message, time_usec);
+}
+
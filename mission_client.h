@@ -0,0 +1,148 @@
+/**
+ * @file mission_client.h
+ *
+ * @brief MAVLink mission protocol client, definition
+ *
+ * Uploads and downloads MISSION_ITEM_INT lists.
+ */
+
+#ifndef MISSION_CLIENT_H_
+#define MISSION_CLIENT_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "autopilot_interface.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+#include <common/mavlink.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// subscriptions of one client
+#define MISSION_CLIENT_MESSAGES 5
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+void mission_client_message_callback(const mavlink_message_t &message, uint64_t time_usec, void *args);
+
+
+// ----------------------------------------------------------------------------------
+//   Mission Client Class
+// ----------------------------------------------------------------------------------
+/*
+ * Mission Client Class
+ *
+ * Upload is driven by the vehicle, it asks for one item at a time with
+ * MISSION_REQUEST_INT.  Those requests are answered straight from the read
+ * thread, so each item costs one link round trip and no thread wake-up.
+ * An autopilot that asks with the older MISSION_REQUEST gets MISSION_ITEM,
+ * the same item with float coordinates.
+ * When the mission on the vehicle is known (after an upload or download
+ * through this client) and only a range of items changed, just that range
+ * is sent with MISSION_WRITE_PARTIAL_LIST; if the vehicle refuses, or does
+ * not answer within two timeouts (PX4 ignores it), the whole list is sent.
+ *
+ * Download is driven by us: after MISSION_COUNT, MISSION_REQUEST_INTs go out
+ * for up to max_in_flight items at a time, so the link stays busy rather
+ * than waiting a round trip per item.
+ *
+ * Retransmit timeouts follow the measured round trip, smoothed as TCP does
+ * (srtt + 4 x rttvar, samples of retransmitted requests are not used), and
+ * double on every timeout.  One transfer runs at a time.
+ */
+class Mission_Client
+{
+
+public:
+
+	Mission_Client(Autopilot_Interface *api_);
+	~Mission_Client();
+
+	unsigned max_in_flight;       // download window, default 8
+	unsigned max_retries;         // per request, default 5
+	uint64_t min_timeout_usec;    // default 50 ms
+	uint64_t max_timeout_usec;    // default 3 s
+
+	bool upload(const std::vector<mavlink_mission_item_int_t> &items, uint64_t timeout_usec);
+	bool download(std::vector<mavlink_mission_item_int_t> &items, uint64_t timeout_usec);
+	bool clear(uint64_t timeout_usec);
+
+	uint8_t  get_result();         // MAV_MISSION_* of the last MISSION_ACK
+	uint64_t get_timeout_usec();   // current retransmit timeout
+	uint64_t get_srtt_usec();
+
+	void handle_message(const mavlink_message_t &message, uint64_t time_usec);
+
+private:
+
+	enum Transfer
+	{
+		TRANSFER_IDLE = 0,
+		TRANSFER_UPLOAD,
+		TRANSFER_DOWNLOAD,
+		TRANSFER_CLEAR,
+	};
+
+	Autopilot_Interface *api;
+	int subscriptions[MISSION_CLIENT_MESSAGES];
+
+	// guarded by lock
+	Transfer transfer;
+	std::vector<mavlink_mission_item_int_t> items;
+	std::vector<mavlink_mission_item_int_t> known;   // on the vehicle
+	bool     known_valid;
+
+	// upload
+	unsigned first_seq, last_seq;   // range the vehicle may ask for
+	int      sent_seq;              // last item sent, -1 for the start message
+	int      max_sent_seq;
+	uint64_t sent_usec;
+	unsigned tries;
+	bool     ack_received;
+	uint8_t  ack_type;
+	bool     legacy_request;        // asked with MISSION_REQUEST, answered with MISSION_ITEM
+
+	// download
+	int      count;                 // -1 before MISSION_COUNT
+	unsigned received;
+	std::vector<uint64_t> requested_usec;
+	std::vector<uint8_t>  request_tries;   // 0 once received
+
+	// round trip estimate
+	uint64_t srtt_usec;
+	uint64_t rttvar_usec;
+	uint64_t rto_usec;
+
+	pthread_mutex_t lock;
+	pthread_cond_t  changed;
+
+	bool run_upload(bool partial, uint64_t end_usec);
+	mavlink_message_t pack_upload_start(bool partial);
+	mavlink_message_t pack_item(unsigned seq);
+	mavlink_message_t pack_request(unsigned seq);
+	mavlink_message_t pack_request_list();
+	mavlink_message_t pack_ack(uint8_t type);
+	void send(std::vector<mavlink_message_t> &messages);
+
+	void rtt_sample(uint64_t rtt_usec);
+	void rtt_backoff();
+
+	void wait(uint64_t wake_usec);
+
+	Mission_Client(const Mission_Client &);
+	Mission_Client &operator=(const Mission_Client &);
+
+};
+
+#endif // MISSION_CLIENT_H_
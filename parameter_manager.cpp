@@ -0,0 +1,1023 @@
+/**
+ * @file parameter_manager.cpp
+ *
+ * @brief Autopilot parameter table, functions
+ *
+ * PARAM_REQUEST_LIST download, pipelined re-reads of lost indices, name index
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "parameter_manager.h"
+#include "hr_clock.h"
+#include "realtime.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <vector>
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+// Start of a cache file, followed by count Parameters in index order
+struct Parameter_Cache_Header
+{
+	char     magic[4];    // "PRMC"
+	uint32_t version;     // PARAMETER_CACHE_VERSION
+	uint64_t uid;
+	uint32_t hash;
+	uint32_t count;
+};
+
+
+// ------------------------------------------------------------------------------
+//   Helper Functions
+// ------------------------------------------------------------------------------
+
+// FNV-1a over the at most 16 characters of a parameter name
+static uint32_t
+hash_name(const char *name)
+{
+	uint32_t hash = 2166136261u;
+
+	for (int i = 0; i < MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN && name[i]; i++)
+	{
+		hash ^= (uint8_t)name[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+
+// Equal as the autopilot stores it: floats by value, integers bytewise
+static bool
+same_value(float a, float b, uint8_t type)
+{
+	if ( type == MAV_PARAM_TYPE_REAL32 or type == MAV_PARAM_TYPE_REAL64 )
+		return a == b;
+
+	return memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+Parameter_Write
+make_parameter_write(const char *name, float value, uint8_t type)
+{
+	Parameter_Write write;
+	memset(&write, 0, sizeof(write));
+
+	strncpy(write.id, name, MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN);
+	write.value  = value;
+	write.type   = type;
+	write.result = PARAMETER_WRITE_PENDING;
+
+	return write;
+}
+
+Parameter_Write
+make_parameter_write_int(const char *name, int32_t value)
+{
+	float raw;
+	memcpy(&raw, &value, sizeof(raw));
+
+	return make_parameter_write(name, raw, MAV_PARAM_TYPE_INT32);
+}
+
+
+// ----------------------------------------------------------------------------------
+//   Parameter Manager Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Parameter_Manager::
+Parameter_Manager(Autopilot_Interface *api_)
+{
+	api = api_;
+
+	max_in_flight        = 8;
+	request_timeout_usec = 1000000; // 1 s
+	stream_gap_usec      = 300000;  // 300 ms
+	max_retries          = 3;
+	reread_count         = 0;
+
+	params          = NULL;
+	count           = 0;
+	received        = 0;
+	slots           = NULL;
+	slot_mask       = 0;
+	last_value_usec = 0;
+	last_index      = -1;
+	hash_received   = false;
+	hash_check      = 0;
+
+	const char *home = getenv("HOME");
+	cache_dir = std::string(home ? home : "/tmp") + "/.px4_offboard_control";
+
+	// waits on the monotonic clock, like every timestamp
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+	int result = realtime_mutex_init(&lock);
+	if ( result == 0 )
+		result = pthread_cond_init(&changed, &attr);
+
+	pthread_condattr_destroy(&attr);
+
+	if ( result != 0 )
+	{
+		printf("\n parameter manager init failed\n");
+		throw 1;
+	}
+
+	subscription = api->subscribe(MAVLINK_MSG_ID_PARAM_VALUE,
+	                              &parameter_manager_param_value_callback, this);
+}
+
+Parameter_Manager::
+~Parameter_Manager()
+{
+	api->unsubscribe(subscription);
+
+	resize(0);
+
+	pthread_cond_destroy(&changed);
+	pthread_mutex_destroy(&lock);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Table
+// ------------------------------------------------------------------------------
+
+// Start over with room for count_ parameters, lock held
+void
+Parameter_Manager::
+resize(unsigned count_)
+{
+	delete [] params;
+	delete [] slots;
+	params    = NULL;
+	slots     = NULL;
+	slot_mask = 0;
+
+	count      = count_;
+	received   = 0;
+	last_index = -1;
+
+	if ( count == 0 )
+		return;
+
+	params = new Parameter[count];
+	memset(params, 0, count * sizeof(Parameter));
+
+	// at most half full keeps the probe sequences short
+	unsigned size = 16;
+	while ( size < 2 * count )
+		size *= 2;
+
+	slots = new int32_t[size];
+	for (unsigned i = 0; i < size; i++)
+		slots[i] = -1;
+	slot_mask = size - 1;
+}
+
+// Index of the parameter called name, -1 if not known, lock held
+int
+Parameter_Manager::
+find(const char *name) const
+{
+	if ( slots == NULL )
+		return -1;
+
+	for (unsigned i = hash_name(name) & slot_mask; slots[i] >= 0; i = (i + 1) & slot_mask)
+		if ( strncmp(params[slots[i]].id, name, MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN) == 0 )
+			return slots[i];
+
+	return -1;
+}
+
+// Add params[index] to the name index, lock held
+void
+Parameter_Manager::
+insert(unsigned index)
+{
+	unsigned i = hash_name(params[index].id) & slot_mask;
+	while ( slots[i] >= 0 )
+		i = (i + 1) & slot_mask;
+
+	slots[i] = (int32_t)index;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Receive
+// ------------------------------------------------------------------------------
+void
+Parameter_Manager::
+handle_param_value(const mavlink_message_t &message, uint64_t time_usec)
+{
+	if ( message.sysid != api->system_id or message.compid != api->autopilot_id )
+		return;
+
+	mavlink_param_value_t value;
+	mavlink_msg_param_value_decode(&message, &value);
+
+	char id[PARAMETER_ID_LEN];
+	memcpy(id, value.param_id, MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN);
+	id[PARAMETER_ID_LEN - 1] = '\0';
+
+	// the hash is not part of the table, its value is a bytewise uint32
+	if ( strcmp(id, PARAMETER_HASH_CHECK) == 0 )
+	{
+		pthread_mutex_lock(&lock);
+		memcpy(&hash_check, &value.param_value, sizeof(hash_check));
+		hash_received = true;
+		pthread_cond_broadcast(&changed);
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+
+	if ( value.param_count == 0 )
+		return;
+
+	pthread_mutex_lock(&lock);
+
+	match_write(id, value.param_value, time_usec);
+
+	// parameters were added or removed, the indices are no longer valid
+	if ( value.param_count != count )
+		resize(value.param_count);
+
+	// answers by name, e.g. to PARAM_SET, carry no index
+	int index = value.param_index;
+	if ( index == UINT16_MAX )
+		index = find(id);
+
+	if ( index >= 0 and index < (int)count )
+	{
+		Parameter &parameter = params[index];
+
+		memcpy(parameter.id, id, PARAMETER_ID_LEN);
+		parameter.value = value.param_value;
+		parameter.type  = value.param_type;
+		parameter.index = (uint16_t)index;
+
+		if ( not parameter.received )
+		{
+			parameter.received = true;
+			received++;
+			insert(index);
+		}
+
+		last_value_usec = time_usec;
+		last_index      = index;
+
+	}
+
+	pthread_cond_broadcast(&changed);
+
+	pthread_mutex_unlock(&lock);
+}
+
+// The answer to a pending PARAM_SET settles it, lock held
+void
+Parameter_Manager::
+match_write(const char *id, float value, uint64_t time_usec)
+{
+	for (size_t i = 0; i < pending.size(); i++)
+	{
+		Pending_Write   &entry = pending[i];
+		Parameter_Write &write = *entry.write;
+
+		if ( strncmp(write.id, id, MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN) != 0 )
+			continue;
+
+		write.echoed = value;
+
+		if ( same_value(value, write.value, write.type) )
+			write.result = PARAMETER_WRITE_OK;
+
+		// still different after a PARAM_SET sent since the last such answer
+		else if ( entry.mismatch_usec and entry.sent_usec > entry.mismatch_usec )
+			write.result = PARAMETER_WRITE_REJECTED;
+
+		// may predate our PARAM_SET, the retransmit asks again
+		else if ( entry.mismatch_usec == 0 )
+			entry.mismatch_usec = time_usec;
+
+		return;
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Requests
+// ------------------------------------------------------------------------------
+void
+Parameter_Manager::
+request_list()
+{
+	mavlink_param_request_list_t request;
+	request.target_system    = api->system_id;
+	request.target_component = api->autopilot_id;
+
+	mavlink_message_t message;
+	mavlink_msg_param_request_list_encode(api->system_id, api->companion_id, &message, &request);
+
+	if ( api->write_message(message) <= 0 )
+		fprintf(stderr,"WARNING: could not send PARAM_REQUEST_LIST\n");
+}
+
+void
+Parameter_Manager::
+request_read(unsigned index)
+{
+	mavlink_param_request_read_t request;
+	memset(&request, 0, sizeof(request));
+	request.target_system    = api->system_id;
+	request.target_component = api->autopilot_id;
+	request.param_index      = (int16_t)index;
+
+	mavlink_message_t message;
+	mavlink_msg_param_request_read_encode(api->system_id, api->companion_id, &message, &request);
+
+	if ( api->write_message(message) <= 0 )
+		fprintf(stderr,"WARNING: could not send PARAM_REQUEST_READ\n");
+}
+
+
+void
+Parameter_Manager::
+request_set(const Parameter_Write &write)
+{
+	mavlink_param_set_t request;
+	memset(&request, 0, sizeof(request));
+	request.target_system    = api->system_id;
+	request.target_component = api->autopilot_id;
+	request.param_value      = write.value;
+	request.param_type       = write.type;
+	memcpy(request.param_id, write.id, MAVLINK_MSG_PARAM_SET_FIELD_PARAM_ID_LEN);
+
+	mavlink_message_t message;
+	mavlink_msg_param_set_encode(api->system_id, api->companion_id, &message, &request);
+
+	if ( api->write_message(message) <= 0 )
+		fprintf(stderr,"WARNING: could not send PARAM_SET %s\n", write.id);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Fetch
+// ------------------------------------------------------------------------------
+bool
+Parameter_Manager::
+fetch(uint64_t timeout_usec)
+{
+	struct Read
+	{
+		unsigned index;
+		uint64_t sent_usec;
+		unsigned tries;
+	};
+
+	std::vector<Read> in_flight;
+	unsigned cursor    = 0;      // next index to check for a re-read
+	bool     repairing = false;
+
+	// sent once the lock is released
+	bool                  send_list = true;
+	std::vector<unsigned> send_reads;
+
+	uint64_t start_usec = hr_clock_usec();
+	uint64_t end_usec   = start_usec + timeout_usec;
+
+	pthread_mutex_lock(&lock);
+
+	resize(0);
+	last_value_usec = start_usec;
+	reread_count    = 0;
+
+	uint64_t list_sent_usec = start_usec;
+	unsigned list_tries     = 1;
+
+	while ( true )
+	{
+		// writes block until drained, the read thread must not wait for them
+		if ( send_list or not send_reads.empty() )
+		{
+			pthread_mutex_unlock(&lock);
+
+			if ( send_list )
+				request_list();
+			for (size_t i = 0; i < send_reads.size(); i++)
+				request_read(send_reads[i]);
+
+			pthread_mutex_lock(&lock);
+
+			send_list = false;
+			send_reads.clear();
+		}
+
+		uint64_t now = hr_clock_usec();
+
+		if ( ( count and received == count ) or now >= end_usec )
+			break;
+
+		uint64_t wake_usec = end_usec;
+
+		// ----------------------------------------------------------------------
+		//   LIST STREAM
+		// ----------------------------------------------------------------------
+		if ( not repairing )
+		{
+			// nothing came back, ask again
+			if ( count == 0 )
+			{
+				if ( now - list_sent_usec >= request_timeout_usec )
+				{
+					if ( list_tries > max_retries )
+						break;
+
+					send_list      = true;
+					list_sent_usec = now;
+					list_tries++;
+				}
+
+				wake_usec = std::min(wake_usec, list_sent_usec + request_timeout_usec);
+			}
+
+			// the stream ended or stalled, the gaps are lost
+			else if ( last_index == (int)count - 1 or now - last_value_usec >= stream_gap_usec )
+				repairing = true;
+
+			else
+				wake_usec = std::min(wake_usec, last_value_usec + stream_gap_usec);
+		}
+
+		// ----------------------------------------------------------------------
+		//   RE-READ MISSING
+		// ----------------------------------------------------------------------
+		if ( repairing )
+		{
+			// retire answered reads, repeat overdue ones
+			for (size_t i = 0; i < in_flight.size(); )
+			{
+				Read &read = in_flight[i];
+
+				bool done = read.index >= count or params[read.index].received;
+				if ( not done and now - read.sent_usec >= request_timeout_usec )
+				{
+					if ( read.tries > max_retries )
+						done = true;
+					else
+					{
+						send_reads.push_back(read.index);
+						reread_count++;
+						read.sent_usec = now;
+						read.tries++;
+					}
+				}
+
+				if ( done )
+				{
+					in_flight[i] = in_flight.back();
+					in_flight.pop_back();
+					continue;
+				}
+
+				wake_usec = std::min(wake_usec, read.sent_usec + request_timeout_usec);
+				i++;
+			}
+
+			// keep the window full
+			while ( in_flight.size() < max_in_flight and cursor < count )
+			{
+				unsigned index = cursor++;
+				if ( params[index].received )
+					continue;
+
+				send_reads.push_back(index);
+				reread_count++;
+
+				Read read = { index, now, 1 };
+				in_flight.push_back(read);
+				wake_usec = std::min(wake_usec, now + request_timeout_usec);
+			}
+
+			// every missing one was asked for max_retries times
+			if ( in_flight.empty() )
+				break;
+		}
+
+		// send before sleeping
+		if ( send_list or not send_reads.empty() )
+			continue;
+
+		struct timespec deadline;
+		hr_clock_monotonic_timespec(wake_usec, deadline);
+
+		pthread_cond_timedwait(&changed, &lock, &deadline);
+	}
+
+	bool complete = count and received == count;
+
+	if ( not complete )
+		fprintf(stderr,"WARNING: received %u of %u parameters\n", received, count);
+
+	pthread_mutex_unlock(&lock);
+
+	return complete;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Sync
+// ------------------------------------------------------------------------------
+bool
+Parameter_Manager::
+sync(uint64_t timeout_usec)
+{
+	uint64_t end_usec = hr_clock_usec() + timeout_usec;
+
+	uint64_t uid  = 0;
+	uint32_t hash = 0;
+
+	bool have_uid = request_uid(uid, request_timeout_usec);
+
+	if ( have_uid and request_hash(hash, request_timeout_usec) and load_cache(uid, hash) )
+	{
+		printf("Loaded %u parameters from %s\n", get_count(), cache_path(uid).c_str());
+		return true;
+	}
+
+	uint64_t now = hr_clock_usec();
+	if ( now >= end_usec or not fetch(end_usec - now) )
+		return false;
+
+	// the hash after the download matches the values we have
+	if ( have_uid and request_hash(hash, request_timeout_usec) )
+		save_cache(uid, hash);
+
+	return true;
+}
+
+bool
+Parameter_Manager::
+request_uid(uint64_t &uid, uint64_t timeout_usec)
+{
+	Telemetry_Store &telemetry = api->current_messages;
+	mavlink_autopilot_version_t version;
+
+	// sent once already, e.g. at boot
+	if ( not telemetry.get_message(MAVLINK_MSG_ID_AUTOPILOT_VERSION, version) )
+	{
+		mavlink_command_long_t com;
+		memset(&com, 0, sizeof(com));
+		com.target_system    = api->system_id;
+		com.target_component = api->autopilot_id;
+		com.command          = MAV_CMD_REQUEST_AUTOPILOT_CAPABILITIES;
+		com.param1           = 1;
+
+		// retransmitted until acknowledged
+		int result = api->commands.execute(com);
+
+		// the message may come before or after the ACK
+		if ( result == MAV_RESULT_ACCEPTED )
+			telemetry.wait_until([&telemetry]() {
+					return telemetry.receive_count(MAVLINK_MSG_ID_AUTOPILOT_VERSION) > 0;
+				}, timeout_usec);
+		else
+			fprintf(stderr,"WARNING: autopilot capabilities request failed, result %d\n", result);
+	}
+
+	if ( telemetry.get_message(MAVLINK_MSG_ID_AUTOPILOT_VERSION, version) )
+	{
+		uid = version.uid;
+		return true;
+	}
+
+	fprintf(stderr,"WARNING: no AUTOPILOT_VERSION, parameter cache not used\n");
+	return false;
+}
+
+bool
+Parameter_Manager::
+request_hash(uint32_t &hash, uint64_t timeout_usec)
+{
+	pthread_mutex_lock(&lock);
+	hash_received = false;
+	pthread_mutex_unlock(&lock);
+
+	bool result = false;
+
+	for (unsigned tries = 0; tries <= max_retries and not result; tries++)
+	{
+		mavlink_param_request_read_t request;
+		memset(&request, 0, sizeof(request));
+		request.target_system    = api->system_id;
+		request.target_component = api->autopilot_id;
+		request.param_index      = -1;
+		strncpy(request.param_id, PARAMETER_HASH_CHECK, MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN);
+
+		mavlink_message_t message;
+		mavlink_msg_param_request_read_encode(api->system_id, api->companion_id, &message, &request);
+
+		// not under the lock, the answer may come before we wait
+		api->write_message(message);
+
+		struct timespec deadline;
+		hr_clock_monotonic_timespec(hr_clock_usec() + timeout_usec, deadline);
+
+		pthread_mutex_lock(&lock);
+
+		while ( not hash_received )
+			if ( pthread_cond_timedwait(&changed, &lock, &deadline) == ETIMEDOUT )
+				break;
+
+		result = hash_received;
+		hash   = hash_check;
+
+		pthread_mutex_unlock(&lock);
+	}
+
+	return result;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Cache
+// ------------------------------------------------------------------------------
+std::string
+Parameter_Manager::
+cache_path(uint64_t uid) const
+{
+	char name[64];
+	snprintf(name, sizeof(name), "/params_%016llx.cache", (unsigned long long)uid);
+
+	return cache_dir + name;
+}
+
+bool
+Parameter_Manager::
+load_cache(uint64_t uid, uint32_t hash)
+{
+	FILE *file = fopen(cache_path(uid).c_str(), "rb");
+	if ( file == NULL )
+		return false;
+
+	Parameter_Cache_Header header;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 and
+	             memcmp(header.magic, "PRMC", 4) == 0   and
+	             header.version == PARAMETER_CACHE_VERSION and
+	             header.uid     == uid                  and
+	             header.hash    == hash                 and
+	             header.count   >  0                    and
+	             header.count   <= UINT16_MAX;
+
+	std::vector<Parameter> cached;
+	if ( valid )
+	{
+		cached.resize(header.count);
+		valid = fread(&cached[0], sizeof(Parameter), header.count, file) == header.count;
+
+		for (unsigned i = 0; valid and i < header.count; i++)
+		{
+			cached[i].id[PARAMETER_ID_LEN - 1] = '\0';
+			valid = cached[i].index == i and cached[i].received;
+		}
+	}
+
+	fclose(file);
+
+	if ( not valid )
+		return false;
+
+	pthread_mutex_lock(&lock);
+
+	resize(header.count);
+	memcpy(params, &cached[0], header.count * sizeof(Parameter));
+	for (unsigned i = 0; i < count; i++)
+		insert(i);
+	received = count;
+
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&lock);
+
+	return true;
+}
+
+bool
+Parameter_Manager::
+save_cache(uint64_t uid, uint32_t hash)
+{
+	if ( mkdir(cache_dir.c_str(), 0755) != 0 and errno != EEXIST )
+	{
+		fprintf(stderr,"WARNING: could not create %s\n", cache_dir.c_str());
+		return false;
+	}
+
+	// write aside and rename, a crash never leaves half a cache
+	std::string path = cache_path(uid);
+	std::string temp = path + ".tmp";
+
+	FILE *file = fopen(temp.c_str(), "wb");
+	if ( file == NULL )
+	{
+		fprintf(stderr,"WARNING: could not write %s\n", temp.c_str());
+		return false;
+	}
+
+	pthread_mutex_lock(&lock);
+
+	Parameter_Cache_Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "PRMC", 4);
+	header.version = PARAMETER_CACHE_VERSION;
+	header.uid     = uid;
+	header.hash    = hash;
+	header.count   = count;
+
+	bool complete = count and received == count;
+	bool written  = complete and
+	                fwrite(&header, sizeof(header), 1, file) == 1 and
+	                fwrite(params, sizeof(Parameter), count, file) == count;
+
+	pthread_mutex_unlock(&lock);
+
+	written = ( fclose(file) == 0 ) and written;
+
+	if ( not written or rename(temp.c_str(), path.c_str()) != 0 )
+	{
+		remove(temp.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Set
+// ------------------------------------------------------------------------------
+unsigned
+Parameter_Manager::
+set_batch(Parameter_Write *writes, unsigned num_writes, uint64_t timeout_usec)
+{
+	unsigned next = 0;       // next write to send
+	unsigned confirmed = 0;
+
+	for (unsigned i = 0; i < num_writes; i++)
+		writes[i].result = PARAMETER_WRITE_PENDING;
+
+	uint64_t end_usec = hr_clock_usec() + timeout_usec;
+
+	// sent once the lock is released
+	std::vector<const Parameter_Write*> sends;
+
+	pthread_mutex_lock(&lock);
+
+	if ( not pending.empty() )
+	{
+		pthread_mutex_unlock(&lock);
+		fprintf(stderr,"ERROR: parameter batch already in progress\n");
+		return 0;
+	}
+
+	while ( true )
+	{
+		// writes block until drained, the read thread must not wait for them
+		if ( not sends.empty() )
+		{
+			pthread_mutex_unlock(&lock);
+
+			for (size_t i = 0; i < sends.size(); i++)
+				request_set(*sends[i]);
+
+			pthread_mutex_lock(&lock);
+
+			sends.clear();
+		}
+
+		uint64_t now = hr_clock_usec();
+		uint64_t wake_usec = end_usec;
+
+		// retire settled writes, repeat overdue ones
+		for (size_t i = 0; i < pending.size(); )
+		{
+			Pending_Write &write = pending[i];
+
+			if ( write.write->result == PARAMETER_WRITE_PENDING and
+			     ( now >= end_usec or now - write.sent_usec >= request_timeout_usec ) )
+			{
+				// the last answer had another value
+				if ( write.tries > max_retries or now >= end_usec )
+					write.write->result = write.mismatch_usec ? PARAMETER_WRITE_REJECTED : PARAMETER_WRITE_TIMEOUT;
+				else
+				{
+					sends.push_back(write.write);
+					write.sent_usec = now;
+					write.tries++;
+				}
+			}
+
+			if ( write.write->result != PARAMETER_WRITE_PENDING )
+			{
+				if ( write.write->result == PARAMETER_WRITE_OK )
+					confirmed++;
+
+				pending[i] = pending.back();
+				pending.pop_back();
+				continue;
+			}
+
+			wake_usec = std::min(wake_usec, write.sent_usec + request_timeout_usec);
+			i++;
+		}
+
+		// keep the window full
+		while ( pending.size() < max_in_flight and next < num_writes and now < end_usec )
+		{
+			Pending_Write write = { &writes[next++], now, 1, 0 };
+			sends.push_back(write.write);
+			pending.push_back(write);
+			wake_usec = std::min(wake_usec, now + request_timeout_usec);
+		}
+
+		if ( pending.empty() )
+			break;
+
+		// send before sleeping
+		if ( not sends.empty() )
+			continue;
+
+		struct timespec deadline;
+		hr_clock_monotonic_timespec(wake_usec, deadline);
+
+		pthread_cond_timedwait(&changed, &lock, &deadline);
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	// never sent, the timeout came first
+	for (unsigned i = next; i < num_writes; i++)
+		writes[i].result = PARAMETER_WRITE_TIMEOUT;
+
+	return confirmed;
+}
+
+bool
+Parameter_Manager::
+set(const char *name, float value, uint8_t type, uint64_t timeout_usec)
+{
+	Parameter_Write write = make_parameter_write(name, value, type);
+
+	return set_batch(&write, 1, timeout_usec) == 1;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Lookup
+// ------------------------------------------------------------------------------
+bool
+Parameter_Manager::
+get(const char *name, float &value, uint8_t *type)
+{
+	pthread_mutex_lock(&lock);
+
+	int index = find(name);
+	if ( index >= 0 )
+	{
+		value = params[index].value;
+		if ( type )
+			*type = params[index].type;
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	return index >= 0;
+}
+
+bool
+Parameter_Manager::
+get_int(const char *name, int32_t &value)
+{
+	float   raw;
+	uint8_t type;
+
+	if ( not get(name, raw, &type) )
+		return false;
+
+	// integers travel bytewise in the float
+	if ( type == MAV_PARAM_TYPE_REAL32 or type == MAV_PARAM_TYPE_REAL64 )
+		value = (int32_t)raw;
+	else
+		memcpy(&value, &raw, sizeof(value));
+
+	return true;
+}
+
+bool
+Parameter_Manager::
+get_by_index(unsigned index, Parameter &parameter)
+{
+	pthread_mutex_lock(&lock);
+
+	bool found = index < count and params[index].received;
+	if ( found )
+		parameter = params[index];
+
+	pthread_mutex_unlock(&lock);
+
+	return found;
+}
+
+unsigned
+Parameter_Manager::
+get_count()
+{
+	pthread_mutex_lock(&lock);
+	unsigned result = count;
+	pthread_mutex_unlock(&lock);
+
+	return result;
+}
+
+unsigned
+Parameter_Manager::
+get_received()
+{
+	pthread_mutex_lock(&lock);
+	unsigned result = received;
+	pthread_mutex_unlock(&lock);
+
+	return result;
+}
+
+bool
+Parameter_Manager::
+is_complete()
+{
+	pthread_mutex_lock(&lock);
+	bool result = count and received == count;
+	pthread_mutex_unlock(&lock);
+
+	return result;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Print
+// ------------------------------------------------------------------------------
+void
+Parameter_Manager::
+print(FILE *file)
+{
+	pthread_mutex_lock(&lock);
+
+	fprintf(file, "PARAMETERS %u of %u\n", received, count);
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		const Parameter &parameter = params[i];
+		if ( not parameter.received )
+			continue;
+
+		if ( parameter.type == MAV_PARAM_TYPE_REAL32 or parameter.type == MAV_PARAM_TYPE_REAL64 )
+			fprintf(file, "  %4u %-16s %g\n", i, parameter.id, parameter.value);
+		else
+		{
+			int32_t value;
+			memcpy(&value, &parameter.value, sizeof(value));
+			fprintf(file, "  %4u %-16s %d\n", i, parameter.id, value);
+		}
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Subscription Helper Function
+// ------------------------------------------------------------------------------
+void
+parameter_manager_param_value_callback(const mavlink_message_t &message, uint64_t time_usec, void *args)
+{
+	// takes a parameter manager object argument
+	Parameter_Manager *parameters = (Parameter_Manager *)args;
+
+	// file the value
+	parameters->handle_param_value(message, time_usec);
+}
+
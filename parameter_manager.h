@@ -0,0 +1,206 @@
+/**
+ * @file parameter_manager.h
+ *
+ * @brief Autopilot parameter table, definition
+ *
+ * Downloads every parameter of the target and keeps them by name.
+ */
+
+#ifndef PARAMETER_MANAGER_H_
+#define PARAMETER_MANAGER_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "autopilot_interface.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <common/mavlink.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// param_id is not terminated when it is 16 characters long
+#define PARAMETER_ID_LEN (MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN + 1)
+
+// PX4's hash over all parameter values, read like a parameter
+#define PARAMETER_HASH_CHECK "_HASH_CHECK"
+
+// bump when Parameter or the cache header change
+#define PARAMETER_CACHE_VERSION 1
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+struct Parameter
+{
+	char     id[PARAMETER_ID_LEN];
+	float    value;      // as sent, integers are bytewise (PX4)
+	uint8_t  type;       // MAV_PARAM_TYPE_*
+	uint16_t index;
+	bool     received;
+};
+
+enum Parameter_Write_Result
+{
+	PARAMETER_WRITE_PENDING = 0,
+	PARAMETER_WRITE_OK,          // echoed with the new value
+	PARAMETER_WRITE_REJECTED,    // echoed with another value, also after a re-send
+	PARAMETER_WRITE_TIMEOUT,     // no echo after max_retries
+};
+
+// One PARAM_SET of a batch, see make_parameter_write()
+struct Parameter_Write
+{
+	char                   id[PARAMETER_ID_LEN];
+	float                  value;     // integers bytewise (PX4)
+	uint8_t                type;      // MAV_PARAM_TYPE_*
+	Parameter_Write_Result result;    // filled in by set_batch()
+	float                  echoed;    // value in the PARAM_VALUE answer
+};
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+Parameter_Write make_parameter_write(const char *name, float value, uint8_t type = MAV_PARAM_TYPE_REAL32);
+Parameter_Write make_parameter_write_int(const char *name, int32_t value);
+
+void parameter_manager_param_value_callback(const mavlink_message_t &message, uint64_t time_usec, void *args);
+
+
+// ----------------------------------------------------------------------------------
+//   Parameter Manager Class
+// ----------------------------------------------------------------------------------
+/*
+ * Parameter Manager Class
+ *
+ * fetch() sends PARAM_REQUEST_LIST and lets the autopilot stream the whole
+ * table, which is as fast as the link allows.  Each PARAM_VALUE is filed by
+ * its index, so a gap shows which ones were lost.  Once the stream ends or
+ * stalls for stream_gap_usec, only the missing indices are asked for again
+ * with PARAM_REQUEST_READ, up to max_in_flight at a time: one round trip per
+ * window instead of per parameter.  Unanswered reads are repeated after
+ * request_timeout_usec, at most max_retries times.
+ *
+ * set_batch() writes many parameters the same way: PARAM_SETs go out up to
+ * max_in_flight at a time, each is matched by name to the PARAM_VALUE the
+ * autopilot answers with, and sent again if that does not come.  A batch
+ * of 40 takes a few round trips rather than 40.  An answer with another
+ * value may have been on its way before the PARAM_SET (a list stream, a
+ * read by someone else), so a write is only rejected when the value still
+ * differs after a PARAM_SET sent later than that answer.
+ *
+ * sync() avoids the download when nothing changed.  The table is saved to
+ * cache_dir under the vehicle's AUTOPILOT_VERSION uid, together with the
+ * _HASH_CHECK PX4 reports over all values; on the next connection the
+ * cache is loaded instead if the hash still matches.
+ *
+ * Values are kept in an open-addressed table by name, lookups are O(1) and
+ * may be made from any thread.  PARAM_VALUE is received through a
+ * subscription on the read thread, also outside fetch(), so the table
+ * follows changes made by others.
+ */
+class Parameter_Manager
+{
+
+public:
+
+	Parameter_Manager(Autopilot_Interface *api_);
+	~Parameter_Manager();
+
+	unsigned max_in_flight;          // default 8
+	uint64_t request_timeout_usec;   // default 1 s
+	uint64_t stream_gap_usec;        // default 300 ms
+	unsigned max_retries;            // default 3
+
+	unsigned reread_count;           // PARAM_REQUEST_READs sent by the last fetch()
+
+	std::string cache_dir;           // default ~/.px4_offboard_control
+
+	// Download every parameter, false if some are still missing at the timeout
+	bool fetch(uint64_t timeout_usec);
+
+	// Load from the cache if the hash matches, else fetch() and save
+	bool sync(uint64_t timeout_usec);
+
+	bool request_uid(uint64_t &uid, uint64_t timeout_usec);
+	bool request_hash(uint32_t &hash, uint64_t timeout_usec);
+	bool load_cache(uint64_t uid, uint32_t hash);
+	bool save_cache(uint64_t uid, uint32_t hash);
+
+	/*
+		Write every parameter of the batch, returns how many were
+		confirmed.  The result of each is in writes[i].result.
+	*/
+	unsigned set_batch(Parameter_Write *writes, unsigned num_writes, uint64_t timeout_usec);
+	bool     set(const char *name, float value, uint8_t type, uint64_t timeout_usec);
+
+	bool get(const char *name, float &value, uint8_t *type = NULL);
+	bool get_int(const char *name, int32_t &value);
+	bool get_by_index(unsigned index, Parameter &parameter);
+
+	unsigned get_count();       // on the autopilot, 0 before the first PARAM_VALUE
+	unsigned get_received();
+	bool     is_complete();
+
+	void print(FILE *file);
+
+	void handle_param_value(const mavlink_message_t &message, uint64_t time_usec);
+
+private:
+
+	Autopilot_Interface *api;
+	int subscription;
+
+	// guarded by lock
+	Parameter *params;          // by index
+	unsigned   count;
+	unsigned   received;
+	int32_t   *slots;           // name hash -> index, -1 empty
+	unsigned   slot_mask;
+	uint64_t   last_value_usec;
+	int        last_index;
+	bool       hash_received;
+	uint32_t   hash_check;
+
+	// set_batch() in progress
+	struct Pending_Write
+	{
+		Parameter_Write *write;
+		uint64_t         sent_usec;
+		unsigned         tries;
+		uint64_t         mismatch_usec;   // first echo with another value, 0 if none
+	};
+	std::vector<Pending_Write> pending;
+
+	pthread_mutex_t lock;
+	pthread_cond_t  changed;
+
+	void resize(unsigned count_);
+	int  find(const char *name) const;
+	void insert(unsigned index);
+
+	void request_list();
+	void request_read(unsigned index);
+	void request_set(const Parameter_Write &write);
+	std::string cache_path(uint64_t uid) const;
+	void match_write(const char *id, float value, uint64_t time_usec);
+
+	Parameter_Manager(const Parameter_Manager &);
+	Parameter_Manager &operator=(const Parameter_Manager &);
+
+};
+
+#endif // PARAMETER_MANAGER_H_
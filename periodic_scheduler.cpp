@@ -0,0 +1,187 @@
+/**
+ * @file periodic_scheduler.cpp
+ *
+ * @brief Fixed rate loop on absolute deadlines, functions
+ *
+ * clock_nanosleep pacing, overrun handling and period statistics
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "periodic_scheduler.h"
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+
+// ------------------------------------------------------------------------------
+//   Helper Functions
+// ------------------------------------------------------------------------------
+
+// The clock clock_nanosleep() sleeps on
+static uint64_t
+monotonic_nsec()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+
+// ----------------------------------------------------------------------------------
+//   Periodic Scheduler Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Periodic_Scheduler::
+Periodic_Scheduler()
+{
+	period_nsec.store(100000000, std::memory_order_relaxed); // 10 Hz
+
+	deadline_nsec  = 0;
+	last_wake_nsec = 0;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Rate
+// ------------------------------------------------------------------------------
+bool
+Periodic_Scheduler::
+set_rate(float rate_hz)
+{
+	if ( not ( rate_hz >= PERIODIC_SCHEDULER_MIN_HZ and rate_hz <= PERIODIC_SCHEDULER_MAX_HZ ) )
+	{
+		fprintf(stderr,"WARNING: rate %.1f Hz outside %.0f to %.0f Hz, unchanged\n",
+		        rate_hz, PERIODIC_SCHEDULER_MIN_HZ, PERIODIC_SCHEDULER_MAX_HZ);
+		return false;
+	}
+
+	// taken up at the next deadline
+	period_nsec.store((uint64_t)(1e9 / rate_hz + 0.5), std::memory_order_relaxed);
+	return true;
+}
+
+float
+Periodic_Scheduler::
+get_rate() const
+{
+	return 1e9f / get_period_nsec();
+}
+
+
+// ------------------------------------------------------------------------------
+//   Loop
+// ------------------------------------------------------------------------------
+void
+Periodic_Scheduler::
+start()
+{
+	last_wake_nsec = monotonic_nsec();
+	deadline_nsec  = last_wake_nsec + get_period_nsec();
+
+	Scheduler_Stats fresh;
+	memset(&fresh, 0, sizeof(fresh));
+	fresh.min_period_nsec = UINT64_MAX;
+	stats.store(fresh);
+}
+
+bool
+Periodic_Scheduler::
+wait()
+{
+	uint64_t period = get_period_nsec();
+	uint64_t now    = monotonic_nsec();
+
+	bool     on_time = now < deadline_nsec;
+	uint64_t skipped = 0;
+
+	if ( on_time )
+	{
+		struct timespec deadline;
+		deadline.tv_sec  = deadline_nsec / 1000000000ULL;
+		deadline.tv_nsec = deadline_nsec % 1000000000ULL;
+
+		// absolute, so an interrupted sleep simply resumes
+		while ( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR )
+			;
+	}
+
+	// a whole period or more lost, keep the phase instead of catching up
+	else if ( now - deadline_nsec >= period )
+	{
+		skipped        = ( now - deadline_nsec ) / period;
+		deadline_nsec += skipped * period;
+	}
+
+	uint64_t wake    = monotonic_nsec();
+	uint64_t elapsed = wake - last_wake_nsec;
+	uint64_t latency = wake > deadline_nsec ? wake - deadline_nsec : 0;
+
+	last_wake_nsec = wake;
+	deadline_nsec += period;
+
+	stats.update([&](Scheduler_Stats &s)
+	{
+		s.cycles++;
+		s.skipped += skipped;
+		if ( not on_time )
+			s.overruns++;
+
+		// Welford
+		double delta = elapsed - s.mean_period_nsec;
+		s.mean_period_nsec += delta / s.cycles;
+		s.period_m2        += delta * ( elapsed - s.mean_period_nsec );
+
+		if ( elapsed < s.min_period_nsec ) s.min_period_nsec = elapsed;
+		if ( elapsed > s.max_period_nsec ) s.max_period_nsec = elapsed;
+
+		// an overrun's lateness is the work's, not the sleep's
+		if ( on_time )
+		{
+			uint64_t woken = s.cycles - s.overruns;
+			s.mean_latency_nsec += ( latency - s.mean_latency_nsec ) / woken;
+			if ( latency > s.max_latency_nsec ) s.max_latency_nsec = latency;
+		}
+	});
+
+	return on_time;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Statistics
+// ------------------------------------------------------------------------------
+double
+Periodic_Scheduler::
+jitter_usec(const Scheduler_Stats &stats_)
+{
+	if ( stats_.cycles < 2 )
+		return 0.0;
+
+	return sqrt(stats_.period_m2 / (stats_.cycles - 1)) / 1000.0;
+}
+
+void
+Periodic_Scheduler::
+print(FILE *out) const
+{
+	Scheduler_Stats s = get_stats();
+
+	fprintf(out, "%.1f Hz, %lu cycles, %lu overruns, %lu skipped\n",
+	        get_rate(), (unsigned long)s.cycles, (unsigned long)s.overruns, (unsigned long)s.skipped);
+
+	if ( s.cycles == 0 )
+		return;
+
+	fprintf(out, "period min %.3f mean %.3f max %.3f ms, jitter %.1f us, wake latency mean %.1f max %.1f us\n",
+	        s.min_period_nsec / 1e6, s.mean_period_nsec / 1e6, s.max_period_nsec / 1e6,
+	        jitter_usec(s), s.mean_latency_nsec / 1e3, s.max_latency_nsec / 1e3);
+}
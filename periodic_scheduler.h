@@ -0,0 +1,113 @@
+/**
+ * @file periodic_scheduler.h
+ *
+ * @brief Fixed rate loop on absolute deadlines, definition
+ *
+ * Paces the setpoint stream and measures how well it keeps time.
+ */
+
+#ifndef PERIODIC_SCHEDULER_H_
+#define PERIODIC_SCHEDULER_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "seqlock.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// accepted by Periodic_Scheduler::set_rate()
+#define PERIODIC_SCHEDULER_MIN_HZ 1.0f
+#define PERIODIC_SCHEDULER_MAX_HZ 250.0f
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+struct Scheduler_Stats
+{
+	uint64_t cycles;
+	uint64_t overruns;          // work ran past the next deadline
+	uint64_t skipped;           // deadlines dropped after an overrun
+
+	// wake to wake, nominally the period
+	uint64_t min_period_nsec;
+	uint64_t max_period_nsec;
+	double   mean_period_nsec;
+	double   period_m2;         // sum of squared deviations, see jitter_usec()
+
+	// deadline to wake
+	uint64_t max_latency_nsec;
+	double   mean_latency_nsec;
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Periodic Scheduler Class
+// ----------------------------------------------------------------------------------
+/*
+ * Periodic Scheduler Class
+ *
+ * wait() sleeps with clock_nanosleep(TIMER_ABSTIME) on CLOCK_MONOTONIC until
+ * the next deadline, which is always the previous one plus the period.  The
+ * time spent working in between is thereby taken off the sleep, and neither
+ * it nor late wake-ups add up to drift.
+ *
+ * When the work runs past the next deadline wait() returns at once and
+ * counts an overrun.  If a whole period or more was lost the missed
+ * deadlines are skipped rather than caught up in a burst, and the loop
+ * keeps its phase.
+ *
+ * The loop thread is the only one to call start() and wait(); the rate and
+ * the statistics may be changed or read from any thread.
+ */
+class Periodic_Scheduler
+{
+
+public:
+
+	Periodic_Scheduler();
+
+	// PERIODIC_SCHEDULER_MIN_HZ to _MAX_HZ, false and unchanged outside
+	bool     set_rate(float rate_hz);
+	float    get_rate() const;
+	uint64_t get_period_nsec() const { return period_nsec.load(std::memory_order_relaxed); }
+
+	// First deadline one period from now, clears the statistics
+	void start();
+
+	// Sleep until the next deadline, false if it had already passed
+	bool wait();
+
+	Scheduler_Stats get_stats() const { return stats.load(); }
+
+	// Standard deviation of the period
+	static double jitter_usec(const Scheduler_Stats &stats);
+
+	void print(FILE *out) const;
+
+private:
+
+	std::atomic<uint64_t> period_nsec;
+
+	// loop thread only
+	uint64_t deadline_nsec;
+	uint64_t last_wake_nsec;
+
+	Seqlock<Scheduler_Stats> stats;
+
+	Periodic_Scheduler(const Periodic_Scheduler &);
+	Periodic_Scheduler &operator=(const Periodic_Scheduler &);
+
+};
+
+#endif // PERIODIC_SCHEDULER_H_
@@ -0,0 +1,348 @@
+/**
+ * @file rate_monitor.cpp
+ *
+ * @brief Per message id arrival rate and jitter, functions
+ *
+ * Log-linear gap histograms, windowed rates and sequence loss
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "rate_monitor.h"
+#include "message_info.h"
+#include "hr_clock.h"
+
+#include <math.h>
+
+
+// ----------------------------------------------------------------------------------
+//   Rate Monitor Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Rate_Monitor::
+Rate_Monitor()
+{
+	for (int i = 0; i < 256; i++)
+		stats[i].store(NULL, std::memory_order_relaxed);
+
+	for (int i = 0; i < RATE_MONITOR_MAX_SENDERS; i++)
+		senders[i] = NULL;
+
+	num_senders.store(0, std::memory_order_relaxed);
+	last_sender = 0;
+
+	dump_requested.store(false, std::memory_order_relaxed);
+}
+
+Rate_Monitor::
+~Rate_Monitor()
+{
+	for (int i = 0; i < 256; i++)
+		delete stats[i].load();
+
+	for (int i = 0; i < RATE_MONITOR_MAX_SENDERS; i++)
+		delete senders[i];
+}
+
+
+// ------------------------------------------------------------------------------
+//   Histogram Buckets
+// ------------------------------------------------------------------------------
+unsigned
+Rate_Monitor::
+bucket_of(uint64_t gap_usec)
+{
+	if ( gap_usec < RATE_MONITOR_SUB_BUCKETS )
+		return (unsigned)gap_usec;
+
+	if ( gap_usec >= (1ull << 31) )
+		return RATE_MONITOR_BUCKETS - 1;
+
+	// top bit picks the power of two, the next three the sub bucket
+	unsigned exponent = 63 - __builtin_clzll(gap_usec);
+	unsigned sub = (unsigned)(gap_usec >> (exponent - 3)) & (RATE_MONITOR_SUB_BUCKETS - 1);
+
+	return (exponent - 2) * RATE_MONITOR_SUB_BUCKETS + sub;
+}
+
+uint64_t
+Rate_Monitor::
+bucket_floor(unsigned bucket)
+{
+	if ( bucket < RATE_MONITOR_SUB_BUCKETS )
+		return bucket;
+
+	unsigned exponent = bucket / RATE_MONITOR_SUB_BUCKETS + 2;
+	unsigned sub = bucket % RATE_MONITOR_SUB_BUCKETS;
+
+	return (uint64_t)(RATE_MONITOR_SUB_BUCKETS + sub) << (exponent - 3);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Record
+// ------------------------------------------------------------------------------
+void
+Rate_Monitor::
+record(const mavlink_message_t &message, uint64_t time_usec)
+{
+	Seqlock<Rate_Stats> *id_stats = stats[message.msgid].load(std::memory_order_relaxed);
+	if ( id_stats == NULL )
+	{
+		id_stats = new Seqlock<Rate_Stats>();
+		stats[message.msgid].store(id_stats, std::memory_order_release);
+	}
+
+	id_stats->update([time_usec](Rate_Stats &s) {
+
+		if ( s.count == 0 )
+		{
+			s.first_usec        = time_usec;
+			s.window_start_usec = time_usec;
+			s.min_gap_usec      = UINT64_MAX;
+		}
+		else
+		{
+			uint64_t gap = time_usec - s.last_usec;
+
+			if ( gap < s.min_gap_usec )
+				s.min_gap_usec = gap;
+			if ( gap > s.max_gap_usec )
+				s.max_gap_usec = gap;
+
+			// Welford's running mean and variance
+			uint64_t n = s.count;   // gaps so far, including this one
+			double delta = (double)gap - s.mean_gap_usec;
+			s.mean_gap_usec += delta / n;
+			s.gap_m2 += delta * ((double)gap - s.mean_gap_usec);
+
+			s.buckets[bucket_of(gap)]++;
+		}
+
+		s.count++;
+		s.last_usec = time_usec;
+
+		// close the window, the message that closes it starts the next
+		uint64_t elapsed = time_usec - s.window_start_usec;
+		if ( elapsed >= RATE_MONITOR_WINDOW_USEC )
+		{
+			s.rate_hz = s.window_count * 1e6f / elapsed;
+			s.window_start_usec = time_usec;
+			s.window_count = 0;
+		}
+		s.window_count++;
+	});
+}
+
+void
+Rate_Monitor::
+record_sequence(const mavlink_message_t &message)
+{
+	// usually the same sender as last time
+	Sender *sender = NULL;
+	unsigned n = num_senders.load(std::memory_order_relaxed);
+
+	if ( last_sender < n && senders[last_sender]->sysid == message.sysid &&
+	                        senders[last_sender]->compid == message.compid )
+		sender = senders[last_sender];
+
+	for (unsigned i = 0; sender == NULL && i < n; i++)
+	{
+		if ( senders[i]->sysid == message.sysid && senders[i]->compid == message.compid )
+		{
+			sender = senders[i];
+			last_sender = i;
+		}
+	}
+
+	if ( sender == NULL )
+	{
+		if ( n == RATE_MONITOR_MAX_SENDERS )
+			return;
+
+		sender = new Sender;
+		sender->stats.update([&message](Sequence_Stats &s) {
+			s.sysid  = message.sysid;
+			s.compid = message.compid;
+		});
+		sender->sysid    = message.sysid;
+		sender->compid   = message.compid;
+		sender->last_seq = message.seq - 1;
+		sender->behind   = 0;
+
+		senders[n]  = sender;
+		last_sender = n;
+		num_senders.store(n + 1, std::memory_order_release);
+	}
+
+	// wraps at 256, a run of skipped numbers is one burst of loss.  A step
+	// of half the range or more is a duplicate or a frame that was
+	// overtaken, not loss.  Several of those in a row follow an outage
+	// longer than half the range, the sequence restarts from there.
+	uint8_t step = (uint8_t)(message.seq - sender->last_seq);
+	uint8_t skipped = 0;
+	if ( step != 0 && step < 128 )
+	{
+		skipped = step - 1;
+		sender->last_seq = message.seq;
+		sender->behind   = 0;
+	}
+	else if ( ++sender->behind == RATE_MONITOR_RESYNC_BEHIND )
+	{
+		sender->last_seq = message.seq;
+		sender->behind   = 0;
+	}
+
+	sender->stats.update([skipped](Sequence_Stats &s) {
+		s.received++;
+		s.lost += skipped;
+		if ( skipped > s.max_burst )
+			s.max_burst = skipped;
+	});
+}
+
+
+// ------------------------------------------------------------------------------
+//   Queries
+// ------------------------------------------------------------------------------
+bool
+Rate_Monitor::
+get_stats(uint8_t msgid, Rate_Stats &stats_) const
+{
+	const Seqlock<Rate_Stats> *id_stats = stats[msgid].load(std::memory_order_acquire);
+	if ( id_stats == NULL )
+		return false;
+
+	stats_ = id_stats->load();
+	return true;
+}
+
+float
+Rate_Monitor::
+get_rate(uint8_t msgid) const
+{
+	const Seqlock<Rate_Stats> *id_stats = stats[msgid].load(std::memory_order_acquire);
+	if ( id_stats == NULL )
+		return 0.0f;
+
+	return id_stats->load_field(&Rate_Stats::rate_hz);
+}
+
+Sequence_Stats
+Rate_Monitor::
+get_sequence_stats(unsigned sender) const
+{
+	return senders[sender]->stats.load();
+}
+
+uint64_t
+Rate_Monitor::
+gap_percentile(const Rate_Stats &stats_, double p)
+{
+	uint64_t gaps = stats_.count > 1 ? stats_.count - 1 : 0;
+	if ( gaps == 0 )
+		return 0;
+
+	uint64_t rank = (uint64_t)ceil(p * gaps);
+	if ( rank == 0 )
+		rank = 1;
+
+	uint64_t seen = 0;
+	for (unsigned i = 0; i < RATE_MONITOR_BUCKETS; i++)
+	{
+		seen += stats_.buckets[i];
+		if ( seen >= rank )
+		{
+			// middle of the bucket, clamped to what was actually seen
+			uint64_t low  = bucket_floor(i);
+			uint64_t high = i + 1 < RATE_MONITOR_BUCKETS ? bucket_floor(i + 1) : low;
+			uint64_t mid  = low + (high - low) / 2;
+
+			if ( mid > stats_.max_gap_usec ) mid = stats_.max_gap_usec;
+			if ( mid < stats_.min_gap_usec ) mid = stats_.min_gap_usec;
+			return mid;
+		}
+	}
+
+	return stats_.max_gap_usec;
+}
+
+double
+Rate_Monitor::
+jitter_usec(const Rate_Stats &stats_)
+{
+	if ( stats_.count < 3 )
+		return 0.0;
+
+	return sqrt(stats_.gap_m2 / (stats_.count - 2));
+}
+
+
+// ------------------------------------------------------------------------------
+//   Print
+// ------------------------------------------------------------------------------
+void
+Rate_Monitor::
+print(FILE *out, uint64_t now_usec) const
+{
+	char wall[HR_CLOCK_WALL_FORMAT_SIZE];
+	hr_clock_format_wall(now_usec, wall, sizeof(wall));
+
+	fprintf(out, "\nMESSAGE RATES at %s\n", wall);
+	fprintf(out, " id  name                          count     Hz   mean ms  jitter ms   p50 ms   p99 ms   max ms   age ms\n");
+
+	for (int msgid = 0; msgid < 256; msgid++)
+	{
+		Rate_Stats s;
+		if ( not get_stats((uint8_t)msgid, s) )
+			continue;
+
+		const mavlink_message_info_t *info = get_message_info((uint8_t)msgid);
+
+		// a message may have come in after the caller read the time
+		uint64_t age_usec = now_usec > s.last_usec ? now_usec - s.last_usec : 0;
+
+		fprintf(out, "%3d  %-28s %7llu %6.1f %9.2f %10.2f %8.2f %8.2f %8.2f %8.1f\n",
+		        msgid, info ? info->name : "?",
+		        (unsigned long long)s.count, s.rate_hz,
+		        s.mean_gap_usec / 1000.0, jitter_usec(s) / 1000.0,
+		        gap_percentile(s, 0.50) / 1000.0, gap_percentile(s, 0.99) / 1000.0,
+		        s.max_gap_usec / 1000.0, age_usec / 1000.0);
+	}
+
+	fprintf(out, "\nLINK LOSS\n");
+	fprintf(out, " sys comp   received       lost   loss %%  max burst\n");
+
+	unsigned n = get_num_senders();
+	for (unsigned i = 0; i < n; i++)
+	{
+		Sequence_Stats s = get_sequence_stats(i);
+		uint64_t total = s.received + s.lost;
+
+		fprintf(out, "%4d %4d %10llu %10llu %8.2f %10u\n",
+		        s.sysid, s.compid,
+		        (unsigned long long)s.received, (unsigned long long)s.lost,
+		        total ? 100.0 * s.lost / total : 0.0, s.max_burst);
+	}
+
+	fprintf(out, "\n");
+}
+
+void
+Rate_Monitor::
+dump_if_requested(uint64_t now_usec)
+{
+	if ( not dump_requested.load(std::memory_order_relaxed) )
+		return;
+
+	// one caller prints
+	if ( dump_requested.exchange(false) )
+		print(stderr, now_usec);
+}
+
@@ -0,0 +1,162 @@
+/**
+ * @file rate_monitor.h
+ *
+ * @brief Per message id arrival rate and jitter, definition
+ *
+ * Watches the receive path for late, bunched up or lost messages.
+ */
+
+#ifndef RATE_MONITOR_H_
+#define RATE_MONITOR_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "seqlock.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <common/mavlink.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// Inter-arrival histogram: exact below 8 usec, then 8 buckets per power of
+// two (12.5% resolution) up to 2^31 usec
+#define RATE_MONITOR_SUB_BUCKETS 8
+#define RATE_MONITOR_BUCKETS     240
+
+// rate is re-measured over windows of this length
+#define RATE_MONITOR_WINDOW_USEC 1000000
+
+// senders whose sequence numbers are followed
+#define RATE_MONITOR_MAX_SENDERS 32
+
+// frames in a row behind the last sequence number before it is reset
+#define RATE_MONITOR_RESYNC_BEHIND 4
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+struct Rate_Stats
+{
+	uint64_t count;
+	uint64_t first_usec;        // host receive times
+	uint64_t last_usec;
+
+	float    rate_hz;           // over the last complete window
+
+	uint64_t min_gap_usec;
+	uint64_t max_gap_usec;
+	double   mean_gap_usec;
+	double   gap_m2;            // sum of squared deviations, see jitter_usec()
+
+	uint32_t buckets[RATE_MONITOR_BUCKETS];
+
+	// window in progress
+	uint64_t window_start_usec;
+	uint32_t window_count;
+};
+
+// Sequence numbers of one sender, for link loss
+struct Sequence_Stats
+{
+	uint8_t  sysid;
+	uint8_t  compid;
+	uint64_t received;
+	uint64_t lost;              // skipped sequence numbers
+	uint32_t max_burst;         // longest run of lost messages
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Rate Monitor Class
+// ----------------------------------------------------------------------------------
+/*
+ * Rate Monitor Class
+ *
+ * Both record functions run on the receive path.  record() takes the
+ * messages of interest, usually one vehicle's, and per message id keeps the
+ * count, the rate over the last RATE_MONITOR_WINDOW_USEC, the smallest and
+ * largest gap, the mean and standard deviation of the gaps and an HDR style
+ * histogram of them, from which percentiles are read.  record_sequence()
+ * takes every message on the link and per sender counts sequence number
+ * gaps, i.e. messages lost on the link.
+ *
+ * Statistics of an id are allocated on its first message and kept in a
+ * seqlock, so any thread may query them.  print() writes a table of
+ * everything; request_dump() only sets a flag and is safe in a signal
+ * handler, the next dump_if_requested() call does the printing.
+ */
+class Rate_Monitor
+{
+
+public:
+
+	Rate_Monitor();
+	~Rate_Monitor();
+
+	// Receive path only
+	void record(const mavlink_message_t &message, uint64_t time_usec);
+	void record_sequence(const mavlink_message_t &message);
+
+	// False if the id was never received
+	bool get_stats(uint8_t msgid, Rate_Stats &stats) const;
+
+	// Messages per second over the last window, 0 if never received
+	float get_rate(uint8_t msgid) const;
+
+	unsigned get_num_senders() const { return num_senders.load(std::memory_order_acquire); }
+	Sequence_Stats get_sequence_stats(unsigned sender) const;
+
+	// Gap below which fraction p (0..1) of the gaps fall
+	static uint64_t gap_percentile(const Rate_Stats &stats, double p);
+
+	// Standard deviation of the gaps
+	static double jitter_usec(const Rate_Stats &stats);
+
+	void print(FILE *out, uint64_t now_usec) const;
+
+	// Signal safe; the dump happens in dump_if_requested()
+	void request_dump() { dump_requested.store(true, std::memory_order_relaxed); }
+	void dump_if_requested(uint64_t now_usec);
+
+	// Histogram bucket of a gap, and the smallest gap in a bucket
+	static unsigned bucket_of(uint64_t gap_usec);
+	static uint64_t bucket_floor(unsigned bucket);
+
+private:
+
+	std::atomic<Seqlock<Rate_Stats>*> stats[256];
+
+	struct Sender
+	{
+		Seqlock<Sequence_Stats> stats;
+
+		// receive path only
+		uint8_t sysid;
+		uint8_t compid;
+		uint8_t last_seq;
+		uint8_t behind;     // frames in a row behind last_seq
+	};
+
+	Sender               *senders[RATE_MONITOR_MAX_SENDERS];
+	std::atomic<unsigned> num_senders;
+	unsigned              last_sender;    // receive path cache
+
+	std::atomic<bool> dump_requested;
+
+	Rate_Monitor(const Rate_Monitor &);
+	Rate_Monitor &operator=(const Rate_Monitor &);
+
+};
+
+#endif // RATE_MONITOR_H_
+
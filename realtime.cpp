@@ -0,0 +1,245 @@
+/**
+ * @file realtime.cpp
+ *
+ * @brief Real-time scheduling, CPU pinning and memory locking, functions
+ *
+ * SCHED_FIFO thread attributes with fallback, mlockall and prefaulting
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // pthread_attr_setaffinity_np
+#endif
+
+#include "realtime.h"
+
+#include <alloca.h>
+#include <atomic>
+#include <errno.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+// ------------------------------------------------------------------------------
+//   Helper Functions
+// ------------------------------------------------------------------------------
+
+static std::atomic<bool> memory_locked(false);
+
+static const char *
+policy_name(int policy)
+{
+	switch ( policy )
+	{
+		case SCHED_OTHER: return "SCHED_OTHER";
+		case SCHED_FIFO:  return "SCHED_FIFO";
+		case SCHED_RR:    return "SCHED_RR";
+		default:          return "?";
+	}
+}
+
+// Attributes of the config, the error of the first one refused
+static int
+set_attributes(pthread_attr_t &attr, const Realtime_Thread_Config &config)
+{
+	int result = 0;
+
+	if ( config.stack_size )
+		result = pthread_attr_setstacksize(&attr, config.stack_size);
+
+	if ( result == 0 and config.policy != SCHED_OTHER )
+	{
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = config.priority;
+
+		// not the creator's, which is inherited by default
+		result = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		if ( result == 0 )
+			result = pthread_attr_setschedpolicy(&attr, config.policy);
+		if ( result == 0 )
+			result = pthread_attr_setschedparam(&attr, &param);
+	}
+
+	if ( result == 0 and config.cpu >= 0 )
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(config.cpu, &cpus);
+		result = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+
+	return result;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Config
+// ------------------------------------------------------------------------------
+Realtime_Thread_Config::
+Realtime_Thread_Config()
+{
+	policy     = SCHED_OTHER;
+	priority   = 0;
+	cpu        = -1;
+	stack_size = 0;
+}
+
+Realtime_Config::
+Realtime_Config()
+{
+	lock_memory = false;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Threads
+// ------------------------------------------------------------------------------
+int
+realtime_create_thread(pthread_t *tid, const Realtime_Thread_Config &config,
+                       void *(*start_routine)(void *), void *args)
+{
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+
+	int result = set_attributes(attr, config);
+
+	// EPERM only shows here, the attributes themselves are not checked
+	if ( result == 0 )
+		result = pthread_create(tid, &attr, start_routine, args);
+
+	pthread_attr_destroy(&attr);
+
+	if ( result == 0 )
+		return 0;
+
+	fprintf(stderr,"WARNING: could not apply %s priority %d cpu %d (%s), using defaults\n",
+	        policy_name(config.policy), config.priority, config.cpu, strerror(result));
+
+	return pthread_create(tid, NULL, start_routine, args);
+}
+
+int
+realtime_mutex_init(pthread_mutex_t *mutex)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+
+	int result = pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	if ( result == 0 )
+		result = pthread_mutex_init(mutex, &attr);
+
+	pthread_mutexattr_destroy(&attr);
+
+	if ( result == 0 )
+		return 0;
+
+	return pthread_mutex_init(mutex, NULL);
+}
+
+void
+realtime_prefault_stack(size_t stack_size)
+{
+	pthread_attr_t attr;
+	if ( stack_size == 0 and pthread_getattr_np(pthread_self(), &attr) == 0 )
+	{
+		pthread_attr_getstacksize(&attr, &stack_size);
+		pthread_attr_destroy(&attr);
+	}
+
+	// the rest is left for the frames above and below this one
+	size_t size = stack_size / 2;
+	if ( size > REALTIME_PREFAULT_STACK )
+		size = REALTIME_PREFAULT_STACK;
+
+	volatile char *stack = (volatile char*)alloca(size);
+
+	// one write per page is enough
+	long page = sysconf(_SC_PAGESIZE);
+	for (size_t i = 0; i < size; i += page)
+		stack[i] = 0;
+}
+
+void
+realtime_print_thread(FILE *out, const char *name, pthread_t tid)
+{
+	int policy;
+	struct sched_param param;
+	if ( tid == 0 or pthread_getschedparam(tid, &policy, &param) )
+	{
+		fprintf(out, "%-8s thread not running\n", name);
+		return;
+	}
+
+	// CPUs as a list, e.g. 2,3
+	char list[128] = "";
+	size_t length = 0;
+	int count = 0;
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	if ( pthread_getaffinity_np(tid, sizeof(cpus), &cpus) == 0 )
+	{
+		for (int cpu = 0; cpu < CPU_SETSIZE and length + 8 < sizeof(list); cpu++)
+		{
+			if ( not CPU_ISSET(cpu, &cpus) )
+				continue;
+
+			length += snprintf(list + length, sizeof(list) - length, "%s%d", count ? "," : "", cpu);
+			count++;
+		}
+	}
+
+	fprintf(out, "%-8s thread %s priority %d, cpus %s, memory %s\n",
+	        name, policy_name(policy), param.sched_priority,
+	        count == sysconf(_SC_NPROCESSORS_ONLN) ? "any" : list,
+	        realtime_memory_locked() ? "locked" : "not locked");
+}
+
+
+// ------------------------------------------------------------------------------
+//   Memory
+// ------------------------------------------------------------------------------
+bool
+realtime_lock_memory()
+{
+	if ( memory_locked.load() )
+		return true;
+
+	if ( mlockall(MCL_CURRENT | MCL_FUTURE) )
+	{
+		fprintf(stderr,"WARNING: could not lock memory (%s)\n", strerror(errno));
+		return false;
+	}
+
+	// freed memory stays with us, so later mallocs do not fault
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	volatile char *heap = (volatile char*)malloc(REALTIME_PREFAULT_HEAP);
+	if ( heap )
+	{
+		long page = sysconf(_SC_PAGESIZE);
+		for (long i = 0; i < REALTIME_PREFAULT_HEAP; i += page)
+			heap[i] = 0;
+		free((void*)heap);
+	}
+
+	realtime_prefault_stack();
+
+	memory_locked.store(true);
+	return true;
+}
+
+bool
+realtime_memory_locked()
+{
+	return memory_locked.load();
+}
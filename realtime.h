@@ -0,0 +1,104 @@
+/**
+ * @file realtime.h
+ *
+ * @brief Real-time scheduling, CPU pinning and memory locking, definition
+ *
+ * Keeps the link threads off the CFS run queue and out of page faults.
+ */
+
+#ifndef REALTIME_H_
+#define REALTIME_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdio.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// stack touched by realtime_prefault_stack() at most, well above what the
+// threads use
+#define REALTIME_PREFAULT_STACK 65536
+
+// heap touched and kept by realtime_lock_memory()
+#define REALTIME_PREFAULT_HEAP (4 * 1024 * 1024)
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+struct Realtime_Thread_Config
+{
+	int    policy;        // SCHED_OTHER (default) or SCHED_FIFO
+	int    priority;      // 1 to 99 for SCHED_FIFO
+	int    cpu;           // pinned to this CPU, -1 (default) for any
+	size_t stack_size;    // 0 (default) for the system's
+
+	Realtime_Thread_Config();
+};
+
+/*
+ * Defaults leave the process as it is.  SCHED_FIFO needs CAP_SYS_NICE (or
+ * an rtprio limit), mlockall CAP_IPC_LOCK (or a memlock limit); what cannot
+ * be applied is reported and left at the default.
+ */
+struct Realtime_Config
+{
+	bool                   lock_memory;     // mlockall and prefault heap and stacks
+	Realtime_Thread_Config read_thread;
+	Realtime_Thread_Config write_thread;
+	Realtime_Thread_Config watchdog_thread; // Freshness_Watchdog, raises HOLD
+	Realtime_Thread_Config command_thread;  // Command_Engine retransmits
+	Realtime_Thread_Config loop_thread;     // Swarm_Manager, runs every session
+
+	Realtime_Config();
+};
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+/*
+ * pthread_create() with the policy, priority, CPU and stack size of the
+ * config.  If the system refuses them the thread is created with default
+ * attributes instead, after a warning; only that fails too is an error.
+ */
+int realtime_create_thread(pthread_t *tid, const Realtime_Thread_Config &config,
+                           void *(*start_routine)(void *), void *args);
+
+/*
+ * mlockall() current and future pages, keep freed heap instead of giving it
+ * back to the system, and fault in REALTIME_PREFAULT_HEAP of it.  Once per
+ * process, false if the pages could not be locked.
+ */
+bool realtime_lock_memory();
+bool realtime_memory_locked();
+
+/*
+ * pthread_mutex_init() with priority inheritance, so a SCHED_FIFO thread
+ * waiting for the lock lends its priority to a SCHED_OTHER holder instead
+ * of being held up by everything ranked between them.  Costs nothing while
+ * uncontended; a plain mutex where the system has no PI support.
+ */
+int realtime_mutex_init(pthread_mutex_t *mutex);
+
+/*
+ * Fault in the calling thread's stack, first thing in a thread.  At most
+ * half of stack_size is touched, so a small configured stack cannot
+ * overflow; 0 for the size the thread actually has.
+ */
+void realtime_prefault_stack(size_t stack_size = 0);
+
+// What a running thread actually got, one line, 0 for a thread not started
+void realtime_print_thread(FILE *out, const char *name, pthread_t tid);
+
+#endif // REALTIME_H_
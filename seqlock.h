@@ -0,0 +1,179 @@
+/**
+ * @file seqlock.h
+ *
+ * @brief Sequence lock for data shared between one writer and many readers
+ *
+ * The writer never waits for readers.  Readers copy the protected value and
+ * retry if the writer touched it during the copy, so they never see a
+ * half-updated value.
+ */
+
+#ifndef SEQLOCK_H_
+#define SEQLOCK_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// failed reads spun through before sleeping, a write takes far less
+#define SEQLOCK_SPIN_LIMIT 100
+
+// sleep between further reads, lets a preempted writer finish
+#define SEQLOCK_SLEEP_NSEC 10000
+
+
+// ----------------------------------------------------------------------------------
+//   Seqlock Class
+// ----------------------------------------------------------------------------------
+/*
+ * Seqlock Class
+ *
+ * Wraps a plain-old-data value T.  The sequence counter is odd while a write
+ * is in progress and even otherwise.  A read is consistent when the counter
+ * was even before the copy and unchanged after it.
+ *
+ * Only one thread may write (store() / update()).  Any number of threads may
+ * read (load() / read()).
+ *
+ * A reader that keeps failing spins SEQLOCK_SPIN_LIMIT times, then sleeps
+ * between tries: the writer was preempted mid-write, and a SCHED_FIFO
+ * reader on its CPU would otherwise never let it finish.  sched_yield()
+ * would not help, it only gives way to threads of the same priority.
+ */
+template <typename T>
+class Seqlock
+{
+
+public:
+
+	Seqlock()
+		: sequence(0)
+	{
+		memset(&value, 0, sizeof(value));
+	}
+
+	// Replace the whole value
+	void
+	store(const T &value_)
+	{
+		begin_write();
+		memcpy(&value, &value_, sizeof(value));
+		end_write();
+	}
+
+	// Modify the value in place, writer( T& ) must not block
+	template <typename Writer>
+	void
+	update(Writer writer)
+	{
+		begin_write();
+		writer(value);
+		end_write();
+	}
+
+	// Consistent copy of the whole value
+	T
+	load() const
+	{
+		T copy;
+		read([&copy](const T &v) { memcpy(&copy, &v, sizeof(copy)); });
+		return copy;
+	}
+
+	// Consistent copy of one member, cheaper than load() for large T
+	template <typename F>
+	F
+	load_field(F T::*field) const
+	{
+		F copy;
+		read([&copy, field](const T &v) { copy = v.*field; });
+		return copy;
+	}
+
+	/*
+	 * Run reader( const T& ) until it sees a consistent value.
+	 *
+	 * The reader may be run several times and may see torn data on the
+	 * discarded passes, so it must only copy out of the value.
+	 */
+	template <typename Reader>
+	void
+	read(Reader reader) const
+	{
+		for (unsigned tries = 0; ; tries++)
+		{
+			if ( tries )
+				back_off(tries);
+
+			uint32_t before = sequence.load(std::memory_order_acquire);
+			if ( before & 1 )
+				continue; // write in progress
+
+			reader(value);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			uint32_t after = sequence.load(std::memory_order_relaxed);
+			if ( before == after )
+				return;
+		}
+	}
+
+	// Number of completed writes
+	uint32_t
+	version() const
+	{
+		return sequence.load(std::memory_order_acquire) >> 1;
+	}
+
+private:
+
+	Seqlock(const Seqlock &);
+	Seqlock &operator=(const Seqlock &);
+
+	std::atomic<uint32_t> sequence;
+	T value;
+
+	void
+	begin_write()
+	{
+		uint32_t s = sequence.load(std::memory_order_relaxed);
+		sequence.store(s + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	void
+	end_write()
+	{
+		uint32_t s = sequence.load(std::memory_order_relaxed);
+		sequence.store(s + 1, std::memory_order_release);
+	}
+
+	static void
+	back_off(unsigned tries)
+	{
+		if ( tries < SEQLOCK_SPIN_LIMIT )
+		{
+#if defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+#endif
+			return;
+		}
+
+		struct timespec pause = { 0, SEQLOCK_SLEEP_NSEC };
+		nanosleep(&pause, NULL);
+	}
+
+};
+
+#endif // SEQLOCK_H_
+
@@ -13,6 +13,10 @@
 // ------------------------------------------------------------------------------
 
 #include "serial_port.h"
+#include "realtime.h"
+
+#include <errno.h>
+#include <string.h>
 
 
 // ----------------------------------------------------------------------------------
@@ -55,8 +59,19 @@ initialize_defaults()
 	uart_name = (char*)"/dev/ttyUSB0";
 	baudrate  = 57600;
 
+	// parser of our own, see rx_status
+	memset(&rx_message, 0, sizeof(rx_message));
+	memset(&rx_status,  0, sizeof(rx_status));
+	memset(&lastStatus, 0, sizeof(lastStatus));
+
+	rx_length   = 0;
+	rx_position = 0;
+
+	queued_writes = false;
+	tx_length     = 0;
+
 	// Start mutex
-	int result = pthread_mutex_init(&lock, NULL);
+	int result = realtime_mutex_init(&lock);
 	if ( result != 0 )
 	{
 		printf("\n mutex init failed\n");
@@ -73,14 +88,13 @@ Serial_Port::
 read_message(mavlink_message_t &message)
 {
 	uint8_t          cp;
-	mavlink_status_t status;
 	uint8_t          msgReceived = false;
 
 	// --------------------------------------------------------------------------
 	//   READ FROM PORT
 	// --------------------------------------------------------------------------
 
-	// this function locks the port during read
+	// blocks until a byte comes, without the lock writers need
 	int result = _read_port(cp);
 
 
@@ -90,16 +104,7 @@ read_message(mavlink_message_t &message)
 	if (result > 0)
 	{
 		// the parsing
-		msgReceived = mavlink_parse_char(MAVLINK_COMM_1, cp, &message, &status);
-
-		// check for dropped packets
-		if ( (lastStatus.packet_rx_drop_count != status.packet_rx_drop_count) && debug )
-		{
-			printf("ERROR: DROPPED %d PACKETS\n", status.packet_rx_drop_count);
-			unsigned char v=cp;
-			fprintf(stderr,"%02x ", v);
-		}
-		lastStatus = status;
+		msgReceived = _parse_byte(cp, message);
 	}
 
 	// Couldn't read from port
@@ -145,6 +150,84 @@ read_message(mavlink_message_t &message)
 	return msgReceived;
 }
 
+// ------------------------------------------------------------------------------
+//   Buffered Read for Event Loops
+// ------------------------------------------------------------------------------
+int
+Serial_Port::
+read_buffered()
+{
+	// unparsed bytes left, don't overwrite them
+	if ( rx_position < rx_length )
+		return 0;
+
+	// caller saw the port readable, so this does not block; the lock is
+	// for writers only
+	int result = read(fd, rx_buffer, SERIAL_PORT_RX_BUFFER);
+
+	rx_position = 0;
+	rx_length   = result > 0 ? result : 0;
+
+	// non-blocking in queued mode, nothing there after all
+	if ( result < 0 and ( errno == EAGAIN or errno == EWOULDBLOCK ) )
+		return 0;
+
+	if ( result < 0 )
+		fprintf(stderr, "ERROR: Could not read from fd %d\n", fd);
+
+	return result;
+}
+
+bool
+Serial_Port::
+parse_message(mavlink_message_t &message)
+{
+	while ( rx_position < rx_length )
+	{
+		if ( _parse_byte(rx_buffer[rx_position++], message) )
+			return true;
+	}
+
+	return false;
+}
+
+bool
+Serial_Port::
+_parse_byte(uint8_t cp, mavlink_message_t &message)
+{
+	mavlink_status_t status;
+
+	uint8_t result = mavlink_frame_char_buffer(&rx_message, &rx_status, cp, &message, &status);
+
+	// a bad CRC is a parse error, as in mavlink_parse_char()
+	if ( result == MAVLINK_FRAMING_BAD_CRC )
+	{
+		rx_status.parse_error++;
+		rx_status.msg_received = MAVLINK_FRAMING_INCOMPLETE;
+		rx_status.parse_state  = MAVLINK_PARSE_STATE_IDLE;
+		if ( cp == MAVLINK_STX )
+		{
+			rx_status.parse_state = MAVLINK_PARSE_STATE_GOT_STX;
+			rx_message.len = 0;
+			mavlink_start_checksum(&rx_message);
+		}
+	}
+
+	bool msgReceived = ( result == MAVLINK_FRAMING_OK );
+
+	// check for dropped packets
+	if ( (lastStatus.packet_rx_drop_count != status.packet_rx_drop_count) && debug )
+	{
+		printf("ERROR: DROPPED %d PACKETS\n", status.packet_rx_drop_count);
+		unsigned char v=cp;
+		fprintf(stderr,"%02x ", v);
+	}
+	lastStatus = status;
+
+	return msgReceived;
+}
+
+
 // ------------------------------------------------------------------------------
 //   Write to Serial
 // ------------------------------------------------------------------------------
@@ -164,6 +247,71 @@ write_message(const mavlink_message_t &message)
 }
 
 
+// ------------------------------------------------------------------------------
+//   Queued Writes for Event Loops
+// ------------------------------------------------------------------------------
+void
+Serial_Port::
+set_queued_writes(bool queued)
+{
+	pthread_mutex_lock(&lock);
+
+	queued_writes = queued;
+
+	// the event loop must never block on the port
+	if ( fd >= 0 )
+	{
+		int flags = fcntl(fd, F_GETFL);
+		fcntl(fd, F_SETFL, queued ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+bool
+Serial_Port::
+has_pending_writes()
+{
+	pthread_mutex_lock(&lock);
+	bool result = tx_length > 0;
+	pthread_mutex_unlock(&lock);
+
+	return result;
+}
+
+int
+Serial_Port::
+flush_writes()
+{
+	pthread_mutex_lock(&lock);
+	int result = _flush_locked();
+	pthread_mutex_unlock(&lock);
+
+	return result;
+}
+
+// Write what the port takes now, lock held
+int
+Serial_Port::
+_flush_locked()
+{
+	if ( tx_length == 0 )
+		return 0;
+
+	int result = static_cast<int>(write(fd, tx_buffer, tx_length));
+
+	if ( result > 0 )
+	{
+		tx_length -= result;
+		memmove(tx_buffer, tx_buffer + result, tx_length);
+	}
+	else if ( result < 0 and errno != EAGAIN and errno != EWOULDBLOCK )
+		fprintf(stderr, "ERROR: Could not write to fd %d\n", fd);
+
+	return result;
+}
+
+
 // ------------------------------------------------------------------------------
 //   Open Serial Port
 // ------------------------------------------------------------------------------
@@ -214,6 +362,10 @@ open_serial()
 	printf("Connected to %s with %d-8N1\n", uart_name, baudrate);
 	lastStatus.packet_rx_drop_count = 0;
 
+	// queued mode was chosen before the port was open
+	if ( queued_writes )
+		set_queued_writes(true);
+
 	status = true;
 
 	printf("\n");
@@ -458,22 +610,17 @@ _setup_port(int baud, int data_bits, int stop_bits, bool parity, bool hardware_c
 
 
 // ------------------------------------------------------------------------------
-//   Read Port with Lock
+//   Read Port
 // ------------------------------------------------------------------------------
+/*
+ * No lock: there is one reader, and holding the port lock through a
+ * blocking read would stall every writer until the next byte comes in.
+ */
 int
 Serial_Port::
 _read_port(uint8_t &cp)
 {
-
-	// Lock
-	pthread_mutex_lock(&lock);
-
-	int result = read(fd, &cp, 1);
-
-	// Unlock
-	pthread_mutex_unlock(&lock);
-
-	return result;
+	return read(fd, &cp, 1);
 }
 
 
@@ -488,6 +635,27 @@ _write_port(char *buf, unsigned len)
 	// Lock
 	pthread_mutex_lock(&lock);
 
+	// event loop, queue behind what is still waiting and never block
+	if ( queued_writes )
+	{
+		int queued = -1;
+		if ( tx_length + (int)len <= SERIAL_PORT_TX_BUFFER )
+		{
+			memcpy(tx_buffer + tx_length, buf, len);
+			tx_length += len;
+			queued = len;
+
+			_flush_locked();
+		}
+
+		pthread_mutex_unlock(&lock);
+
+		if ( queued < 0 )
+			fprintf(stderr, "WARNING: write queue of fd %d full, message dropped\n", fd);
+
+		return queued;
+	}
+
 	// Write packet via serial link
 	const int bytesWritten = static_cast<int>(write(fd, buf, len));
 
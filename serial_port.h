@@ -45,6 +45,12 @@
 #define SERIAL_PORT_CLOSED 0;
 #define SERIAL_PORT_ERROR -1;
 
+// bytes taken from the port per read_buffered()
+#define SERIAL_PORT_RX_BUFFER 512
+
+// bytes waiting to be written in queued mode
+#define SERIAL_PORT_TX_BUFFER 4096
+
 
 // ------------------------------------------------------------------------------
 //   Prototypes
@@ -84,6 +90,23 @@ public:
 	int read_message(mavlink_message_t &message);
 	int write_message(const mavlink_message_t &message);
 
+	/*
+		Event loop reading: poll get_fd(), call read_buffered() once when it
+		is readable, then parse_message() until it returns false.
+	*/
+	int  get_fd() const { return fd; }
+	int  read_buffered();
+	bool parse_message(mavlink_message_t &message);
+
+	/*
+		Event loop writing: write_message() only queues and writes what
+		the port takes without blocking, there is no tcdrain.  Poll for
+		POLLOUT while has_pending_writes(), then call flush_writes().
+	*/
+	void set_queued_writes(bool queued);
+	bool has_pending_writes();
+	int  flush_writes();
+
 	void open_serial();
 	void close_serial();
 
@@ -96,7 +119,28 @@ private:
 
 	int  fd;
 	mavlink_status_t lastStatus;
-	pthread_mutex_t  lock;
+	pthread_mutex_t  lock;     // writers, reads need none
+
+	/*
+		Parser state of this port alone.  The shared MAVLink channels
+		run out after MAVLINK_COMM_NUM_BUFFERS ports, and two ports on
+		one channel corrupt each other's partial frames.
+	*/
+	mavlink_message_t rx_message;
+	mavlink_status_t  rx_status;
+
+	uint8_t rx_buffer[SERIAL_PORT_RX_BUFFER];
+	int     rx_length;
+	int     rx_position;
+
+	// guarded by lock
+	bool    queued_writes;
+	uint8_t tx_buffer[SERIAL_PORT_TX_BUFFER];
+	int     tx_length;
+
+	int  _flush_locked();
+
+	bool _parse_byte(uint8_t cp, mavlink_message_t &message);
 
 	int  _open_port(const char* port);
 	bool _setup_port(int baud, int data_bits, int stop_bits, bool parity, bool hardware_control);
@@ -0,0 +1,249 @@
+/**
+ * @file setpoint_trajectory.cpp
+ *
+ * @brief Timed setpoint queue sampled at the stream rate, functions
+ *
+ * Horizon replacement, Hermite / linear interpolation of setpoints
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "setpoint_trajectory.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// type_mask bits, set when the field is ignored
+#define TRAJECTORY_IGNORE_POSITION     0x0007
+#define TRAJECTORY_IGNORE_VELOCITY     0x0038
+#define TRAJECTORY_IGNORE_ACCELERATION 0x01C0
+#define TRAJECTORY_IGNORE_YAW          0x0400
+#define TRAJECTORY_IGNORE_YAW_RATE     0x0800
+
+
+// ------------------------------------------------------------------------------
+//   Helper Functions
+// ------------------------------------------------------------------------------
+
+static bool
+uses(uint16_t type_mask, uint16_t bits)
+{
+	return ( type_mask & bits ) != bits;
+}
+
+static float
+lerp(float a, float b, float s)
+{
+	return a + ( b - a ) * s;
+}
+
+// Along the shorter way round
+static float
+lerp_angle(float a, float b, float s)
+{
+	float d = remainderf(b - a, 2.0f * (float)M_PI);
+	return remainderf(a + d * s, 2.0f * (float)M_PI);
+}
+
+
+// ----------------------------------------------------------------------------------
+//   Setpoint Trajectory Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Queue
+// ------------------------------------------------------------------------------
+bool
+Setpoint_Trajectory::
+push(const Trajectory_Point *points, unsigned num_points, uint64_t now_usec)
+{
+	// nothing to replace the horizon with, clear() empties it
+	if ( num_points == 0 )
+		return true;
+
+	bool complete = true;
+
+	queue.update([&](Queue &q)
+	{
+		// the last point at or before now still brackets the present
+		unsigned first = 0;
+		while ( first + 1 < q.count and q.points[first + 1].time_usec <= now_usec )
+			first++;
+
+		// older points stay until the new ones begin
+		unsigned keep = first;
+		while ( keep < q.count and q.points[keep].time_usec < points[0].time_usec )
+			keep++;
+
+		unsigned n = keep - first;
+		memmove(q.points, q.points + first, n * sizeof(Trajectory_Point));
+
+		for (unsigned i = 0; i < num_points; i++)
+		{
+			if ( n and points[i].time_usec <= q.points[n - 1].time_usec )
+			{
+				complete = false;
+				continue;
+			}
+
+			if ( n == SETPOINT_TRAJECTORY_MAX_POINTS )
+			{
+				complete = false;
+				break;
+			}
+
+			q.points[n++] = points[i];
+		}
+
+		q.count = n;
+	});
+
+	return complete;
+}
+
+void
+Setpoint_Trajectory::
+clear()
+{
+	queue.update([](Queue &q) { q.count = 0; });
+}
+
+uint64_t
+Setpoint_Trajectory::
+get_end_usec() const
+{
+	uint64_t end = 0;
+
+	queue.read([&end](const Queue &q)
+	{
+		unsigned n = std::min(q.count, (unsigned)SETPOINT_TRAJECTORY_MAX_POINTS);
+		end = n ? q.points[n - 1].time_usec : 0;
+	});
+
+	return end;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Sample
+// ------------------------------------------------------------------------------
+bool
+Setpoint_Trajectory::
+sample(uint64_t time_usec, mavlink_set_position_target_local_ned_t &setpoint) const
+{
+	Trajectory_Point a, b;
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	bool found, bracketed;
+
+	// copy out only the two points around the time
+	queue.read([&](const Queue &q)
+	{
+		found     = false;
+		bracketed = false;
+
+		unsigned n = std::min(q.count, (unsigned)SETPOINT_TRAJECTORY_MAX_POINTS);
+		if ( n == 0 or time_usec < q.points[0].time_usec )
+			return;
+
+		// last point at or before the time
+		unsigned lo = 0, hi = n - 1;
+		while ( lo < hi )
+		{
+			unsigned mid = ( lo + hi + 1 ) / 2;
+			if ( q.points[mid].time_usec <= time_usec )
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+
+		a = q.points[lo];
+		if ( lo + 1 < n )
+		{
+			b = q.points[lo + 1];
+			bracketed = true;
+		}
+		found = true;
+	});
+
+	if ( not found )
+		return false;
+
+	setpoint = a.setpoint;
+	setpoint.time_boot_ms = 0; // stamped when sent
+
+	// held after the last point, stepped between different kinds
+	uint16_t mask = a.setpoint.type_mask;
+	if ( not bracketed or b.setpoint.type_mask != mask or b.time_usec <= a.time_usec )
+		return true;
+
+	const mavlink_set_position_target_local_ned_t &p0 = a.setpoint;
+	const mavlink_set_position_target_local_ned_t &p1 = b.setpoint;
+
+	float h = ( b.time_usec - a.time_usec ) * 1e-6f;
+	float s = ( time_usec - a.time_usec ) * 1e-6f / h;
+
+	// cubic Hermite, as State_Interpolator
+	if ( uses(mask, TRAJECTORY_IGNORE_POSITION) and uses(mask, TRAJECTORY_IGNORE_VELOCITY) )
+	{
+		float s2 = s * s, s3 = s2 * s;
+		float h00 =  2*s3 - 3*s2 + 1;
+		float h10 =    s3 - 2*s2 + s;
+		float h01 = -2*s3 + 3*s2;
+		float h11 =    s3 -   s2;
+
+		const float x0[3] = { p0.x,  p0.y,  p0.z  }, x1[3] = { p1.x,  p1.y,  p1.z  };
+		const float v0[3] = { p0.vx, p0.vy, p0.vz }, v1[3] = { p1.vx, p1.vy, p1.vz };
+		float x[3], v[3];
+
+		for (int k = 0; k < 3; k++)
+		{
+			x[k] = h00 * x0[k] + h10 * h * v0[k] + h01 * x1[k] + h11 * h * v1[k];
+			v[k] = (6*s2 - 6*s) / h * x0[k] + (3*s2 - 4*s + 1) * v0[k]
+			     + (6*s - 6*s2) / h * x1[k] + (3*s2 - 2*s) * v1[k];
+		}
+
+		setpoint.x  = x[0]; setpoint.y  = x[1]; setpoint.z  = x[2];
+		setpoint.vx = v[0]; setpoint.vy = v[1]; setpoint.vz = v[2];
+	}
+	else
+	{
+		if ( uses(mask, TRAJECTORY_IGNORE_POSITION) )
+		{
+			setpoint.x = lerp(p0.x, p1.x, s);
+			setpoint.y = lerp(p0.y, p1.y, s);
+			setpoint.z = lerp(p0.z, p1.z, s);
+		}
+
+		if ( uses(mask, TRAJECTORY_IGNORE_VELOCITY) )
+		{
+			setpoint.vx = lerp(p0.vx, p1.vx, s);
+			setpoint.vy = lerp(p0.vy, p1.vy, s);
+			setpoint.vz = lerp(p0.vz, p1.vz, s);
+		}
+	}
+
+	if ( uses(mask, TRAJECTORY_IGNORE_ACCELERATION) )
+	{
+		setpoint.afx = lerp(p0.afx, p1.afx, s);
+		setpoint.afy = lerp(p0.afy, p1.afy, s);
+		setpoint.afz = lerp(p0.afz, p1.afz, s);
+	}
+
+	if ( uses(mask, TRAJECTORY_IGNORE_YAW) )
+		setpoint.yaw = lerp_angle(p0.yaw, p1.yaw, s);
+
+	if ( uses(mask, TRAJECTORY_IGNORE_YAW_RATE) )
+		setpoint.yaw_rate = lerp(p0.yaw_rate, p1.yaw_rate, s);
+
+	return true;
+}
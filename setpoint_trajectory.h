@@ -0,0 +1,95 @@
+/**
+ * @file setpoint_trajectory.h
+ *
+ * @brief Timed setpoint queue sampled at the stream rate, definition
+ *
+ * Lets a planner send a horizon of setpoints at its own rate while the
+ * write thread streams the interpolated point for "now".
+ */
+
+#ifndef SETPOINT_TRAJECTORY_H_
+#define SETPOINT_TRAJECTORY_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "seqlock.h"
+
+#include <stdint.h>
+
+#include <common/mavlink.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// points queued at once, a 2 s horizon at 20 Hz with room to spare
+#define SETPOINT_TRAJECTORY_MAX_POINTS 64
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+/*
+ * A setpoint and when it applies, on the hr_clock_usec() clock.  Its
+ * type_mask says which fields are used, as when streamed on its own.
+ */
+struct Trajectory_Point
+{
+	uint64_t                                time_usec;
+	mavlink_set_position_target_local_ned_t setpoint;
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Setpoint Trajectory Class
+// ----------------------------------------------------------------------------------
+/*
+ * Setpoint Trajectory Class
+ *
+ * push() queues points in time order.  They replace the queued points from
+ * the first new one's time on, so a planner simply pushes its latest
+ * horizon every cycle; points already passed are dropped.  Pushing no
+ * points leaves the queue as it is, clear() empties it.
+ *
+ * sample() gives the setpoint for a time.  Between two points with the same
+ * type_mask the used fields are interpolated: position by cubic Hermite if
+ * both points carry velocity (velocity then follows the curve), else
+ * linearly, like acceleration and yaw rate; yaw along the shorter way
+ * round.  Points with different type_masks are stepped between.  Before
+ * the first point there is no setpoint, after the last it is held.
+ *
+ * One thread pushes, any thread samples.  The queue is kept in a seqlock,
+ * sample() never blocks push() and vice versa.
+ */
+class Setpoint_Trajectory
+{
+
+public:
+
+	// False if points were dropped: out of order, or past the capacity
+	bool push(const Trajectory_Point *points, unsigned num_points, uint64_t now_usec);
+	void clear();
+
+	// False before the first point or when empty
+	bool sample(uint64_t time_usec, mavlink_set_position_target_local_ned_t &setpoint) const;
+
+	// Time of the last point, 0 when empty
+	uint64_t get_end_usec() const;
+
+private:
+
+	struct Queue
+	{
+		unsigned         count;
+		Trajectory_Point points[SETPOINT_TRAJECTORY_MAX_POINTS];
+	};
+
+	Seqlock<Queue> queue;
+
+};
+
+#endif // SETPOINT_TRAJECTORY_H_
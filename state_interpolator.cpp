@@ -0,0 +1,341 @@
+/**
+ * @file state_interpolator.cpp
+ *
+ * @brief Vehicle position and attitude at an arbitrary time, functions
+ *
+ * Hermite interpolation of position, slerp of attitude, short extrapolation
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "state_interpolator.h"
+
+#include <math.h>
+#include <stdio.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// Most samples a query looks back over, they are copied on the stack
+#define STATE_INTERPOLATOR_MAX_WINDOW 128
+
+
+// ------------------------------------------------------------------------------
+//   Helper Functions
+// ------------------------------------------------------------------------------
+
+/*
+ * Find where time_usec falls in the ascending times[0..n).
+ *
+ * Returns the index of the last sample at or before time_usec, or -1 if
+ * time_usec is older than every sample.
+ */
+static int
+find_bracket(const uint64_t *times, unsigned n, uint64_t time_usec)
+{
+	if ( n == 0 || time_usec < times[0] )
+		return -1;
+
+	unsigned low = 0, high = n - 1;
+	while ( low < high )
+	{
+		unsigned mid = (low + high + 1) / 2;
+		if ( times[mid] <= time_usec )
+			low = mid;
+		else
+			high = mid - 1;
+	}
+
+	return (int)low;
+}
+
+static void
+quaternion_multiply(const float a[4], const float b[4], float out[4])
+{
+	float w = a[0]*b[0] - a[1]*b[1] - a[2]*b[2] - a[3]*b[3];
+	float x = a[0]*b[1] + a[1]*b[0] + a[2]*b[3] - a[3]*b[2];
+	float y = a[0]*b[2] - a[1]*b[3] + a[2]*b[0] + a[3]*b[1];
+	float z = a[0]*b[3] + a[1]*b[2] - a[2]*b[1] + a[3]*b[0];
+
+	out[0] = w; out[1] = x; out[2] = y; out[3] = z;
+}
+
+static void
+quaternion_slerp(const float a[4], const float b_[4], float s, float out[4])
+{
+	float b[4] = { b_[0], b_[1], b_[2], b_[3] };
+
+	// take the short way round
+	float dot = a[0]*b[0] + a[1]*b[1] + a[2]*b[2] + a[3]*b[3];
+	if ( dot < 0.0f )
+	{
+		dot = -dot;
+		b[0] = -b[0]; b[1] = -b[1]; b[2] = -b[2]; b[3] = -b[3];
+	}
+
+	float wa, wb;
+	if ( dot > 0.9995f )
+	{
+		// nearly parallel, linear is exact enough and avoids 0/0
+		wa = 1.0f - s;
+		wb = s;
+	}
+	else
+	{
+		float theta = acosf(dot);
+		float sin_theta = sinf(theta);
+		wa = sinf((1.0f - s) * theta) / sin_theta;
+		wb = sinf(s * theta) / sin_theta;
+	}
+
+	float norm = 0.0f;
+	for (int i = 0; i < 4; i++)
+	{
+		out[i] = wa * a[i] + wb * b[i];
+		norm  += out[i] * out[i];
+	}
+
+	norm = sqrtf(norm);
+	for (int i = 0; i < 4; i++)
+		out[i] /= norm;
+}
+
+
+// ----------------------------------------------------------------------------------
+//   State Interpolator Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+State_Interpolator::
+State_Interpolator(Telemetry_Store &telemetry, const Time_Sync *time_sync_, unsigned depth)
+{
+	max_extrapolation_usec = 100000; // 100 ms
+
+	time_sync = time_sync_;
+
+	position_history = telemetry.enable_history(MAVLINK_MSG_ID_LOCAL_POSITION_NED, depth);
+	attitude_history = telemetry.enable_history(MAVLINK_MSG_ID_ATTITUDE, depth);
+
+	const char *position_fields[6] = { "x", "y", "z", "vx", "vy", "vz" };
+	const char *attitude_fields[6] = { "roll", "pitch", "yaw", "rollspeed", "pitchspeed", "yawspeed" };
+
+	for (int i = 0; i < 6; i++)
+	{
+		position_columns[i] = position_history->column(position_fields[i]);
+		attitude_columns[i] = attitude_history->column(attitude_fields[i]);
+
+		if ( position_columns[i] < 0 || attitude_columns[i] < 0 )
+		{
+			fprintf(stderr,"ERROR: position or attitude message lacks field %s / %s\n",
+			        position_fields[i], attitude_fields[i]);
+			throw 1;
+		}
+	}
+
+	position_boot_column = position_history->column("time_boot_ms");
+	attitude_boot_column = attitude_history->column("time_boot_ms");
+
+	if ( position_boot_column < 0 || attitude_boot_column < 0 )
+	{
+		fprintf(stderr,"ERROR: position or attitude message lacks field time_boot_ms\n");
+		throw 1;
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Samples
+// ------------------------------------------------------------------------------
+/*
+ * Copy the newest samples of a history, with the host time each was taken
+ * at: its time_boot_ms on the vehicle clock once that is synced, else the
+ * time it was received.  Returns the number of samples.
+ */
+unsigned
+State_Interpolator::
+copy_samples(const Message_History *history, const int *columns, int boot_column,
+             float *const *out, uint64_t *times) const
+{
+	for (;;)
+	{
+		uint64_t before = history->get_count();
+
+		unsigned n = history->copy_windows(columns, 6, STATE_INTERPOLATOR_MAX_WINDOW, out, times);
+
+		if ( time_sync == NULL || not time_sync->is_valid() )
+			return n;
+
+		// the same samples, unless one was appended in between
+		uint32_t boot_ms[STATE_INTERPOLATOR_MAX_WINDOW];
+		unsigned m = history->copy_window(boot_column, n, boot_ms);
+
+		if ( m != n || history->get_count() != before )
+			continue;
+
+		for (unsigned i = 0; i < n; i++)
+			times[i] = time_sync->vehicle_to_host_usec((uint64_t)boot_ms[i] * 1000);
+
+		return n;
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Position
+// ------------------------------------------------------------------------------
+bool
+State_Interpolator::
+position_at(uint64_t time_usec, Position_Estimate &estimate) const
+{
+	float    values[6][STATE_INTERPOLATOR_MAX_WINDOW];
+	float   *out[6] = { values[0], values[1], values[2], values[3], values[4], values[5] };
+	uint64_t times[STATE_INTERPOLATOR_MAX_WINDOW];
+
+	unsigned n = copy_samples(position_history, position_columns, position_boot_column, out, times);
+
+	int i = find_bracket(times, n, time_usec);
+	if ( i < 0 )
+		return false;
+
+	float p[3], v[3];
+
+	// newest sample or later, extrapolate with its velocity
+	if ( (unsigned)i == n - 1 )
+	{
+		uint64_t ahead = time_usec - times[i];
+		if ( ahead > max_extrapolation_usec )
+			return false;
+
+		float dt = ahead * 1e-6f;
+		for (int k = 0; k < 3; k++)
+		{
+			p[k] = values[k][i] + values[k+3][i] * dt;
+			v[k] = values[k+3][i];
+		}
+
+		estimate.extrapolated = ( ahead > 0 );
+	}
+
+	// cubic Hermite between sample i and i+1
+	else
+	{
+		float h = (times[i+1] - times[i]) * 1e-6f;
+		float s = (time_usec - times[i]) * 1e-6f / h;
+
+		float s2 = s * s, s3 = s2 * s;
+		float h00 =  2*s3 - 3*s2 + 1;
+		float h10 =    s3 - 2*s2 + s;
+		float h01 = -2*s3 + 3*s2;
+		float h11 =    s3 -   s2;
+
+		for (int k = 0; k < 3; k++)
+		{
+			float p0 = values[k][i],   p1 = values[k][i+1];
+			float v0 = values[k+3][i], v1 = values[k+3][i+1];
+
+			p[k] = h00 * p0 + h10 * h * v0 + h01 * p1 + h11 * h * v1;
+			v[k] = (6*s2 - 6*s) / h * p0 + (3*s2 - 4*s + 1) * v0
+			     + (6*s - 6*s2) / h * p1 + (3*s2 - 2*s) * v1;
+		}
+
+		estimate.extrapolated = false;
+	}
+
+	estimate.x  = p[0]; estimate.y  = p[1]; estimate.z  = p[2];
+	estimate.vx = v[0]; estimate.vy = v[1]; estimate.vz = v[2];
+
+	return true;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Attitude
+// ------------------------------------------------------------------------------
+bool
+State_Interpolator::
+attitude_at(uint64_t time_usec, Attitude_Estimate &estimate) const
+{
+	float    values[6][STATE_INTERPOLATOR_MAX_WINDOW];
+	float   *out[6] = { values[0], values[1], values[2], values[3], values[4], values[5] };
+	uint64_t times[STATE_INTERPOLATOR_MAX_WINDOW];
+
+	unsigned n = copy_samples(attitude_history, attitude_columns, attitude_boot_column, out, times);
+
+	int i = find_bracket(times, n, time_usec);
+	if ( i < 0 )
+		return false;
+
+	float q0[4];
+	mavlink_euler_to_quaternion(values[0][i], values[1][i], values[2][i], q0);
+
+	// newest sample or later, rotate on by the body rates
+	if ( (unsigned)i == n - 1 )
+	{
+		uint64_t ahead = time_usec - times[i];
+		if ( ahead > max_extrapolation_usec )
+			return false;
+
+		float dt = ahead * 1e-6f;
+		float w[3] = { values[3][i], values[4][i], values[5][i] };
+		float rate = sqrtf(w[0]*w[0] + w[1]*w[1] + w[2]*w[2]);
+
+		float dq[4] = { 1.0f, 0.0f, 0.0f, 0.0f };
+		if ( rate > 1e-6f )
+		{
+			float half = 0.5f * rate * dt;
+			float k = sinf(half) / rate;
+			dq[0] = cosf(half);
+			dq[1] = w[0] * k;
+			dq[2] = w[1] * k;
+			dq[3] = w[2] * k;
+		}
+
+		quaternion_multiply(q0, dq, estimate.q);
+
+		estimate.rollspeed  = w[0];
+		estimate.pitchspeed = w[1];
+		estimate.yawspeed   = w[2];
+		estimate.extrapolated = ( ahead > 0 );
+	}
+
+	// slerp between sample i and i+1
+	else
+	{
+		float q1[4];
+		mavlink_euler_to_quaternion(values[0][i+1], values[1][i+1], values[2][i+1], q1);
+
+		float s = (float)(time_usec - times[i]) / (float)(times[i+1] - times[i]);
+		quaternion_slerp(q0, q1, s, estimate.q);
+
+		estimate.rollspeed  = values[3][i] + s * (values[3][i+1] - values[3][i]);
+		estimate.pitchspeed = values[4][i] + s * (values[4][i+1] - values[4][i]);
+		estimate.yawspeed   = values[5][i] + s * (values[5][i+1] - values[5][i]);
+		estimate.extrapolated = false;
+	}
+
+	mavlink_quaternion_to_euler(estimate.q, &estimate.roll, &estimate.pitch, &estimate.yaw);
+
+	return true;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Pose
+// ------------------------------------------------------------------------------
+bool
+State_Interpolator::
+pose_at(uint64_t time_usec, Pose_Estimate &estimate) const
+{
+	estimate.time_usec = time_usec;
+
+	return position_at(time_usec, estimate.position) &&
+	       attitude_at(time_usec, estimate.attitude);
+}
+
@@ -0,0 +1,99 @@
+/**
+ * @file state_interpolator.h
+ *
+ * @brief Vehicle position and attitude at an arbitrary time, definition
+ *
+ * Interpolates between recorded LOCAL_POSITION_NED and ATTITUDE samples,
+ * e.g. to find the pose at the time a camera frame was taken.
+ */
+
+#ifndef STATE_INTERPOLATOR_H_
+#define STATE_INTERPOLATOR_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "telemetry_store.h"
+#include "time_sync.h"
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+struct Position_Estimate
+{
+	float x, y, z;        // local NED, m
+	float vx, vy, vz;     // local NED, m/s
+	bool  extrapolated;   // past the newest sample
+};
+
+struct Attitude_Estimate
+{
+	float q[4];                              // w, x, y, z
+	float roll, pitch, yaw;                  // rad
+	float rollspeed, pitchspeed, yawspeed;   // rad/s
+	bool  extrapolated;                      // past the newest sample
+};
+
+struct Pose_Estimate
+{
+	uint64_t          time_usec;
+	Position_Estimate position;
+	Attitude_Estimate attitude;
+};
+
+
+// ----------------------------------------------------------------------------------
+//   State Interpolator Class
+// ----------------------------------------------------------------------------------
+/*
+ * State Interpolator Class
+ *
+ * Answers "where was the vehicle at time T" from the message histories of a
+ * Telemetry_Store, which it enables on construction.  T is host time, the
+ * clock receive times are stamped with.  A sample is placed at its
+ * time_boot_ms, mapped to host time through time_sync, so read and link
+ * latency do not shift it.  Until the clocks are synced (or without a
+ * time_sync) the host receive time is used.
+ *
+ * Position uses cubic Hermite interpolation, since LOCAL_POSITION_NED carries
+ * the velocity at both ends.  Attitude is slerped between quaternions.  Past
+ * the newest sample both are extrapolated with the last velocity / body rates,
+ * for at most max_extrapolation_usec.  Queries older than the history fail.
+ *
+ * Queries copy out of the histories and may be made from any thread.
+ */
+class State_Interpolator
+{
+
+public:
+
+	State_Interpolator(Telemetry_Store &telemetry, const Time_Sync *time_sync, unsigned depth = 64);
+
+	uint64_t max_extrapolation_usec;
+
+	bool position_at(uint64_t time_usec, Position_Estimate &estimate) const;
+	bool attitude_at(uint64_t time_usec, Attitude_Estimate &estimate) const;
+	bool pose_at(uint64_t time_usec, Pose_Estimate &estimate) const;
+
+private:
+
+	const Time_Sync *time_sync;
+
+	const Message_History *position_history;
+	const Message_History *attitude_history;
+
+	int position_columns[6];  // x y z vx vy vz
+	int attitude_columns[6];  // roll pitch yaw rollspeed pitchspeed yawspeed
+	int position_boot_column;
+	int attitude_boot_column;
+
+	unsigned copy_samples(const Message_History *history, const int *columns, int boot_column,
+	                      float *const *out, uint64_t *times) const;
+
+};
+
+#endif // STATE_INTERPOLATOR_H_
+
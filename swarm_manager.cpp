@@ -0,0 +1,353 @@
+/**
+ * @file swarm_manager.cpp
+ *
+ * @brief Many vehicles from one event loop, functions
+ *
+ * ppoll over all ports, routing by system id, timer wheel setpoint streams
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "swarm_manager.h"
+
+#include <errno.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// wheel resolution, setpoints go out within this of their slot
+#define SWARM_TIMER_TICK_USEC 1000
+
+
+// ----------------------------------------------------------------------------------
+//   Swarm Manager Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Swarm_Manager::
+Swarm_Manager()
+	: timers(SWARM_TIMER_TICK_USEC)
+{
+	unrouted_count = 0;
+
+	time_to_exit = false;
+	loop_tid     = 0;
+
+	if ( pipe(wake_pipe) )
+	{
+		fprintf(stderr,"ERROR: could not create wake pipe\n");
+		throw 1;
+	}
+	fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+}
+
+Swarm_Manager::
+~Swarm_Manager()
+{
+	for (size_t i = 0; i < sessions.size(); i++)
+		delete sessions[i];
+	for (size_t i = 0; i < links.size(); i++)
+		delete links[i];
+
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Add Vehicle
+// ------------------------------------------------------------------------------
+/**
+ * throws EXIT_FAILURE if the vehicle's system id is taken on its port
+ */
+void
+Swarm_Manager::
+add_vehicle(Autopilot_Interface *api)
+{
+	api->start_session();
+
+	// find or add the vehicle's port
+	Serial_Port *port = api->get_serial_port();
+	Link *link = NULL;
+	for (size_t i = 0; i < links.size(); i++)
+		if ( links[i]->port == port )
+			link = links[i];
+
+	if ( not link )
+	{
+		link = new Link;
+		link->port = port;
+
+		// one slow port must not hold up the loop
+		port->set_queued_writes(true);
+		for (int i = 0; i < 256; i++)
+			link->routes[i] = NULL;
+		links.push_back(link);
+	}
+
+	int sysid = api->system_id & 0xff;
+	if ( link->routes[sysid] )
+	{
+		fprintf(stderr,"ERROR: two vehicles with system id %i on one port\n", sysid);
+		throw EXIT_FAILURE;
+	}
+	link->routes[sysid] = api;
+
+	Session *session = new Session;
+	session->api      = api;
+	session->manager  = this;
+	session->stream.callback = &stream_timer;
+	session->stream.context  = session;
+	session->commands_due    = false;
+	sessions.push_back(session);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Event Loop
+// ------------------------------------------------------------------------------
+void
+Swarm_Manager::
+run()
+{
+	if ( realtime_memory_locked() )
+		realtime_prefault_stack(realtime.loop_thread.stack_size);
+
+	// stagger the streams over one period
+	uint64_t now = get_time_usec();
+	for (size_t i = 0; i < sessions.size(); i++)
+	{
+		uint64_t period = sessions[i]->api->write_scheduler.get_period_nsec() / 1000;
+		timers.schedule(&sessions[i]->stream, now + period * i / sessions.size());
+
+		// stream deadlines and command retransmits run on the same wheel
+		sessions[i]->api->watchdog.arm(&timers, now);
+		sessions[i]->api->commands.arm(&timers, &commands_waker, sessions[i]);
+	}
+
+	// the wake pipe, then every port
+	std::vector<struct pollfd> fds(links.size() + 1);
+	fds[0].fd     = wake_pipe[0];
+	fds[0].events = POLLIN;
+	for (size_t i = 0; i < links.size(); i++)
+		fds[i+1].fd = links[i]->port->get_fd();
+
+	while ( !time_to_exit )
+	{
+		// writable only matters while bytes are queued
+		for (size_t i = 0; i < links.size(); i++)
+			fds[i+1].events = POLLIN | ( links[i]->port->has_pending_writes() ? POLLOUT : 0 );
+
+		// sleep until a port has data or the next stream is due
+		uint64_t next = timers.next_deadline();
+		now = get_time_usec();
+
+		struct timespec timeout, *timeout_ptr = NULL;
+		if ( next != UINT64_MAX )
+		{
+			uint64_t wait = next > now ? next - now : 0;
+			timeout.tv_sec  = wait / 1000000;
+			timeout.tv_nsec = (wait % 1000000) * 1000;
+			timeout_ptr = &timeout;
+		}
+
+		int result = ppoll(fds.data(), fds.size(), timeout_ptr, NULL);
+		if ( result < 0 && errno != EINTR )
+		{
+			fprintf(stderr,"ERROR: poll failed (%i)\n", errno);
+			break;
+		}
+
+		if ( result > 0 )
+		{
+			// a command was sent from another thread
+			if ( fds[0].revents & POLLIN )
+			{
+				char drain[16];
+				while ( read(wake_pipe[0], drain, sizeof(drain)) > 0 )
+					;
+
+				for (size_t i = 0; i < sessions.size(); i++)
+					if ( sessions[i]->commands_due.exchange(false) )
+						sessions[i]->api->commands.reschedule();
+			}
+
+			for (size_t i = 0; i < links.size(); i++)
+			{
+				short revents = fds[i+1].revents;
+
+				if ( revents & (POLLIN | POLLERR | POLLHUP) )
+					receive(links[i]);
+
+				if ( revents & POLLOUT )
+					links[i]->port->flush_writes();
+
+				// a hung up port stays readable, stop polling it
+				if ( revents & (POLLERR | POLLHUP | POLLNVAL) )
+				{
+					fprintf(stderr,"ERROR: lost port %s\n", links[i]->port->uart_name);
+					fds[i+1].fd = -1;
+				}
+			}
+		}
+
+		timers.advance(get_time_usec());
+	}
+
+	for (size_t i = 0; i < sessions.size(); i++)
+	{
+		timers.cancel(&sessions[i]->stream);
+		sessions[i]->api->watchdog.disarm();
+		sessions[i]->api->commands.disarm();
+	}
+
+	// drain the wake pipe for a later run()
+	char drain[16];
+	while ( read(wake_pipe[0], drain, sizeof(drain)) > 0 )
+		;
+}
+
+void
+Swarm_Manager::
+receive(Link *link)
+{
+	if ( link->port->read_buffered() <= 0 )
+		return;
+
+	uint64_t receive_time = get_time_usec();
+
+	mavlink_message_t message;
+	while ( link->port->parse_message(message) )
+	{
+		Autopilot_Interface *api = link->routes[message.sysid];
+
+		if ( api )
+			api->handle_message(message, receive_time);
+		else
+			unrouted_count++;
+	}
+}
+
+void
+Swarm_Manager::
+stream_timer(Wheel_Timer *timer, uint64_t now_usec, void *context)
+{
+	Session *session = (Session *)context;
+	Swarm_Manager *manager = session->manager;
+
+	session->api->write_stream(now_usec);
+
+	// the vehicle's own rate, see Periodic_Scheduler::set_rate()
+	uint64_t period = session->api->write_scheduler.get_period_nsec() / 1000;
+
+	// keep the phase, unless we fell a whole period behind
+	uint64_t next = timer->deadline_usec + period;
+	if ( next <= now_usec )
+		next = now_usec + period;
+
+	manager->timers.schedule(timer, next);
+}
+
+void
+Swarm_Manager::
+commands_waker(void *context)
+{
+	Session *session = (Session *)context;
+
+	session->commands_due = true;
+	session->manager->wake();
+}
+
+
+// ------------------------------------------------------------------------------
+//   Start / Stop
+// ------------------------------------------------------------------------------
+void
+Swarm_Manager::
+start()
+{
+	time_to_exit = false;
+
+	// before the thread, so its stack is locked as well
+	if ( realtime.lock_memory )
+		realtime_lock_memory();
+
+	int result = realtime_create_thread( &loop_tid, realtime.loop_thread, &start_swarm_manager_thread, this );
+	if ( result ) throw result;
+
+	// what the system actually granted
+	realtime_print_thread(stdout, "loop", loop_tid);
+}
+
+void
+Swarm_Manager::
+stop()
+{
+	time_to_exit = true;
+
+	// wake the loop out of ppoll
+	wake();
+
+	if ( loop_tid )
+	{
+		pthread_join(loop_tid, NULL);
+		loop_tid = 0;
+	}
+
+	// release anyone blocked waiting on telemetry
+	for (size_t i = 0; i < sessions.size(); i++)
+		sessions[i]->api->current_messages.notify_all();
+}
+
+
+void
+Swarm_Manager::
+wake()
+{
+	// a full pipe wakes it already
+	char byte = 1;
+	if ( write(wake_pipe[1], &byte, 1) < 0 and errno != EAGAIN )
+		fprintf(stderr,"WARNING: could not wake swarm loop\n");
+}
+
+
+// ------------------------------------------------------------------------------
+//   Quit Handler
+// ------------------------------------------------------------------------------
+void
+Swarm_Manager::
+handle_quit( int sig )
+{
+	time_to_exit = true;
+
+	// write() is async-signal-safe
+	char wake = 1;
+	if ( write(wake_pipe[1], &wake, 1) < 0 )
+		return;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Pthread Starter Helper Function
+// ------------------------------------------------------------------------------
+void*
+start_swarm_manager_thread(void *args)
+{
+	// takes a swarm manager object argument
+	Swarm_Manager *swarm_manager = (Swarm_Manager *)args;
+
+	// run the object's event loop
+	swarm_manager->run();
+
+	// done!
+	return NULL;
+}
+
@@ -0,0 +1,118 @@
+/**
+ * @file swarm_manager.h
+ *
+ * @brief Many vehicles from one event loop, definition
+ *
+ * Drives Autopilot_Interface sessions without per-vehicle threads.
+ */
+
+#ifndef SWARM_MANAGER_H_
+#define SWARM_MANAGER_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "autopilot_interface.h"
+#include "timer_wheel.h"
+
+#include <atomic>
+#include <vector>
+#include <poll.h>
+#include <pthread.h>
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+void* start_swarm_manager_thread(void *args);
+
+
+// ----------------------------------------------------------------------------------
+//   Swarm Manager Class
+// ----------------------------------------------------------------------------------
+/*
+ * Swarm Manager Class
+ *
+ * One thread runs every vehicle: it waits in ppoll() on all serial ports
+ * at once, routes each received message by system id to its vehicle's
+ * handle_message(), and fires each vehicle's setpoint stream from a timer
+ * wheel, at the rate of the vehicle's write_scheduler (which may change
+ * while the loop runs).  The streams start spread evenly over their period
+ * so the writes do not bunch up.  Several vehicles may share one port, e.g. a radio mesh.
+ * Ports are written in queued mode: a write never blocks the loop, what
+ * the port does not take at once goes out when it polls writable.
+ *
+ * Vehicles are added before the loop starts.  Each Autopilot_Interface must
+ * have its system_id and autopilot_id set, and is used in session mode
+ * (start_session()), never with its own start().  Commands may be sent to
+ * the vehicles from other threads while the loop runs, waits on their
+ * telemetry are woken by the loop.  Their retransmits run on the loop's
+ * wheel too, a new command wakes the loop to schedule them.
+ */
+class Swarm_Manager
+{
+
+public:
+
+	Swarm_Manager();
+	~Swarm_Manager();
+
+	uint64_t unrouted_count;           // messages from unknown system ids
+
+	// loop_thread and lock_memory, set before start()
+	Realtime_Config realtime;
+
+	void add_vehicle(Autopilot_Interface *api);
+	unsigned get_num_vehicles() const { return sessions.size(); }
+
+	// Loop on the calling thread until stop()
+	void run();
+
+	// Loop on a thread of its own
+	void start();
+	void stop();
+
+	void handle_quit( int sig );
+
+private:
+
+	// A port and the vehicles heard on it, by system id
+	struct Link
+	{
+		Serial_Port         *port;
+		Autopilot_Interface *routes[256];
+	};
+
+	struct Session
+	{
+		Autopilot_Interface *api;
+		Wheel_Timer          stream;
+		Swarm_Manager       *manager;
+		std::atomic<bool>    commands_due;   // reschedule its command engine
+	};
+
+	std::vector<Link*>    links;
+	std::vector<Session*> sessions;
+
+	Timer_Wheel timers;
+
+	std::atomic<bool> time_to_exit;
+	pthread_t         loop_tid;
+
+	// stop() writes here to wake the loop
+	int wake_pipe[2];
+
+	void receive(Link *link);
+	void wake();
+	static void stream_timer(Wheel_Timer *timer, uint64_t now_usec, void *context);
+	static void commands_waker(void *context);
+
+	Swarm_Manager(const Swarm_Manager &);
+	Swarm_Manager &operator=(const Swarm_Manager &);
+
+};
+
+#endif // SWARM_MANAGER_H_
+
@@ -0,0 +1,137 @@
+/**
+ * @file telemetry_history.cpp
+ *
+ * @brief Fixed-depth time series of received messages, functions
+ *
+ * Structure-of-arrays ring buffers laid out from MAVLink message metadata
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "telemetry_history.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+// ----------------------------------------------------------------------------------
+//   Message History Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Message_History::
+Message_History(uint8_t msgid_, unsigned depth_)
+{
+	msgid = msgid_;
+
+	// power of two, so ring positions are a mask away
+	depth = 2;
+	while ( depth < depth_ )
+		depth <<= 1;
+	mask = depth - 1;
+
+	count.store(0);
+
+	const mavlink_message_info_t *info = get_message_info(msgid);
+	if ( info == NULL )
+	{
+		fprintf(stderr,"ERROR: no metadata for message id %d, can not record history\n", msgid);
+		throw 1;
+	}
+
+	// one column per numeric element, text fields are left out
+	num_columns = 0;
+	for (unsigned i = 0; i < info->num_fields; i++)
+	{
+		const mavlink_field_info_t &field = info->fields[i];
+		if ( field.type == MAVLINK_TYPE_CHAR )
+			continue;
+		num_columns += field.array_length ? field.array_length : 1;
+	}
+
+	columns = new Column[num_columns];
+	times   = new uint64_t[2 * depth]();
+
+	unsigned n = 0;
+	for (unsigned i = 0; i < info->num_fields; i++)
+	{
+		const mavlink_field_info_t &field = info->fields[i];
+		if ( field.type == MAVLINK_TYPE_CHAR )
+			continue;
+
+		unsigned elements = field.array_length ? field.array_length : 1;
+		unsigned size     = get_field_type_size(field.type);
+
+		for (unsigned e = 0; e < elements; e++)
+		{
+			Column &c = columns[n++];
+			c.type        = field.type;
+			c.size        = size;
+			c.wire_offset = field.wire_offset + e * size;
+			c.name        = field.name;
+			c.index       = e;
+			c.data        = new uint8_t[2 * depth * size]();
+		}
+	}
+}
+
+Message_History::
+~Message_History()
+{
+	for (unsigned i = 0; i < num_columns; i++)
+		delete [] columns[i].data;
+
+	delete [] columns;
+	delete [] times;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Column Lookup
+// ------------------------------------------------------------------------------
+int
+Message_History::
+column(const char *field_name, unsigned index) const
+{
+	for (unsigned i = 0; i < num_columns; i++)
+		if ( columns[i].index == index && strcmp(columns[i].name, field_name) == 0 )
+			return (int)i;
+
+	return -1;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Append
+// ------------------------------------------------------------------------------
+void
+Message_History::
+append(const mavlink_message_t &message, uint64_t time_usec)
+{
+	uint64_t n = count.load(std::memory_order_relaxed);
+
+	// readers must see the count move before they can see any of this write
+	std::atomic_thread_fence(std::memory_order_release);
+
+	unsigned pos = (unsigned)(n & mask);
+	const uint8_t *payload = (const uint8_t*) _MAV_PAYLOAD(&message);
+
+	// both copies of the ring, so every window is contiguous
+	for (unsigned i = 0; i < num_columns; i++)
+	{
+		Column &c = columns[i];
+		memcpy(c.data +  pos          * c.size, payload + c.wire_offset, c.size);
+		memcpy(c.data + (pos + depth) * c.size, payload + c.wire_offset, c.size);
+	}
+
+	times[pos]         = time_usec;
+	times[pos + depth] = time_usec;
+
+	count.store(n + 1, std::memory_order_release);
+}
+
@@ -0,0 +1,219 @@
+/**
+ * @file telemetry_history.h
+ *
+ * @brief Fixed-depth time series of received messages, definition
+ *
+ * Keeps the last N samples of a message, one contiguous array per field.
+ */
+
+#ifndef TELEMETRY_HISTORY_H_
+#define TELEMETRY_HISTORY_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "message_info.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+#include <common/mavlink.h>
+
+
+// ----------------------------------------------------------------------------------
+//   Message History Class
+// ----------------------------------------------------------------------------------
+/*
+ * Message History Class
+ *
+ * A ring buffer of one message id stored structure-of-arrays: every numeric
+ * field (every element, for array fields) is a column of its own, so the
+ * last 512 local_position_ned.x values sit next to each other in memory and
+ * can be fed straight to vectorized filters.  Columns keep their MAVLink
+ * type and are laid out from the message metadata, so any message can be
+ * recorded.
+ *
+ * Each column holds two copies of the ring back to back.  The newest n
+ * samples therefore always form one contiguous run, without a wrap.
+ *
+ * One thread appends (the receive path).  window() hands out pointers into
+ * the ring and is only safe on that thread, e.g. in a subscription callback.
+ * copy_window() may be called from any thread; it detects samples that were
+ * overwritten during the copy and retries.
+ */
+class Message_History
+{
+
+public:
+
+	// depth is rounded up to a power of two
+	Message_History(uint8_t msgid, unsigned depth);
+	~Message_History();
+
+	uint8_t  get_msgid() const { return msgid; }
+	unsigned get_depth() const { return depth; }
+
+	// Total samples appended so far
+	uint64_t
+	get_count() const
+	{
+		return count.load(std::memory_order_acquire);
+	}
+
+	// Column of a field, or -1 if the message has no such numeric field
+	int column(const char *field_name, unsigned index = 0) const;
+
+	mavlink_message_type_t
+	column_type(int column_) const
+	{
+		return columns[column_].type;
+	}
+
+	// Writer side
+	void append(const mavlink_message_t &message, uint64_t time_usec);
+
+	/*
+	 * Newest n samples of a column, oldest first.  Only valid on the
+	 * appending thread, V must match the column type.  Returns NULL if
+	 * fewer than n samples exist.
+	 */
+	template <typename V>
+	const V *
+	window(int column_, unsigned n) const
+	{
+		const Column &c = columns[column_];
+		if ( sizeof(V) != c.size || n > depth || n > get_count() )
+			return NULL;
+
+		return (const V*)(c.data + start_of(get_count(), n) * c.size);
+	}
+
+	// Host receive times of the newest n samples, same rules as window()
+	const uint64_t *
+	time_window(unsigned n) const
+	{
+		if ( n > depth || n > get_count() )
+			return NULL;
+
+		return times + start_of(get_count(), n);
+	}
+
+	/*
+	 * Copy the newest n samples of a column, converted to V, and optionally
+	 * their receive times.  Safe from any thread.  Returns the number of
+	 * samples copied, which is less than n if fewer were received.  At most
+	 * depth - 1 samples can be copied while the writer is running.
+	 */
+	template <typename V>
+	unsigned
+	copy_window(int column_, unsigned n, V *out, uint64_t *out_times = NULL) const
+	{
+		return copy_windows(&column_, 1, n, &out, out_times);
+	}
+
+	// As copy_window(), for several columns taken from the same samples.
+	// out[i] receives column columns_[i].
+	template <typename V>
+	unsigned
+	copy_windows(const int *columns_, unsigned num, unsigned n, V *const *out, uint64_t *out_times = NULL) const
+	{
+		for (;;)
+		{
+			uint64_t before = get_count();
+
+			unsigned available = (unsigned)( before < depth - 1 ? before : depth - 1 );
+			if ( n > available )
+				n = available;
+
+			unsigned start = start_of(before, n);
+			for (unsigned i = 0; i < num; i++)
+				copy_elements(columns[columns_[i]], start, n, out[i]);
+			if ( out_times )
+				memcpy(out_times, times + start, n * sizeof(uint64_t));
+
+			// valid unless the writer reached into the copied part of the ring
+			std::atomic_thread_fence(std::memory_order_acquire);
+			uint64_t after = count.load(std::memory_order_relaxed);
+			if ( after - before < depth - n )
+				return n;
+		}
+	}
+
+private:
+
+	struct Column
+	{
+		mavlink_message_type_t type;
+		unsigned               size;
+		unsigned               wire_offset;
+		const char            *name;
+		unsigned               index;
+		uint8_t               *data;     // 2 * depth elements
+	};
+
+	uint8_t  msgid;
+	unsigned depth;
+	unsigned mask;
+
+	Column  *columns;
+	unsigned num_columns;
+	uint64_t *times;                     // 2 * depth
+
+	std::atomic<uint64_t> count;
+
+	Message_History(const Message_History &);
+	Message_History &operator=(const Message_History &);
+
+	// Ring position of the oldest of the newest n samples
+	unsigned
+	start_of(uint64_t count_, unsigned n) const
+	{
+		return (unsigned)((count_ - n) & mask);
+	}
+
+	template <typename V>
+	static void
+	copy_elements(const Column &c, unsigned start, unsigned n, V *out)
+	{
+		const uint8_t *src = c.data + start * c.size;
+
+		// same type, straight copy
+		if ( sizeof(V) == c.size && same_kind<V>(c.type) )
+		{
+			memcpy(out, src, n * sizeof(V));
+			return;
+		}
+
+		for (unsigned i = 0; i < n; i++)
+			out[i] = (V) field_element_to_double(c.type, src + i * c.size);
+	}
+
+	template <typename V>
+	static bool
+	same_kind(mavlink_message_type_t type)
+	{
+		V probe = (V)0.5;
+		bool is_float = ( probe != 0 );
+		bool is_signed = ( (V)-1 < (V)0 );
+
+		switch (type)
+		{
+			case MAVLINK_TYPE_FLOAT:
+			case MAVLINK_TYPE_DOUBLE:
+				return is_float;
+			case MAVLINK_TYPE_INT8_T:
+			case MAVLINK_TYPE_INT16_T:
+			case MAVLINK_TYPE_INT32_T:
+			case MAVLINK_TYPE_INT64_T:
+				return not is_float and is_signed;
+			default:
+				return not is_float and not is_signed;
+		}
+	}
+
+};
+
+#endif // TELEMETRY_HISTORY_H_
+
@@ -0,0 +1,330 @@
+/**
+ * @file telemetry_store.cpp
+ *
+ * @brief Telemetry store functions
+ *
+ * Consistent copies of the latest telemetry received from the autopilot
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "telemetry_store.h"
+#include "realtime.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+
+// ----------------------------------------------------------------------------------
+//   Telemetry Store Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Telemetry_Store::
+Telemetry_Store()
+{
+	// all buffers start zeroed, i.e. never received
+	for (int i = 0; i < 256; i++)
+	{
+		received[i].store(0, std::memory_order_relaxed);
+		histories[i].store(NULL, std::memory_order_relaxed);
+		raw_messages[i].store(NULL, std::memory_order_relaxed);
+	}
+
+	// tracked messages are views of their payload slot
+#define TELEMETRY_ATTACH_BUFFER(name, ID)                                              \
+	raw_messages[MAVLINK_MSG_ID_##ID].store(new Seqlock<Raw_Message>(), std::memory_order_relaxed); \
+	name.attach(raw_messages[MAVLINK_MSG_ID_##ID].load(std::memory_order_relaxed));
+	TELEMETRY_TRACKED_MESSAGES(TELEMETRY_ATTACH_BUFFER)
+#undef TELEMETRY_ATTACH_BUFFER
+
+	waiters.store(0);
+
+	// Waiters time out on the monotonic clock, wall clock jumps don't matter
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+	int result = realtime_mutex_init(&wait_lock);
+	if ( result == 0 )
+		result = realtime_mutex_init(&history_lock);
+	if ( result == 0 )
+		result = pthread_cond_init(&wait_cond, &attr);
+
+	pthread_condattr_destroy(&attr);
+
+	if ( result != 0 )
+	{
+		printf("\n telemetry wait init failed\n");
+		throw 1;
+	}
+}
+
+Telemetry_Store::
+~Telemetry_Store()
+{
+	for (int i = 0; i < 256; i++)
+	{
+		delete histories[i].load();
+		delete raw_messages[i].load();
+	}
+
+	pthread_cond_destroy(&wait_cond);
+	pthread_mutex_destroy(&history_lock);
+	pthread_mutex_destroy(&wait_lock);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Snapshot
+// ------------------------------------------------------------------------------
+Mavlink_Messages
+Telemetry_Store::
+snapshot() const
+{
+	Mavlink_Messages messages;
+
+	Message_Source from = source.load();
+	messages.sysid  = from.sysid;
+	messages.compid = from.compid;
+
+	// one consistent copy per tracked message
+#define TELEMETRY_SNAPSHOT(name, ID)                              \
+	{                                                              \
+		Message_Slot<mavlink_##name##_t> slot = name.load();        \
+		messages.name             = slot.data;                     \
+		messages.time_stamps.name = slot.time_usec;                \
+	}
+	TELEMETRY_TRACKED_MESSAGES(TELEMETRY_SNAPSHOT)
+#undef TELEMETRY_SNAPSHOT
+
+	return messages;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Any Message
+// ------------------------------------------------------------------------------
+void
+Telemetry_Store::
+store_raw(const mavlink_message_t &message, uint64_t time_usec)
+{
+	Seqlock<Raw_Message> *raw = raw_messages[message.msgid].load(std::memory_order_relaxed);
+	if ( raw == NULL )
+	{
+		raw = new Seqlock<Raw_Message>();
+		raw_messages[message.msgid].store(raw, std::memory_order_release);
+	}
+
+	// only the bytes that arrived, the tail stays zero from construction
+	// or is cleared if an earlier message was longer
+	raw->update([&message, time_usec](Raw_Message &m) {
+		if ( message.len < m.len )
+			memset(m.payload + message.len, 0, m.len - message.len);
+		memcpy(m.payload, _MAV_PAYLOAD(&message), message.len);
+		m.len       = message.len;
+		m.time_usec = time_usec;
+	});
+}
+
+// The few fields of the hot state, decoded on arrival
+void
+Telemetry_Store::
+update_hot_state(const mavlink_message_t &message, uint64_t time_usec)
+{
+	switch (message.msgid)
+	{
+		case MAVLINK_MSG_ID_HEARTBEAT:
+		{
+			mavlink_heartbeat_t heartbeat;
+			mavlink_msg_heartbeat_decode(&message, &heartbeat);
+			hot.update([&heartbeat, time_usec](Hot_State &h) {
+				h.custom_mode    = heartbeat.custom_mode;
+				h.base_mode      = heartbeat.base_mode;
+				h.system_status  = heartbeat.system_status;
+				h.heartbeat_usec = time_usec;
+			});
+			break;
+		}
+
+		case MAVLINK_MSG_ID_EXTENDED_SYS_STATE:
+		{
+			mavlink_extended_sys_state_t state;
+			mavlink_msg_extended_sys_state_decode(&message, &state);
+			hot.update([&state](Hot_State &h) {
+				h.landed_state = state.landed_state;
+			});
+			break;
+		}
+
+		case MAVLINK_MSG_ID_LOCAL_POSITION_NED:
+		{
+			mavlink_local_position_ned_t position;
+			mavlink_msg_local_position_ned_decode(&message, &position);
+			hot.update([&position, time_usec](Hot_State &h) {
+				h.x  = position.x;  h.y  = position.y;  h.z  = position.z;
+				h.vx = position.vx; h.vy = position.vy; h.vz = position.vz;
+				h.position_usec = time_usec;
+			});
+			break;
+		}
+
+		case MAVLINK_MSG_ID_ATTITUDE:
+		{
+			mavlink_attitude_t attitude;
+			mavlink_msg_attitude_decode(&message, &attitude);
+			hot.update([&attitude, time_usec](Hot_State &h) {
+				h.roll      = attitude.roll;
+				h.pitch     = attitude.pitch;
+				h.yaw       = attitude.yaw;
+				h.rollspeed  = attitude.rollspeed;
+				h.pitchspeed = attitude.pitchspeed;
+				h.yawspeed   = attitude.yawspeed;
+				h.attitude_usec = time_usec;
+			});
+			break;
+		}
+
+		default:
+			break;
+	}
+}
+
+bool
+Telemetry_Store::
+get_message(uint8_t msgid, void *out, size_t size, uint64_t *time_usec) const
+{
+	const Seqlock<Raw_Message> *raw = raw_messages[msgid].load(std::memory_order_acquire);
+	if ( raw == NULL )
+		return false;
+
+	if ( size > MAVLINK_MAX_PAYLOAD_LEN )
+	{
+		memset((uint8_t*)out + MAVLINK_MAX_PAYLOAD_LEN, 0, size - MAVLINK_MAX_PAYLOAD_LEN);
+		size = MAVLINK_MAX_PAYLOAD_LEN;
+	}
+
+	uint64_t stamp = 0;
+	raw->read([out, size, &stamp](const Raw_Message &m) {
+		memcpy(out, m.payload, size);
+		stamp = m.time_usec;
+	});
+
+	if ( time_usec )
+		*time_usec = stamp;
+
+	return true;
+}
+
+double
+Telemetry_Store::
+get_field(uint8_t msgid, const char *field_name, unsigned index) const
+{
+	const mavlink_field_info_t *field = get_message_field(get_message_info(msgid), field_name);
+	if ( field == NULL || index >= ( field->array_length ? field->array_length : 1 ) )
+		return NAN;
+
+	Raw_Message m;
+	if ( not get_message(msgid, m.payload, sizeof(m.payload)) )
+		return NAN;
+
+	return get_field_value(field, m.payload, index);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Enable History
+// ------------------------------------------------------------------------------
+Message_History *
+Telemetry_Store::
+enable_history(uint8_t msgid, unsigned depth)
+{
+	pthread_mutex_lock(&history_lock);
+
+	Message_History *recorder = histories[msgid].load();
+	if ( recorder == NULL )
+	{
+		try {
+			recorder = new Message_History(msgid, depth);
+		}
+		catch (int error) {
+			pthread_mutex_unlock(&history_lock);
+			throw error;
+		}
+
+		// fully built before the read thread can see it
+		histories[msgid].store(recorder, std::memory_order_release);
+	}
+
+	pthread_mutex_unlock(&history_lock);
+
+	return recorder;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Notify Waiters
+// ------------------------------------------------------------------------------
+void
+Telemetry_Store::
+notify(uint8_t msgid)
+{
+	received[msgid].fetch_add(1, std::memory_order_release);
+
+	// Pairs with the increment in wait_until(): either the waiter sees the
+	// new message in its predicate, or we see the waiter and wake it.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	// Nobody waiting, nothing to lock
+	if ( waiters.load(std::memory_order_relaxed) == 0 )
+		return;
+
+	notify_all();
+}
+
+void
+Telemetry_Store::
+notify_all()
+{
+	pthread_mutex_lock(&wait_lock);
+	pthread_cond_broadcast(&wait_cond);
+	pthread_mutex_unlock(&wait_lock);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Wait For Message
+// ------------------------------------------------------------------------------
+bool
+Telemetry_Store::
+wait_for_message(uint8_t msgid, uint64_t timeout_usec)
+{
+	uint32_t seen = receive_count(msgid);
+
+	return wait_until([this, msgid, seen]() { return receive_count(msgid) != seen; },
+	                  timeout_usec);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Absolute Deadline
+// ------------------------------------------------------------------------------
+void
+Telemetry_Store::
+make_deadline(uint64_t timeout_usec, struct timespec &deadline)
+{
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	if ( timeout_usec == TELEMETRY_WAIT_FOREVER )
+		return;
+
+	uint64_t nsec = (uint64_t)deadline.tv_nsec + (timeout_usec % 1000000) * 1000;
+	deadline.tv_sec  += timeout_usec / 1000000 + nsec / 1000000000;
+	deadline.tv_nsec  = nsec % 1000000000;
+}
@@ -0,0 +1,463 @@
+/**
+ * @file telemetry_store.h
+ *
+ * @brief Latest telemetry received from the autopilot
+ *
+ * Written by the read thread, read by any thread without locking
+ */
+
+#ifndef TELEMETRY_STORE_H_
+#define TELEMETRY_STORE_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "seqlock.h"
+#include "telemetry_history.h"
+
+#include <pthread.h>
+#include <errno.h>
+
+#include <common/mavlink.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// timeout for Telemetry_Store::wait_until() that never expires
+#define TELEMETRY_WAIT_FOREVER UINT64_MAX
+
+
+// ------------------------------------------------------------------------------
+//   Tracked Messages
+// ------------------------------------------------------------------------------
+
+/*
+ * Every message the autopilot interface keeps a latest copy of, as
+ * X( name, MESSAGE_ID ) where mavlink_<name>_t is the message struct.
+ *
+ * The Time_Stamps and Mavlink_Messages members, the Telemetry_Store buffers
+ * and the typed accessors are all generated from this list, so tracking
+ * another message is a one line change here.
+ */
+#define TELEMETRY_TRACKED_MESSAGES(X) \
+	X( heartbeat,                  HEARTBEAT                  ) \
+	X( sys_status,                 SYS_STATUS                 ) \
+	X( battery_status,             BATTERY_STATUS             ) \
+	X( radio_status,               RADIO_STATUS               ) \
+	X( local_position_ned,         LOCAL_POSITION_NED         ) \
+	X( global_position_int,        GLOBAL_POSITION_INT        ) \
+	X( position_target_local_ned,  POSITION_TARGET_LOCAL_NED  ) \
+	X( position_target_global_int, POSITION_TARGET_GLOBAL_INT ) \
+	X( highres_imu,                HIGHRES_IMU                ) \
+	X( attitude,                   ATTITUDE                   ) \
+	X( vfr_hud,                    VFR_HUD                    )
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+struct Time_Stamps
+{
+	Time_Stamps()
+	{
+		reset_timestamps();
+	}
+
+#define TELEMETRY_TIME_STAMP(name, ID) uint64_t name;
+	TELEMETRY_TRACKED_MESSAGES(TELEMETRY_TIME_STAMP)
+#undef TELEMETRY_TIME_STAMP
+
+	void
+	reset_timestamps()
+	{
+#define TELEMETRY_RESET_TIME_STAMP(name, ID) name = 0;
+		TELEMETRY_TRACKED_MESSAGES(TELEMETRY_RESET_TIME_STAMP)
+#undef TELEMETRY_RESET_TIME_STAMP
+	}
+
+};
+
+
+/*
+ * What status checks and control loops read all the time, kept apart from
+ * the full messages so that reading it touches one or two cache lines
+ * instead of several hundred bytes.  Status comes first, so that it shares
+ * the first line with the lock.
+ */
+struct Hot_State
+{
+	// HEARTBEAT, EXTENDED_SYS_STATE
+	uint32_t custom_mode;
+	uint8_t  base_mode;
+	uint8_t  system_status;
+	uint8_t  landed_state;
+
+	// host receive times, 0 if never
+	uint64_t heartbeat_usec;
+	uint64_t position_usec;
+	uint64_t attitude_usec;
+
+	// LOCAL_POSITION_NED
+	float x, y, z;
+	float vx, vy, vz;
+
+	// ATTITUDE
+	float roll, pitch, yaw;
+	float rollspeed, pitchspeed, yawspeed;
+};
+
+
+// Struct containing information on the MAV we are currently connected to
+
+struct Mavlink_Messages {
+
+	int sysid;
+	int compid;
+
+	// One member per tracked message, e.g. mavlink_heartbeat_t heartbeat
+#define TELEMETRY_MESSAGE_MEMBER(name, ID) mavlink_##name##_t name;
+	TELEMETRY_TRACKED_MESSAGES(TELEMETRY_MESSAGE_MEMBER)
+#undef TELEMETRY_MESSAGE_MEMBER
+
+	// System Parameters?
+
+
+	// Time Stamps
+	Time_Stamps time_stamps;
+
+	void
+	reset_timestamps()
+	{
+		time_stamps.reset_timestamps();
+	}
+
+};
+
+
+// System and component id of a message sender
+struct Message_Source
+{
+	int sysid;
+	int compid;
+};
+
+
+// Payload of a message as received, for any message id.  Aligned so that
+// it can be read in place as the message struct.
+struct Raw_Message
+{
+	alignas(8) uint8_t payload[MAVLINK_MAX_PAYLOAD_LEN];
+	uint8_t  len;
+	uint64_t time_usec;
+};
+
+
+// One decoded message and the time it was received
+template <typename T>
+struct Message_Slot
+{
+	T        data;
+	uint64_t time_usec;
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Message Buffer Class
+// ----------------------------------------------------------------------------------
+/*
+ * Message Buffer Class
+ *
+ * Typed view of the latest payload of one tracked message.  The read thread
+ * only copies the payload bytes in; the struct is decoded when it is read,
+ * so a HIGHRES_IMU that is overwritten before anyone looks at it costs no
+ * decode.  Each read returns one complete message, never a mix of two.  Use
+ * field() to decode a single member without copying the whole message.
+ *
+ * Decoding is a copy, which is what MAVLink does itself on a little-endian
+ * host: the payload is the packed struct.
+ */
+template <typename T>
+class Message_Buffer
+{
+
+public:
+
+	Message_Buffer()
+		: raw(NULL)
+	{ }
+
+	// Connect to the payload slot of the message id, done by Telemetry_Store
+	void attach(const Seqlock<Raw_Message> *raw_) { raw = raw_; }
+
+	// Latest message and its receive time
+	Message_Slot<T>
+	load() const
+	{
+		Message_Slot<T> slot;
+		raw->read([&slot](const Raw_Message &m) {
+			memcpy(&slot.data, m.payload, sizeof(T));
+			slot.time_usec = m.time_usec;
+		});
+		return slot;
+	}
+
+	// Latest message
+	T
+	latest() const
+	{
+		T data;
+		raw->read([&data](const Raw_Message &m) { memcpy(&data, m.payload, sizeof(T)); });
+		return data;
+	}
+
+	// One member of the latest message
+	template <typename F>
+	F
+	field(F T::*member) const
+	{
+		F copy;
+		raw->read([&copy, member](const Raw_Message &m) {
+			const T *view = (const T *)m.payload;
+			memcpy(&copy, &(view->*member), sizeof(F));
+		});
+		return copy;
+	}
+
+	// Host time the latest message was received, 0 if never
+	uint64_t
+	time_usec() const
+	{
+		return raw->load_field(&Raw_Message::time_usec);
+	}
+
+	// Number of messages received
+	uint32_t
+	version() const
+	{
+		return raw->version();
+	}
+
+private:
+
+	static_assert(sizeof(T) <= MAVLINK_MAX_PAYLOAD_LEN, "message struct larger than a payload");
+
+	const Seqlock<Raw_Message> *raw;
+
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Telemetry Store Class
+// ----------------------------------------------------------------------------------
+/*
+ * Telemetry Store Class
+ *
+ * Latest payload of every message received, with typed, lazily decoding
+ * buffers for the messages the autopilot interface tracks.  Every message
+ * is protected on its own, so a reader gets a consistent LOCAL_POSITION_NED
+ * without stalling the read thread.  snapshot() assembles a Mavlink_Messages
+ * where each message is consistent in itself; different messages may come
+ * from slightly different times, as they always did.
+ *
+ * Threads that need to react to new telemetry block in wait_until() or
+ * wait_for_message() and are woken by the read thread through notify() as
+ * soon as a message is stored, instead of polling on a timer.
+ */
+class Telemetry_Store
+{
+
+public:
+
+	Telemetry_Store();
+	~Telemetry_Store();
+
+	Seqlock<Message_Source> source;
+
+	// Armed state, mode, position and attitude, see Hot_State
+	alignas(64) Seqlock<Hot_State> hot;
+
+	// One buffer per tracked message, e.g. Message_Buffer<mavlink_heartbeat_t> heartbeat
+#define TELEMETRY_BUFFER_MEMBER(name, ID) Message_Buffer<mavlink_##name##_t> name;
+	TELEMETRY_TRACKED_MESSAGES(TELEMETRY_BUFFER_MEMBER)
+#undef TELEMETRY_BUFFER_MEMBER
+
+	// Buffer by message struct type, e.g. buffer<mavlink_attitude_t>()
+	template <typename T>
+	Message_Buffer<T> &
+	buffer()
+	{
+		return buffer_of((T*)NULL);
+	}
+
+	template <typename T>
+	const Message_Buffer<T> &
+	buffer() const
+	{
+		return buffer_of((T*)NULL);
+	}
+
+	// Latest message by struct type, e.g. latest<mavlink_attitude_t>()
+	template <typename T>
+	T
+	latest() const
+	{
+		return buffer<T>().latest();
+	}
+
+	/*
+	 * Start recording the last depth samples of a message id, see
+	 * Message_History.  May be called while the read thread runs; recording
+	 * can not be turned off again.  Returns the (possibly existing) history.
+	 */
+	Message_History *enable_history(uint8_t msgid, unsigned depth);
+
+	// Recorded history of a message id, NULL if not enabled
+	const Message_History *
+	history(uint8_t msgid) const
+	{
+		return histories[msgid].load(std::memory_order_acquire);
+	}
+
+	/*
+	 * Latest message of any id, tracked or not, e.g. ALTITUDE or
+	 * EXTENDED_SYS_STATE.  Every received message is kept as its payload and
+	 * decoded when asked for: on a little-endian host the MAVLink payload is
+	 * the packed message struct, short (truncated) payloads are zero filled.
+	 * Returns false if the id was never received.
+	 */
+	bool get_message(uint8_t msgid, void *out, size_t size, uint64_t *time_usec = NULL) const;
+
+	template <typename T>
+	bool
+	get_message(uint8_t msgid, T &out, uint64_t *time_usec = NULL) const
+	{
+		return get_message(msgid, &out, sizeof(T), time_usec);
+	}
+
+	// One field of the latest message by name, from the message metadata.
+	// NaN if never received or the message has no such field.
+	double get_field(uint8_t msgid, const char *field_name, unsigned index = 0) const;
+
+	// Read thread side: keep the payload and record it if its history is
+	// enabled.  Nothing is decoded here.  Returns false for untracked
+	// messages.
+	bool
+	store(const mavlink_message_t &message, uint64_t time_usec)
+	{
+		store_raw(message, time_usec);
+		update_hot_state(message, time_usec);
+
+		Message_History *recorder = histories[message.msgid].load(std::memory_order_acquire);
+		if ( recorder )
+			recorder->append(message, time_usec);
+
+		return is_tracked(message.msgid);
+	}
+
+	Mavlink_Messages snapshot() const;
+
+	// Read thread side: a message with this id was just stored
+	void notify(uint8_t msgid);
+	void notify_all();
+
+	// Number of messages received with this id
+	uint32_t
+	receive_count(uint8_t msgid) const
+	{
+		return received[msgid].load(std::memory_order_acquire);
+	}
+
+	// Block until the next message with this id arrives, false on timeout
+	bool wait_for_message(uint8_t msgid, uint64_t timeout_usec);
+
+	/*
+	 * Block until predicate() is true, false on timeout.
+	 *
+	 * predicate() is re-evaluated each time the read thread stores a message
+	 * (or notify_all() is called), so it should only read telemetry and
+	 * flags, and it must not call wait_until() itself.
+	 */
+	template <typename Predicate>
+	bool
+	wait_until(Predicate predicate, uint64_t timeout_usec)
+	{
+		if ( predicate() )
+			return true;
+
+		struct timespec deadline;
+		make_deadline(timeout_usec, deadline);
+
+		waiters.fetch_add(1, std::memory_order_seq_cst);
+		pthread_mutex_lock(&wait_lock);
+
+		bool satisfied;
+		while ( not (satisfied = predicate()) )
+		{
+			int result;
+			if ( timeout_usec == TELEMETRY_WAIT_FOREVER )
+				result = pthread_cond_wait(&wait_cond, &wait_lock);
+			else
+				result = pthread_cond_timedwait(&wait_cond, &wait_lock, &deadline);
+
+			if ( result == ETIMEDOUT )
+			{
+				satisfied = predicate();
+				break;
+			}
+		}
+
+		pthread_mutex_unlock(&wait_lock);
+		waiters.fetch_sub(1, std::memory_order_seq_cst);
+
+		return satisfied;
+	}
+
+private:
+
+	static bool
+	is_tracked(uint8_t msgid)
+	{
+		switch (msgid)
+		{
+#define TELEMETRY_TRACKED_CASE(name, ID) case MAVLINK_MSG_ID_##ID:
+			TELEMETRY_TRACKED_MESSAGES(TELEMETRY_TRACKED_CASE)
+#undef TELEMETRY_TRACKED_CASE
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	// Overloads mapping each tracked struct type to its buffer
+#define TELEMETRY_BUFFER_OF(name, ID)                                                           \
+	Message_Buffer<mavlink_##name##_t> &buffer_of(mavlink_##name##_t*) { return name; }             \
+	const Message_Buffer<mavlink_##name##_t> &buffer_of(mavlink_##name##_t*) const { return name; }
+	TELEMETRY_TRACKED_MESSAGES(TELEMETRY_BUFFER_OF)
+#undef TELEMETRY_BUFFER_OF
+
+	std::atomic<uint32_t> received[256];
+
+	// allocated by the read thread on the first message of each id,
+	// up front for the tracked ids
+	std::atomic<Seqlock<Raw_Message>*> raw_messages[256];
+
+	void store_raw(const mavlink_message_t &message, uint64_t time_usec);
+	void update_hot_state(const mavlink_message_t &message, uint64_t time_usec);
+
+	std::atomic<Message_History*> histories[256];
+	pthread_mutex_t                history_lock;
+
+	std::atomic<int> waiters;
+	pthread_mutex_t  wait_lock;
+	pthread_cond_t   wait_cond;
+
+	static void make_deadline(uint64_t timeout_usec, struct timespec &deadline);
+
+};
+
+#endif // TELEMETRY_STORE_H_
+
@@ -0,0 +1,56 @@
+/**
+ * @file check.h
+ *
+ * @brief Checks shared by the test drivers
+ *
+ * A failed CHECK is reported and counted, the driver goes on with the
+ * next one and check_exit() turns the count into main()'s exit status
+ *
+ */
+
+#ifndef CHECK_H_
+#define CHECK_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cmath>
+#include <cstdio>
+
+
+// ------------------------------------------------------------------------------
+//   Checks
+// ------------------------------------------------------------------------------
+
+static int check_failures = 0;
+
+#define CHECK(condition)                                                    \
+	do {                                                                    \
+		if ( not (condition) )                                              \
+		{                                                                   \
+			fprintf(stderr,"FAILED: %s:%d: %s\n", __FILE__, __LINE__,       \
+			        #condition);                                            \
+			check_failures++;                                               \
+		}                                                                   \
+	} while (0)
+
+// a and b no further apart than tolerance
+#define CHECK_NEAR(a, b, tolerance)                                         \
+	CHECK(std::fabs((double)(a) - (double)(b)) <= (tolerance))
+
+// Exit status of a test driver, name as in "ALL <name> TESTS PASSED"
+static int
+check_exit(const char *name)
+{
+	if ( check_failures )
+	{
+		fprintf(stderr,"%d CHECKS FAILED\n", check_failures);
+		return 1;
+	}
+
+	printf("ALL %s TESTS PASSED\n", name);
+	return 0;
+}
+
+#endif // CHECK_H_
@@ -0,0 +1,369 @@
+/**
+ * @file command_engine_test.cpp
+ *
+ * @brief Command engine test driver
+ *
+ * Runs the engine on a timer wheel against a stub sender and fake
+ * COMMAND_ACKs, time is moved on by hand so every retransmit is decided
+ * by the test
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "check.h"
+#include "command_engine.h"
+#include "timer_wheel.h"
+#include "hr_clock.h"
+
+
+// ------------------------------------------------------------------------------
+//   Stub Link
+// ------------------------------------------------------------------------------
+
+#define TEST_COMMAND      400
+#define TEST_COMMAND_2    176
+#define TEST_FAIL_PARAM1  99.0f
+
+// Records every COMMAND_LONG, commands with param1 TEST_FAIL_PARAM1 fail
+struct Stub_Link
+{
+	std::vector<mavlink_command_long_t> sent;
+	bool fail_enabled;
+
+	Stub_Link() : fail_enabled(false) {}
+};
+
+static int
+stub_sender(const mavlink_command_long_t &command, void *context)
+{
+	Stub_Link *link = (Stub_Link *)context;
+	link->sent.push_back(command);
+
+	if ( link->fail_enabled and command.param1 == TEST_FAIL_PARAM1 )
+		return 0;
+
+	return sizeof(command);
+}
+
+static void
+stub_waker(void *context)
+{
+	*(bool *)context = true;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Test Loop
+// ------------------------------------------------------------------------------
+
+// One engine on one wheel, the clock only moves forward when told to
+struct Test_Loop
+{
+	Stub_Link      link;
+	Timer_Wheel    wheel;
+	Command_Engine engine;
+	bool           woken;
+	uint64_t       now_usec;
+
+	Test_Loop()
+	{
+		woken    = false;
+		now_usec = hr_clock_usec();
+
+		engine.set_sender(&stub_sender, &link);
+		engine.arm(&wheel, &stub_waker, &woken);
+	}
+
+	~Test_Loop()
+	{
+		engine.stop();
+		engine.disarm();
+	}
+
+	void
+	advance(uint64_t usec)
+	{
+		now_usec = std::max(now_usec, hr_clock_usec()) + usec;
+
+		if ( woken )
+		{
+			woken = false;
+			engine.reschedule();
+		}
+
+		wheel.advance(now_usec);
+	}
+
+	void
+	ack(uint8_t sysid, uint8_t compid, uint16_t command, uint8_t result,
+	    uint64_t delay_usec = 0)
+	{
+		mavlink_command_ack_t ack;
+		memset(&ack, 0, sizeof(ack));
+		ack.command = command;
+		ack.result  = result;
+
+		mavlink_message_t message;
+		mavlink_msg_command_ack_encode(sysid, compid, &message, &ack);
+
+		// on the clock the engine stamps its writes with
+		engine.handle_command_ack(message, hr_clock_usec() + delay_usec);
+	}
+};
+
+static mavlink_command_long_t
+make_command(uint16_t command, uint8_t target_component, float param1)
+{
+	mavlink_command_long_t cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.command          = command;
+	cmd.target_system    = 1;
+	cmd.target_component = target_component;
+	cmd.param1           = param1;
+	return cmd;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Tests
+// ------------------------------------------------------------------------------
+
+// The same command to one target goes out one at a time, in order
+static void
+test_queued_same_command()
+{
+	Test_Loop loop;
+	Command_Future a, b, c;
+
+	loop.engine.send(make_command(TEST_COMMAND, 1, 1), &a);
+	loop.engine.send(make_command(TEST_COMMAND, 1, 2), &b);
+	loop.engine.send(make_command(TEST_COMMAND, 1, 3), &c);
+
+	CHECK(loop.link.sent.size() == 1);
+	CHECK(loop.link.sent[0].param1 == 1);
+
+	loop.ack(1, 1, TEST_COMMAND, MAV_RESULT_ACCEPTED);
+
+	CHECK(a.done);
+	CHECK(a.result.result == MAV_RESULT_ACCEPTED);
+	CHECK(not b.done);
+	CHECK(not c.done);
+	CHECK(loop.link.sent.size() == 2);
+	CHECK(loop.link.sent.size() == 2 and loop.link.sent[1].param1 == 2);
+
+	loop.ack(1, 1, TEST_COMMAND, MAV_RESULT_DENIED);
+
+	CHECK(b.done);
+	CHECK(b.result.result == MAV_RESULT_DENIED);
+	CHECK(not c.done);
+	CHECK(loop.link.sent.size() == 3);
+	CHECK(loop.link.sent.size() == 3 and loop.link.sent[2].param1 == 3);
+
+	loop.ack(1, 1, TEST_COMMAND, MAV_RESULT_ACCEPTED);
+
+	CHECK(c.done);
+	CHECK(c.result.result == MAV_RESULT_ACCEPTED);
+	CHECK(loop.link.sent.size() == 3);
+}
+
+// A broadcast holds the same command to every component of its system
+static void
+test_broadcast_blocking()
+{
+	Test_Loop loop;
+	Command_Future all, one, two, other;
+
+	loop.engine.send(make_command(TEST_COMMAND,   0, 1), &all);
+	loop.engine.send(make_command(TEST_COMMAND,   1, 2), &one);
+	loop.engine.send(make_command(TEST_COMMAND,   2, 3), &two);
+	loop.engine.send(make_command(TEST_COMMAND_2, 1, 4), &other);
+
+	// another command is not held back
+	CHECK(loop.link.sent.size() == 2);
+	CHECK(loop.link.sent.size() == 2 and loop.link.sent[1].param1 == 4);
+
+	// any component answers the broadcast
+	loop.ack(1, 2, TEST_COMMAND, MAV_RESULT_ACCEPTED);
+
+	CHECK(all.done);
+	CHECK(all.result.result == MAV_RESULT_ACCEPTED);
+	CHECK(not one.done);
+	CHECK(not two.done);
+	CHECK(loop.link.sent.size() == 4);
+
+	loop.ack(1, 1, TEST_COMMAND, MAV_RESULT_ACCEPTED);
+
+	CHECK(one.done);
+	CHECK(not two.done);
+
+	loop.ack(1, 2, TEST_COMMAND, MAV_RESULT_ACCEPTED);
+	loop.ack(1, 1, TEST_COMMAND_2, MAV_RESULT_ACCEPTED);
+
+	CHECK(two.done);
+	CHECK(other.done);
+
+	// and the other way round
+	Command_Future first, broadcast;
+	size_t sent = loop.link.sent.size();
+
+	loop.engine.send(make_command(TEST_COMMAND, 1, 5), &first);
+	loop.engine.send(make_command(TEST_COMMAND, 0, 6), &broadcast);
+
+	CHECK(loop.link.sent.size() == sent + 1);
+
+	loop.ack(1, 1, TEST_COMMAND, MAV_RESULT_ACCEPTED);
+
+	CHECK(first.done);
+	CHECK(not broadcast.done);
+	CHECK(loop.link.sent.size() == sent + 2);
+	CHECK(loop.link.sent.back().param1 == 6);
+
+	loop.ack(1, 1, TEST_COMMAND, MAV_RESULT_ACCEPTED);
+
+	CHECK(broadcast.done);
+}
+
+// IN_PROGRESS stops the retransmits, then times out on its own deadline
+static void
+test_in_progress_timeout()
+{
+	Test_Loop loop;
+	loop.engine.in_progress_timeout_usec = 5000000;
+
+	Command_Future a;
+	loop.engine.send(make_command(TEST_COMMAND, 1, 1), &a);
+
+	loop.ack(1, 1, TEST_COMMAND, MAV_RESULT_IN_PROGRESS);
+
+	CHECK(not a.done);
+
+	// past any retransmit timeout
+	loop.advance(2 * loop.engine.max_timeout_usec);
+
+	CHECK(not a.done);
+	CHECK(loop.link.sent.size() == 1);
+
+	loop.advance(loop.engine.in_progress_timeout_usec);
+
+	CHECK(a.done);
+	CHECK(a.result.result == COMMAND_RESULT_TIMEOUT);
+	CHECK(a.result.attempts == 1);
+	CHECK(loop.link.sent.size() == 1);
+}
+
+// Without an answer the command is sent again, then given up on
+static void
+test_retransmit_timeout()
+{
+	Test_Loop loop;
+	loop.engine.max_retries = 2;
+
+	Command_Future a;
+	loop.engine.send(make_command(TEST_COMMAND, 1, 1), &a);
+
+	for (int i = 0; i < 4 and not a.done; i++)
+		loop.advance(2 * loop.engine.max_timeout_usec);
+
+	CHECK(a.done);
+	CHECK(a.result.result == COMMAND_RESULT_TIMEOUT);
+	CHECK(loop.link.sent.size() == 3);
+	CHECK(loop.link.sent.size() == 3 and loop.link.sent[0].confirmation == 0);
+	CHECK(loop.link.sent.size() == 3 and loop.link.sent[2].confirmation == 2);
+}
+
+// No round trip sample from a command that was sent more than once
+static void
+test_karn()
+{
+	Test_Loop loop;
+
+	Command_Future a;
+	loop.engine.send(make_command(TEST_COMMAND, 1, 1), &a);
+	loop.advance(2 * loop.engine.max_timeout_usec);
+
+	CHECK(loop.link.sent.size() == 2);
+
+	loop.ack(1, 1, TEST_COMMAND, MAV_RESULT_ACCEPTED);
+
+	CHECK(a.done);
+	CHECK(a.result.attempts == 2);
+	CHECK(loop.engine.get_srtt_usec(1, 1) == 0);
+
+	Command_Future b;
+	loop.engine.send(make_command(TEST_COMMAND_2, 1, 1), &b);
+	loop.ack(1, 1, TEST_COMMAND_2, MAV_RESULT_ACCEPTED, 20000);
+
+	CHECK(b.done);
+	CHECK(b.result.attempts == 1);
+	CHECK(loop.engine.get_srtt_usec(1, 1) >= 20000);
+	CHECK(loop.engine.get_srtt_usec(1, 1) < 2 * loop.engine.max_timeout_usec);
+}
+
+// A failed write completes its own slot and nothing else
+static void
+test_failed_send()
+{
+	Test_Loop loop;
+	loop.link.fail_enabled = true;
+
+	Command_Future a, b;
+	loop.engine.send(make_command(TEST_COMMAND,   1, 1),                &a);
+	loop.engine.send(make_command(TEST_COMMAND_2, 1, TEST_FAIL_PARAM1), &b);
+
+	CHECK(b.done);
+	CHECK(b.result.result == COMMAND_RESULT_SEND_FAILED);
+	CHECK(not a.done);
+
+	loop.ack(1, 1, TEST_COMMAND, MAV_RESULT_ACCEPTED);
+
+	CHECK(a.done);
+	CHECK(a.result.result == MAV_RESULT_ACCEPTED);
+
+	// a queued command that fails when its turn comes
+	Command_Future c, d, e;
+	loop.engine.send(make_command(TEST_COMMAND, 1, 2),                &c);
+	loop.engine.send(make_command(TEST_COMMAND, 1, TEST_FAIL_PARAM1), &d);
+	loop.engine.send(make_command(TEST_COMMAND, 1, 3),                &e);
+
+	size_t sent = loop.link.sent.size();
+
+	loop.ack(1, 1, TEST_COMMAND, MAV_RESULT_ACCEPTED);
+
+	CHECK(c.done);
+	CHECK(c.result.result == MAV_RESULT_ACCEPTED);
+	CHECK(d.done);
+	CHECK(d.result.result == COMMAND_RESULT_SEND_FAILED);
+	CHECK(not e.done);
+	CHECK(loop.link.sent.size() == sent + 2);
+	CHECK(loop.link.sent.back().param1 == 3);
+
+	loop.ack(1, 1, TEST_COMMAND, MAV_RESULT_ACCEPTED);
+
+	CHECK(e.done);
+	CHECK(e.result.result == MAV_RESULT_ACCEPTED);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Main
+// ------------------------------------------------------------------------------
+int
+main(int argc, char **argv)
+{
+	test_queued_same_command();
+	test_broadcast_blocking();
+	test_in_progress_timeout();
+	test_retransmit_timeout();
+	test_karn();
+	test_failed_send();
+
+	return check_exit("COMMAND ENGINE");
+}
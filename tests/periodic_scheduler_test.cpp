@@ -0,0 +1,148 @@
+/**
+ * @file periodic_scheduler_test.cpp
+ *
+ * @brief Periodic scheduler test driver
+ *
+ * Runs the scheduler on the real clock with work of known length, the
+ * margins allow for a loaded machine
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cmath>
+#include <time.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "periodic_scheduler.h"
+
+
+// ------------------------------------------------------------------------------
+//   Helpers
+// ------------------------------------------------------------------------------
+
+static uint64_t
+now_usec()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Tests
+// ------------------------------------------------------------------------------
+
+static void
+test_rate()
+{
+	Periodic_Scheduler scheduler;
+
+	CHECK(scheduler.get_period_nsec() == 100000000);
+
+	CHECK(scheduler.set_rate(20.0f));
+	CHECK(scheduler.get_period_nsec() == 50000000);
+
+	// outside the range, unchanged
+	CHECK(not scheduler.set_rate(0.5f));
+	CHECK(not scheduler.set_rate(300.0f));
+	CHECK(not scheduler.set_rate(NAN));
+	CHECK(scheduler.get_period_nsec() == 50000000);
+}
+
+// Work comes off the sleep, 20 cycles of 10 ms take 200 ms however long
+// each one worked
+static void
+test_no_drift()
+{
+	Periodic_Scheduler scheduler;
+	scheduler.set_rate(100.0f);
+
+	uint64_t begin = now_usec();
+	scheduler.start();
+
+	for (int i = 0; i < 20; i++)
+	{
+		usleep(1000 + 300 * (i % 10));
+		scheduler.wait();
+	}
+
+	uint64_t elapsed = now_usec() - begin;
+	CHECK(elapsed >= 200000);
+	CHECK(elapsed <  210000);
+
+	Scheduler_Stats stats = scheduler.get_stats();
+	CHECK(stats.cycles == 20);
+	CHECK(stats.skipped == 0);
+	CHECK_NEAR(stats.mean_period_nsec, 10000000.0, 500000.0);
+}
+
+// Late by less than a period: wait() returns at once, the next deadline
+// stays where it was
+static void
+test_overrun()
+{
+	Periodic_Scheduler scheduler;
+	scheduler.set_rate(20.0f);
+
+	uint64_t begin = now_usec();
+	scheduler.start();
+
+	usleep(60000);
+	CHECK(not scheduler.wait());
+	CHECK(now_usec() - begin < 100000);
+
+	CHECK(scheduler.wait());
+	uint64_t woken = now_usec() - begin;
+	CHECK(woken >= 100000 and woken < 115000);
+
+	Scheduler_Stats stats = scheduler.get_stats();
+	CHECK(stats.cycles == 2);
+	CHECK(stats.overruns == 1);
+	CHECK(stats.skipped == 0);
+}
+
+// Late by more than a period: the missed deadlines are skipped, not caught
+// up in a burst, and the loop keeps its phase
+static void
+test_skip_missed_periods()
+{
+	Periodic_Scheduler scheduler;
+	scheduler.set_rate(20.0f);
+
+	uint64_t begin = now_usec();
+	scheduler.start();
+
+	// deadlines at 50 and 100 ms pass
+	usleep(130000);
+	CHECK(not scheduler.wait());
+
+	// next at 150 ms, not 100
+	CHECK(scheduler.wait());
+	uint64_t woken = now_usec() - begin;
+	CHECK(woken >= 150000 and woken < 165000);
+
+	Scheduler_Stats stats = scheduler.get_stats();
+	CHECK(stats.cycles == 2);
+	CHECK(stats.overruns == 1);
+	CHECK(stats.skipped == 1);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Main
+// ------------------------------------------------------------------------------
+int
+main(int argc, char **argv)
+{
+	test_rate();
+	test_no_drift();
+	test_overrun();
+	test_skip_missed_periods();
+
+	return check_exit("PERIODIC SCHEDULER");
+}
@@ -0,0 +1,217 @@
+/**
+ * @file rate_monitor_test.cpp
+ *
+ * @brief Rate monitor test driver
+ *
+ * Feeds arrival times and sequence numbers by hand and checks the
+ * histogram buckets, gap statistics and link loss counted from them
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstring>
+
+#include "check.h"
+#include "rate_monitor.h"
+
+
+// ------------------------------------------------------------------------------
+//   Helpers
+// ------------------------------------------------------------------------------
+
+static mavlink_message_t
+message_from(int sysid, int compid, uint8_t seq, uint8_t msgid = MAVLINK_MSG_ID_HEARTBEAT)
+{
+	mavlink_message_t message;
+	memset(&message, 0, sizeof(message));
+	message.sysid  = sysid;
+	message.compid = compid;
+	message.seq    = seq;
+	message.msgid  = msgid;
+
+	return message;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Histogram Buckets
+// ------------------------------------------------------------------------------
+
+// Exact below 8 usec, then every bucket is at most 1/8 of its floor wide
+static void
+test_buckets()
+{
+	for (uint64_t gap = 0; gap < 8; gap++)
+	{
+		CHECK(Rate_Monitor::bucket_of(gap) == gap);
+		CHECK(Rate_Monitor::bucket_floor((unsigned)gap) == gap);
+	}
+
+	CHECK(Rate_Monitor::bucket_of(8)  == 8);
+	CHECK(Rate_Monitor::bucket_of(15) == 15);
+	CHECK(Rate_Monitor::bucket_of(16) == 16);
+	CHECK(Rate_Monitor::bucket_of(17) == 16);
+	CHECK(Rate_Monitor::bucket_of(18) == 17);
+
+	// every gap lies in its bucket, over the whole range
+	unsigned last = 0;
+	for (uint64_t gap = 1; gap < (1ull << 31); gap += gap / 7 + 1)
+	{
+		unsigned bucket = Rate_Monitor::bucket_of(gap);
+		uint64_t floor  = Rate_Monitor::bucket_floor(bucket);
+		uint64_t next   = Rate_Monitor::bucket_floor(bucket + 1);
+
+		CHECK(bucket >= last);
+		CHECK(floor <= gap and gap < next);
+		CHECK(gap < 8 or ( next - floor ) * 8 <= floor);
+		last = bucket;
+	}
+
+	// everything from 2^31 on shares the last bucket
+	CHECK(Rate_Monitor::bucket_of(1ull << 31) == RATE_MONITOR_BUCKETS - 1);
+	CHECK(Rate_Monitor::bucket_of(UINT64_MAX) == RATE_MONITOR_BUCKETS - 1);
+	CHECK(Rate_Monitor::bucket_of((1ull << 31) - 1) < RATE_MONITOR_BUCKETS - 1);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Gap Statistics
+// ------------------------------------------------------------------------------
+
+// A steady 100 Hz stream, no jitter
+static void
+test_steady_rate()
+{
+	Rate_Monitor monitor;
+	Rate_Stats stats;
+
+	CHECK(not monitor.get_stats(MAVLINK_MSG_ID_HEARTBEAT, stats));
+	CHECK(monitor.get_rate(MAVLINK_MSG_ID_HEARTBEAT) == 0.0f);
+
+	mavlink_message_t message = message_from(1, 1, 0);
+	for (int i = 0; i < 150; i++)
+		monitor.record(message, 5000000 + i * 10000ULL);
+
+	CHECK(monitor.get_stats(MAVLINK_MSG_ID_HEARTBEAT, stats));
+	CHECK(stats.count == 150);
+	CHECK(stats.first_usec == 5000000);
+	CHECK(stats.last_usec == 5000000 + 149 * 10000ULL);
+	CHECK(stats.min_gap_usec == 10000 and stats.max_gap_usec == 10000);
+	CHECK_NEAR(stats.mean_gap_usec, 10000.0, 1e-6);
+	CHECK_NEAR(Rate_Monitor::jitter_usec(stats), 0.0, 1e-6);
+
+	// the first window closed after one second, 100 messages
+	CHECK_NEAR(monitor.get_rate(MAVLINK_MSG_ID_HEARTBEAT), 100.0, 1e-3);
+
+	// clamped to the gaps seen, not the bucket's middle
+	CHECK(Rate_Monitor::gap_percentile(stats, 0.50) == 10000);
+	CHECK(Rate_Monitor::gap_percentile(stats, 0.99) == 10000);
+}
+
+// Gaps alternating 5 and 15 ms, 10 ms mean and 5 ms standard deviation
+static void
+test_jitter()
+{
+	Rate_Monitor monitor;
+
+	mavlink_message_t message = message_from(1, 1, 0);
+	uint64_t t = 1000000;
+	for (int i = 0; i < 2001; i++)
+	{
+		monitor.record(message, t);
+		t += ( i % 2 ) ? 15000 : 5000;
+	}
+
+	Rate_Stats stats;
+	CHECK(monitor.get_stats(MAVLINK_MSG_ID_HEARTBEAT, stats));
+	CHECK(stats.min_gap_usec == 5000 and stats.max_gap_usec == 15000);
+	CHECK_NEAR(stats.mean_gap_usec, 10000.0, 1e-3);
+	CHECK_NEAR(Rate_Monitor::jitter_usec(stats), 5000.0, 5.0);
+
+	// half the gaps are short, within a bucket's 12.5%
+	CHECK_NEAR(Rate_Monitor::gap_percentile(stats, 0.25), 5000.0, 5000 / 8.0);
+	CHECK_NEAR(Rate_Monitor::gap_percentile(stats, 0.99), 15000.0, 15000 / 8.0);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Link Loss
+// ------------------------------------------------------------------------------
+
+// Skipped sequence numbers are lost, also across the wrap at 256
+static void
+test_sequence_loss()
+{
+	Rate_Monitor monitor;
+
+	static const uint8_t seqs[] = { 250, 251, 252, 255, 0, 1, 5, 6 };
+	for (size_t i = 0; i < sizeof(seqs); i++)
+	{
+		mavlink_message_t message = message_from(1, 1, seqs[i]);
+		monitor.record_sequence(message);
+	}
+
+	// a second sender of its own
+	mavlink_message_t other = message_from(2, 1, 7);
+	monitor.record_sequence(other);
+
+	CHECK(monitor.get_num_senders() == 2);
+
+	Sequence_Stats s = monitor.get_sequence_stats(0);
+	CHECK(s.sysid == 1 and s.compid == 1);
+	CHECK(s.received == 8);
+	CHECK(s.lost == 5);
+	CHECK(s.max_burst == 3);
+
+	s = monitor.get_sequence_stats(1);
+	CHECK(s.sysid == 2 and s.received == 1 and s.lost == 0);
+}
+
+// Duplicates and overtaken frames are not loss; a run of frames far behind
+// follows an outage, the sequence restarts from there
+static void
+test_sequence_resync()
+{
+	Rate_Monitor monitor;
+
+	static const uint8_t seqs[] = {
+		10, 11, 11, 9, 12,          // duplicate, late frame
+		140, 141, 142, 143, 144,    // 128 ahead, i.e. behind
+	};
+	for (size_t i = 0; i < sizeof(seqs); i++)
+	{
+		mavlink_message_t message = message_from(1, 1, seqs[i]);
+		monitor.record_sequence(message);
+	}
+
+	Sequence_Stats s = monitor.get_sequence_stats(0);
+	CHECK(s.received == 10);
+	CHECK(s.lost == 0);
+
+	// resynced at 143, counting goes on from there
+	mavlink_message_t message = message_from(1, 1, 147);
+	monitor.record_sequence(message);
+
+	s = monitor.get_sequence_stats(0);
+	CHECK(s.lost == 2);
+	CHECK(s.max_burst == 2);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Main
+// ------------------------------------------------------------------------------
+int
+main(int argc, char **argv)
+{
+	test_buckets();
+	test_steady_rate();
+	test_jitter();
+	test_sequence_loss();
+	test_sequence_resync();
+
+	return check_exit("RATE MONITOR");
+}
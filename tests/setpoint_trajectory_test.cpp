@@ -0,0 +1,261 @@
+/**
+ * @file setpoint_trajectory_test.cpp
+ *
+ * @brief Setpoint trajectory test driver
+ *
+ * Pushes horizons as a planner would and checks what the write thread
+ * samples from them
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cmath>
+#include <cstring>
+
+#include "check.h"
+#include "setpoint_trajectory.h"
+
+
+// ------------------------------------------------------------------------------
+//   Points
+// ------------------------------------------------------------------------------
+
+// type_masks, the fields not listed are ignored
+#define POSITION              0x0DF8
+#define POSITION_VELOCITY     0x0DC0
+#define POSITION_YAW          0x09F8
+
+static Trajectory_Point
+point_at(uint64_t time_usec, uint16_t type_mask, float x, float vx = 0.0f, float yaw = 0.0f)
+{
+	Trajectory_Point point;
+	memset(&point, 0, sizeof(point));
+	point.time_usec          = time_usec;
+	point.setpoint.type_mask = type_mask;
+	point.setpoint.x         = x;
+	point.setpoint.vx        = vx;
+	point.setpoint.yaw       = yaw;
+
+	return point;
+}
+
+static float
+x_at(const Setpoint_Trajectory &trajectory, uint64_t time_usec)
+{
+	mavlink_set_position_target_local_ned_t setpoint;
+	CHECK(trajectory.sample(time_usec, setpoint));
+
+	return setpoint.x;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Queue
+// ------------------------------------------------------------------------------
+
+// New points replace the queued ones from their time on, older ones stay
+// until the present has passed them
+static void
+test_horizon_replacement()
+{
+	Setpoint_Trajectory trajectory;
+
+	Trajectory_Point first[3] = {
+		point_at(100000, POSITION, 1.0f),
+		point_at(200000, POSITION, 2.0f),
+		point_at(300000, POSITION, 3.0f),
+	};
+	CHECK(trajectory.push(first, 3, 0));
+	CHECK(trajectory.get_end_usec() == 300000);
+
+	// 300 ms is replaced, 100 ms still brackets now
+	Trajectory_Point second[2] = {
+		point_at(250000, POSITION, 10.0f),
+		point_at(350000, POSITION, 20.0f),
+	};
+	CHECK(trajectory.push(second, 2, 150000));
+	CHECK(trajectory.get_end_usec() == 350000);
+
+	CHECK_NEAR(x_at(trajectory, 150000), 1.5f, 1e-5);
+	CHECK_NEAR(x_at(trajectory, 225000), 6.0f, 1e-5);
+	CHECK_NEAR(x_at(trajectory, 300000), 15.0f, 1e-5);
+
+	// once the present is past 200 ms, 100 ms is dropped
+	Trajectory_Point third[1] = { point_at(400000, POSITION, 30.0f) };
+	CHECK(trajectory.push(third, 1, 260000));
+
+	mavlink_set_position_target_local_ned_t setpoint;
+	CHECK(not trajectory.sample(200000, setpoint));
+	CHECK_NEAR(x_at(trajectory, 375000), 25.0f, 1e-5);
+}
+
+// Out of order and past the capacity are dropped, the rest is queued
+static void
+test_dropped_points()
+{
+	Setpoint_Trajectory trajectory;
+
+	Trajectory_Point unordered[3] = {
+		point_at(100000, POSITION, 1.0f),
+		point_at( 50000, POSITION, 9.0f),
+		point_at(200000, POSITION, 2.0f),
+	};
+	CHECK(not trajectory.push(unordered, 3, 0));
+	CHECK_NEAR(x_at(trajectory, 150000), 1.5f, 1e-5);
+
+	trajectory.clear();
+
+	Trajectory_Point many[SETPOINT_TRAJECTORY_MAX_POINTS + 6];
+	for (unsigned i = 0; i < SETPOINT_TRAJECTORY_MAX_POINTS + 6; i++)
+		many[i] = point_at(1000000 + i * 10000ULL, POSITION, (float)i);
+
+	CHECK(not trajectory.push(many, SETPOINT_TRAJECTORY_MAX_POINTS + 6, 0));
+	CHECK(trajectory.get_end_usec() == 1000000 + ( SETPOINT_TRAJECTORY_MAX_POINTS - 1 ) * 10000ULL);
+}
+
+// No points leave the queue as it was
+static void
+test_zero_points()
+{
+	Setpoint_Trajectory trajectory;
+
+	Trajectory_Point points[2] = {
+		point_at(100000, POSITION, 1.0f),
+		point_at(200000, POSITION, 2.0f),
+	};
+	CHECK(trajectory.push(points, 2, 0));
+
+	CHECK(trajectory.push(points, 0, 150000));
+	CHECK(trajectory.get_end_usec() == 200000);
+	CHECK_NEAR(x_at(trajectory, 150000), 1.5f, 1e-5);
+
+	trajectory.clear();
+	CHECK(trajectory.get_end_usec() == 0);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Sample
+// ------------------------------------------------------------------------------
+
+// Nothing before the first point, the last one held after it, stepped
+// between points of different kinds
+static void
+test_ends_and_steps()
+{
+	Setpoint_Trajectory trajectory;
+	mavlink_set_position_target_local_ned_t setpoint;
+
+	CHECK(not trajectory.sample(0, setpoint));
+
+	Trajectory_Point points[3] = {
+		point_at(100000, POSITION,          1.0f),
+		point_at(200000, POSITION_VELOCITY, 2.0f),
+		point_at(300000, POSITION_VELOCITY, 4.0f),
+	};
+	points[0].setpoint.time_boot_ms = 1234;
+	CHECK(trajectory.push(points, 3, 0));
+
+	CHECK(not trajectory.sample(99999, setpoint));
+
+	CHECK(trajectory.sample(150000, setpoint));
+	CHECK(setpoint.x == 1.0f);
+	CHECK(setpoint.type_mask == POSITION);
+	CHECK(setpoint.time_boot_ms == 0);
+
+	CHECK(trajectory.sample(1000000, setpoint));
+	CHECK(setpoint.x == 4.0f);
+	CHECK(setpoint.type_mask == POSITION_VELOCITY);
+}
+
+// Position alone is interpolated linearly
+static void
+test_linear()
+{
+	Setpoint_Trajectory trajectory;
+
+	Trajectory_Point points[2] = {
+		point_at(1000000, POSITION, -2.0f),
+		point_at(2000000, POSITION,  6.0f),
+	};
+	CHECK(trajectory.push(points, 2, 0));
+
+	CHECK_NEAR(x_at(trajectory, 1000000), -2.0f, 1e-5);
+	CHECK_NEAR(x_at(trajectory, 1250000),  0.0f, 1e-5);
+	CHECK_NEAR(x_at(trajectory, 1500000),  2.0f, 1e-5);
+}
+
+// With velocity at both ends position follows the cubic Hermite curve,
+// velocity its slope: from rest to rest over 1 s and 1 m, halfway at 1.5 m/s
+static void
+test_hermite()
+{
+	Setpoint_Trajectory trajectory;
+
+	Trajectory_Point points[2] = {
+		point_at(1000000, POSITION_VELOCITY, 0.0f, 0.0f),
+		point_at(2000000, POSITION_VELOCITY, 1.0f, 0.0f),
+	};
+	CHECK(trajectory.push(points, 2, 0));
+
+	mavlink_set_position_target_local_ned_t setpoint;
+
+	CHECK(trajectory.sample(1500000, setpoint));
+	CHECK_NEAR(setpoint.x,  0.5f, 1e-5);
+	CHECK_NEAR(setpoint.vx, 1.5f, 1e-4);
+
+	// slow off the first point, x = 3s^2 - 2s^3
+	CHECK(trajectory.sample(1250000, setpoint));
+	CHECK_NEAR(setpoint.x,  0.15625f, 1e-5);
+	CHECK_NEAR(setpoint.vx, 1.125f,   1e-4);
+
+	CHECK(trajectory.sample(2000000, setpoint));
+	CHECK_NEAR(setpoint.x,  1.0f, 1e-5);
+	CHECK_NEAR(setpoint.vx, 0.0f, 1e-5);
+}
+
+// Yaw turns the shorter way round, across +-pi
+static void
+test_yaw_wrap()
+{
+	Setpoint_Trajectory trajectory;
+
+	Trajectory_Point points[2] = {
+		point_at(1000000, POSITION_YAW, 0.0f, 0.0f,  3.0f),
+		point_at(2000000, POSITION_YAW, 0.0f, 0.0f, -3.0f),
+	};
+	CHECK(trajectory.push(points, 2, 0));
+
+	mavlink_set_position_target_local_ned_t setpoint;
+	float step = 2.0f * (float)M_PI - 6.0f;
+
+	CHECK(trajectory.sample(1250000, setpoint));
+	CHECK_NEAR(setpoint.yaw, 3.0f + 0.25f * step, 1e-5);
+
+	CHECK(trajectory.sample(1500000, setpoint));
+	CHECK_NEAR(std::fabs(setpoint.yaw), M_PI, 1e-5);
+
+	CHECK(trajectory.sample(1750000, setpoint));
+	CHECK_NEAR(setpoint.yaw, -3.0f - 0.25f * step, 1e-5);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Main
+// ------------------------------------------------------------------------------
+int
+main(int argc, char **argv)
+{
+	test_horizon_replacement();
+	test_dropped_points();
+	test_zero_points();
+	test_ends_and_steps();
+	test_linear();
+	test_hermite();
+	test_yaw_wrap();
+
+	return check_exit("SETPOINT TRAJECTORY");
+}
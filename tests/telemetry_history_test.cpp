@@ -0,0 +1,200 @@
+/**
+ * @file telemetry_history_test.cpp
+ *
+ * @brief Message history test driver
+ *
+ * Records LOCAL_POSITION_NED with x counting up, so every sample tells
+ * where in the stream it came from, and checks the windows handed out,
+ * also while another thread keeps overwriting the ring
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <pthread.h>
+#include <cstring>
+
+#include "check.h"
+#include "telemetry_history.h"
+
+
+// ------------------------------------------------------------------------------
+//   Samples
+// ------------------------------------------------------------------------------
+
+// Sample i has x = i, time_boot_ms = 10 * i and was received at 1000 * i us
+static void
+append_sample(Message_History &history, unsigned i)
+{
+	mavlink_local_position_ned_t position;
+	memset(&position, 0, sizeof(position));
+	position.time_boot_ms = 10 * i;
+	position.x            = (float)i;
+
+	mavlink_message_t message;
+	mavlink_msg_local_position_ned_encode(1, 1, &message, &position);
+
+	history.append(message, 1000 * (uint64_t)i);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Tests
+// ------------------------------------------------------------------------------
+
+// Depth is a power of two, columns are found by field name
+static void
+test_layout()
+{
+	Message_History history(MAVLINK_MSG_ID_LOCAL_POSITION_NED, 5);
+
+	CHECK(history.get_depth() == 8);
+	CHECK(history.get_count() == 0);
+
+	int x = history.column("x");
+	CHECK(x >= 0);
+	CHECK(history.column_type(x) == MAVLINK_TYPE_FLOAT);
+	CHECK(history.column("time_boot_ms") >= 0);
+	CHECK(history.column("no_such_field") == -1);
+	CHECK(history.column("x", 1) == -1);
+}
+
+// The newest n samples are one contiguous run, also across the wrap
+static void
+test_window_wraps()
+{
+	Message_History history(MAVLINK_MSG_ID_LOCAL_POSITION_NED, 8);
+	int x = history.column("x");
+
+	for (unsigned i = 0; i < 3; i++)
+		append_sample(history, i);
+
+	// fewer samples than asked for
+	CHECK(history.window<float>(x, 4) == NULL);
+	CHECK(history.window<float>(x, 3) != NULL);
+
+	for (unsigned i = 3; i < 21; i++)
+		append_sample(history, i);
+
+	const float *values = history.window<float>(x, 8);
+	const uint64_t *times = history.time_window(8);
+	CHECK(values != NULL and times != NULL);
+	if ( values and times )
+		for (unsigned i = 0; i < 8; i++)
+		{
+			CHECK(values[i] == (float)(13 + i));
+			CHECK(times[i] == 1000 * (uint64_t)(13 + i));
+		}
+
+	// more than the ring holds, or the wrong element size
+	CHECK(history.window<float>(x, 9) == NULL);
+	CHECK(history.window<double>(x, 2) == NULL);
+}
+
+// Copies convert the column type and stop short of the writer
+static void
+test_copy_window()
+{
+	Message_History history(MAVLINK_MSG_ID_LOCAL_POSITION_NED, 8);
+	int time_boot_ms = history.column("time_boot_ms");
+
+	double   values[8];
+	uint64_t times[8];
+
+	append_sample(history, 0);
+	append_sample(history, 1);
+	CHECK(history.copy_window(time_boot_ms, 8, values, times) == 2);
+	CHECK(values[0] == 0.0 and values[1] == 10.0);
+	CHECK(times[1] == 1000);
+
+	// depth - 1 at most, the writer may be filling the slot after them
+	for (unsigned i = 2; i < 30; i++)
+		append_sample(history, i);
+	CHECK(history.copy_window(time_boot_ms, 8, values, times) == 7);
+	for (unsigned i = 0; i < 7; i++)
+		CHECK(values[i] == 10.0 * (23 + i));
+}
+
+
+// ------------------------------------------------------------------------------
+//   Concurrent Writer
+// ------------------------------------------------------------------------------
+
+#define WRITER_SAMPLES 2000000
+
+struct Writer
+{
+	Message_History   *history;
+	std::atomic<bool>  done;
+};
+
+static void *
+run_writer(void *args)
+{
+	Writer *writer = (Writer *)args;
+
+	for (unsigned i = 0; i < WRITER_SAMPLES; i++)
+		append_sample(*writer->history, i);
+
+	writer->done = true;
+	return NULL;
+}
+
+// A copy the writer ran into is thrown away and taken again, so whatever
+// comes back is consecutive samples, the columns and receive times of
+// each from the same message
+static void
+test_copy_windows_overwritten()
+{
+	// a small ring, so the writer often laps a copy in progress
+	Message_History history(MAVLINK_MSG_ID_LOCAL_POSITION_NED, 4);
+	int columns[2] = { history.column("x"), history.column("time_boot_ms") };
+
+	Writer writer;
+	writer.history = &history;
+	writer.done    = false;
+
+	pthread_t tid;
+	CHECK(pthread_create(&tid, NULL, &run_writer, &writer) == 0);
+
+	unsigned copies = 0, torn = 0;
+	while ( not writer.done )
+	{
+		double   x[3], time_boot_ms[3];
+		double  *out[2] = { x, time_boot_ms };
+		uint64_t times[3];
+
+		unsigned n = history.copy_windows(columns, 2, 3, out, times);
+		for (unsigned i = 0; i < n; i++)
+		{
+			bool consecutive = ( i == 0 or x[i] == x[i-1] + 1 );
+			if ( not consecutive or time_boot_ms[i] != 10 * x[i] or
+			     times[i] != 1000 * (uint64_t)x[i] )
+				torn++;
+		}
+		copies++;
+	}
+
+	pthread_join(tid, NULL);
+
+	CHECK(torn == 0);
+	CHECK(copies > 0);
+	CHECK(history.get_count() == WRITER_SAMPLES);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Main
+// ------------------------------------------------------------------------------
+int
+main(int argc, char **argv)
+{
+	test_layout();
+	test_window_wraps();
+	test_copy_window();
+	test_copy_windows_overwritten();
+
+	return check_exit("MESSAGE HISTORY");
+}
@@ -0,0 +1,175 @@
+/**
+ * @file time_sync_test.cpp
+ *
+ * @brief Time sync test driver
+ *
+ * Plays TIMESYNC round trips against a simulated vehicle clock with a known
+ * offset and skew, and checks the estimate recovers them
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "check.h"
+#include "time_sync.h"
+
+
+// ------------------------------------------------------------------------------
+//   Simulated Vehicle
+// ------------------------------------------------------------------------------
+
+// vehicle_usec = VEHICLE_AT_START + rate * (host_usec - HOST_START)
+#define HOST_START       100000000ULL   // 100 s
+#define VEHICLE_AT_START  40000000.0    //  40 s since boot
+
+struct Vehicle_Clock
+{
+	double rate;
+
+	double
+	at(uint64_t host_usec) const
+	{
+		return VEHICLE_AT_START + rate * (double)(host_usec - HOST_START);
+	}
+};
+
+// One request sent at send_usec, up and down are the link delays each way.
+// Returns the host time the reply came back.
+static uint64_t
+round_trip(Time_Sync &sync, const Vehicle_Clock &vehicle, uint64_t send_usec,
+           uint64_t up_usec, uint64_t down_usec)
+{
+	mavlink_timesync_t request;
+	sync.make_request(send_usec, request);
+
+	mavlink_timesync_t answer;
+	answer.tc1 = (int64_t)(vehicle.at(send_usec + up_usec) * 1000);
+	answer.ts1 = request.ts1;
+
+	uint64_t receive_usec = send_usec + up_usec + down_usec;
+
+	mavlink_timesync_t reply;
+	CHECK(not sync.handle_timesync(answer, receive_usec, reply));
+
+	return receive_usec;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Tests
+// ------------------------------------------------------------------------------
+
+// Fewer than four round trips give the offset only
+static void
+test_offset()
+{
+	Time_Sync sync;
+	Vehicle_Clock vehicle = { 1.0 };
+
+	CHECK(not sync.is_valid());
+	CHECK(sync.host_to_vehicle_usec(HOST_START) == 0);
+
+	round_trip(sync, vehicle, HOST_START, 5000, 5000);
+	uint64_t now = round_trip(sync, vehicle, HOST_START + 1000000, 5000, 5000);
+
+	Time_Sync_Estimate e = sync.get_estimate();
+	CHECK(sync.is_valid());
+	CHECK(e.samples == 2);
+	CHECK(e.rate == 1.0);
+	CHECK(e.rtt_usec == 10000);
+
+	CHECK_NEAR(sync.host_to_vehicle_usec(now), vehicle.at(now), 1.0);
+	CHECK_NEAR(sync.vehicle_to_host_usec((uint64_t)vehicle.at(now)), now, 1.0);
+}
+
+// The least-squares line recovers the skew, 100 ppm here
+static void
+test_skew()
+{
+	Time_Sync sync;
+	Vehicle_Clock vehicle = { 1.0001 };
+
+	uint64_t now = HOST_START;
+	for (int i = 0; i < 20; i++)
+		now = round_trip(sync, vehicle, HOST_START + i * 1000000ULL, 4000, 4000);
+
+	Time_Sync_Estimate e = sync.get_estimate();
+	CHECK(e.samples == 20);
+	CHECK_NEAR(e.rate, 1.0001, 1e-8);
+
+	// ten seconds ahead, the skew alone would be 1 ms off
+	uint64_t later = now + 10000000;
+	CHECK_NEAR(sync.host_to_vehicle_usec(later), vehicle.at(later), 2.0);
+	CHECK_NEAR(sync.vehicle_to_host_usec((uint64_t)vehicle.at(later)), later, 2.0);
+}
+
+// Slow round trips are lopsided, all their delay on the way back here, and
+// would pull the offset by half of it.  They are left out.
+static void
+test_rtt_outliers()
+{
+	Time_Sync sync;
+	Vehicle_Clock vehicle = { 1.0 };
+
+	uint64_t now = HOST_START;
+	for (int i = 0; i < 24; i++)
+	{
+		uint64_t send_usec = HOST_START + i * 500000ULL;
+		if ( i % 3 == 2 )
+			now = round_trip(sync, vehicle, send_usec, 5000, 195000);
+		else
+			now = round_trip(sync, vehicle, send_usec, 5000, 5000);
+	}
+
+	Time_Sync_Estimate e = sync.get_estimate();
+	CHECK(e.samples == 16);
+	CHECK(e.rtt_usec == 10000);
+	CHECK_NEAR(sync.host_to_vehicle_usec(now), vehicle.at(now), 2.0);
+}
+
+// Only answers to our own outstanding requests count, each once
+static void
+test_foreign_replies()
+{
+	Time_Sync sync;
+	Vehicle_Clock vehicle = { 1.0 };
+	mavlink_timesync_t reply;
+
+	// the vehicle asks for our time
+	mavlink_timesync_t request = { 0, 123456789 };
+	CHECK(sync.handle_timesync(request, HOST_START, reply));
+	CHECK(reply.tc1 == (int64_t)HOST_START * 1000);
+	CHECK(reply.ts1 == 123456789);
+
+	// the vehicle answering somebody else
+	mavlink_timesync_t answer;
+	answer.tc1 = (int64_t)(vehicle.at(HOST_START) * 1000);
+	answer.ts1 = (int64_t)(HOST_START - 3000) * 1000;
+	CHECK(not sync.handle_timesync(answer, HOST_START + 1000, reply));
+	CHECK(not sync.is_valid());
+
+	// ours, then the same answer again
+	sync.make_request(HOST_START, request);
+	answer.ts1 = request.ts1;
+	sync.handle_timesync(answer, HOST_START + 10000, reply);
+	sync.handle_timesync(answer, HOST_START + 10000, reply);
+	CHECK(sync.is_valid());
+	CHECK(sync.get_estimate().samples == 1);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Main
+// ------------------------------------------------------------------------------
+int
+main(int argc, char **argv)
+{
+	test_offset();
+	test_skew();
+	test_rtt_outliers();
+	test_foreign_replies();
+
+	return check_exit("TIME SYNC");
+}
@@ -0,0 +1,158 @@
+/**
+ * @file vehicle_table_test.cpp
+ *
+ * @brief Vehicle table test driver
+ *
+ * Fills the table to its limit, so probe sequences collide, and moves an
+ * adopted sender between the caller's store and the table's
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstring>
+
+#include "check.h"
+#include "vehicle_table.h"
+
+
+// ------------------------------------------------------------------------------
+//   Helpers
+// ------------------------------------------------------------------------------
+
+static mavlink_message_t
+heartbeat_from(int sysid, int compid)
+{
+	mavlink_heartbeat_t heartbeat;
+	memset(&heartbeat, 0, sizeof(heartbeat));
+
+	mavlink_message_t message;
+	mavlink_msg_heartbeat_encode(sysid, compid, &message, &heartbeat);
+
+	return message;
+}
+
+static bool
+has_source(const Telemetry_Store *store, int sysid, int compid)
+{
+	Message_Source source = store->source.load();
+	return source.sysid == sysid and source.compid == compid;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Tests
+// ------------------------------------------------------------------------------
+
+// Every sender up to the limit gets a store of its own and is found again,
+// whatever slot its probe ended in
+static void
+test_fill()
+{
+	Vehicle_Table table;
+
+	CHECK(table.find(0, 0) == NULL);
+	CHECK(table.find_or_add(0, 0) != NULL);
+	CHECK(table.find(0, 0) != NULL);
+
+	Telemetry_Store *stores[VEHICLE_TABLE_MAX_ENTRIES];
+	stores[0] = table.find(0, 0);
+
+	for (int i = 1; i < VEHICLE_TABLE_MAX_ENTRIES; i++)
+	{
+		stores[i] = table.find_or_add(i % 7 + 1, i);
+		CHECK(stores[i] != NULL);
+	}
+
+	CHECK(table.size() == VEHICLE_TABLE_MAX_ENTRIES);
+
+	for (int i = 1; i < VEHICLE_TABLE_MAX_ENTRIES; i++)
+	{
+		CHECK(table.find(i % 7 + 1, i) == stores[i]);
+		CHECK(has_source(stores[i], i % 7 + 1, i));
+		CHECK(stores[i] != stores[i-1]);
+
+		// in the order they were heard
+		Message_Source source = table.get_source(i);
+		CHECK(source.sysid == i % 7 + 1 and source.compid == i);
+	}
+
+	// full, newcomers are not recorded, the others still are
+	CHECK(table.find_or_add(200, 1) == NULL);
+	CHECK(table.find(200, 1) == NULL);
+	CHECK(table.find_or_add(2, 1) == stores[1]);
+	CHECK(table.size() == VEHICLE_TABLE_MAX_ENTRIES);
+}
+
+// store() decodes into the sender's store and returns it
+static void
+test_store()
+{
+	Vehicle_Table table;
+
+	mavlink_message_t message = heartbeat_from(1, 1);
+	Telemetry_Store *vehicle = table.store(message, 1000);
+
+	CHECK(vehicle != NULL);
+	CHECK(vehicle == table.find(1, 1));
+	CHECK(vehicle->receive_count(MAVLINK_MSG_ID_HEARTBEAT) == 1);
+	CHECK(table.find(1, 2) == NULL);
+}
+
+// The adopted sender is kept in the caller's store, the one before goes
+// back to a store of the table's
+static void
+test_adopt()
+{
+	Vehicle_Table   table;
+	Telemetry_Store mine;
+
+	// not heard yet
+	CHECK(table.adopt(1, 1, &mine));
+	CHECK(table.find(1, 1) == &mine);
+	CHECK(has_source(&mine, 1, 1));
+	CHECK(table.size() == 1);
+
+	// again, nothing changes
+	CHECK(table.adopt(1, 1, &mine));
+	CHECK(table.find(1, 1) == &mine);
+	CHECK(table.size() == 1);
+
+	// heard before, and the last sender find_or_add() looked up
+	Telemetry_Store *before = table.find_or_add(2, 1);
+	CHECK(before != NULL and before != &mine);
+
+	CHECK(table.adopt(2, 1, &mine));
+	CHECK(table.find(2, 1) == &mine);
+	CHECK(table.find_or_add(2, 1) == &mine);
+	CHECK(has_source(&mine, 2, 1));
+
+	// the first one has a store of the table's now
+	Telemetry_Store *first = table.find(1, 1);
+	CHECK(first != NULL and first != &mine);
+	CHECK(has_source(first, 1, 1));
+
+	// messages follow the swap
+	mavlink_message_t message = heartbeat_from(2, 1);
+	CHECK(table.store(message, 1000) == &mine);
+	CHECK(mine.receive_count(MAVLINK_MSG_ID_HEARTBEAT) == 1);
+	CHECK(before->receive_count(MAVLINK_MSG_ID_HEARTBEAT) == 0);
+
+	CHECK(table.size() == 2);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Main
+// ------------------------------------------------------------------------------
+int
+main(int argc, char **argv)
+{
+	test_fill();
+	test_store();
+	test_adopt();
+
+	return check_exit("VEHICLE TABLE");
+}
@@ -0,0 +1,217 @@
+/**
+ * @file time_sync.cpp
+ *
+ * @brief Vehicle to host clock mapping from TIMESYNC, functions
+ *
+ * Offset and skew estimation with round trip based outlier rejection
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "time_sync.h"
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// round trips slower than 1.5 x the fastest plus this are not used
+#define TIME_SYNC_RTT_MARGIN_USEC 2000
+
+// replies to requests older than this are ignored
+#define TIME_SYNC_MAX_RTT_USEC 10000000
+
+
+// ----------------------------------------------------------------------------------
+//   Time Sync Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Time_Sync::
+Time_Sync()
+{
+	num_samples = 0;
+	next_sample = 0;
+
+	for (int i = 0; i < TIME_SYNC_PENDING; i++)
+		pending[i].store(0, std::memory_order_relaxed);
+	next_pending = 0;
+
+	// estimate starts zeroed, i.e. not valid
+}
+
+
+// ------------------------------------------------------------------------------
+//   Request
+// ------------------------------------------------------------------------------
+void
+Time_Sync::
+make_request(uint64_t host_usec, mavlink_timesync_t &request)
+{
+	request.tc1 = 0;
+	request.ts1 = (int64_t)(host_usec * 1000);
+
+	// the reply must carry it back, see handle_timesync()
+	pending[next_pending].store(request.ts1, std::memory_order_release);
+	next_pending = (next_pending + 1) % TIME_SYNC_PENDING;
+}
+
+// Forget an outstanding request, false if it is not ours or was answered
+bool
+Time_Sync::
+take_request(int64_t ts1)
+{
+	for (int i = 0; i < TIME_SYNC_PENDING; i++)
+	{
+		int64_t expected = ts1;
+		if ( pending[i].compare_exchange_strong(expected, 0, std::memory_order_acq_rel) )
+			return true;
+	}
+
+	return false;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Handle TIMESYNC
+// ------------------------------------------------------------------------------
+bool
+Time_Sync::
+handle_timesync(const mavlink_timesync_t &timesync, uint64_t receive_usec,
+                mavlink_timesync_t &reply)
+{
+	// the vehicle wants our time
+	if ( timesync.tc1 == 0 )
+	{
+		reply.tc1 = (int64_t)(receive_usec * 1000);
+		reply.ts1 = timesync.ts1;
+		return true;
+	}
+
+	// answer to one of our requests
+	uint64_t sent_usec = (uint64_t)timesync.ts1 / 1000;
+	if ( timesync.ts1 <= 0 || sent_usec > receive_usec ||
+	     receive_usec - sent_usec > TIME_SYNC_MAX_RTT_USEC )
+		return false;
+
+	// someone else's, or a duplicate
+	if ( not take_request(timesync.ts1) )
+		return false;
+
+	Sample &sample = samples[next_sample];
+	sample.rtt_usec     = receive_usec - sent_usec;
+	sample.host_usec    = sent_usec + sample.rtt_usec / 2;
+	sample.vehicle_usec = (uint64_t)timesync.tc1 / 1000;
+
+	next_sample = (next_sample + 1) % TIME_SYNC_WINDOW;
+	if ( num_samples < TIME_SYNC_WINDOW )
+		num_samples++;
+
+	update_estimate();
+
+	return false;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Estimate
+// ------------------------------------------------------------------------------
+void
+Time_Sync::
+update_estimate()
+{
+	// fastest round trip in the window
+	uint64_t min_rtt = UINT64_MAX;
+	for (unsigned i = 0; i < num_samples; i++)
+		if ( samples[i].rtt_usec < min_rtt )
+			min_rtt = samples[i].rtt_usec;
+
+	uint64_t max_rtt = min_rtt + min_rtt / 2 + TIME_SYNC_RTT_MARGIN_USEC;
+
+	// newest sample is the reference point
+	unsigned newest = (next_sample + TIME_SYNC_WINDOW - 1) % TIME_SYNC_WINDOW;
+	uint64_t host_ref = samples[newest].host_usec;
+
+	// least squares d = a + s x, with x = host - host_ref, d = vehicle - host
+	double sx = 0, sd = 0, sxx = 0, sxd = 0;
+	unsigned n = 0;
+	for (unsigned i = 0; i < num_samples; i++)
+	{
+		if ( samples[i].rtt_usec > max_rtt )
+			continue;
+
+		double x = (double)(int64_t)(samples[i].host_usec - host_ref);
+		double d = (double)(int64_t)(samples[i].vehicle_usec - samples[i].host_usec);
+		sx  += x;
+		sd  += d;
+		sxx += x * x;
+		sxd += x * d;
+		n++;
+	}
+
+	double a = sd / n, s = 0.0;
+	double denominator = n * sxx - sx * sx;
+	if ( n >= 4 && denominator > 0.0 )
+	{
+		s = (n * sxd - sx * sd) / denominator;
+		a = (sd - s * sx) / n;
+	}
+
+	Time_Sync_Estimate e;
+	e.valid       = true;
+	e.host_ref    = host_ref;
+	e.vehicle_ref = (double)host_ref + a;
+	e.rate        = 1.0 + s;
+	e.rtt_usec    = min_rtt;
+	e.samples     = n;
+
+	estimate.store(e);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Conversions
+// ------------------------------------------------------------------------------
+bool
+Time_Sync::
+is_valid() const
+{
+	return estimate.load_field(&Time_Sync_Estimate::valid);
+}
+
+Time_Sync_Estimate
+Time_Sync::
+get_estimate() const
+{
+	return estimate.load();
+}
+
+uint64_t
+Time_Sync::
+vehicle_to_host_usec(uint64_t vehicle_usec) const
+{
+	Time_Sync_Estimate e = estimate.load();
+	if ( not e.valid )
+		return 0;
+
+	double host = (double)e.host_ref + ((double)vehicle_usec - e.vehicle_ref) / e.rate;
+	return host > 0.0 ? (uint64_t)host : 0;
+}
+
+uint64_t
+Time_Sync::
+host_to_vehicle_usec(uint64_t host_usec) const
+{
+	Time_Sync_Estimate e = estimate.load();
+	if ( not e.valid )
+		return 0;
+
+	double vehicle = e.vehicle_ref + e.rate * (double)(int64_t)(host_usec - e.host_ref);
+	return vehicle > 0.0 ? (uint64_t)vehicle : 0;
+}
+
@@ -0,0 +1,125 @@
+/**
+ * @file time_sync.h
+ *
+ * @brief Vehicle to host clock mapping from TIMESYNC, definition
+ *
+ * Estimates the offset and skew between the autopilot's boot clock and the
+ * host clock so that timestamps can be converted in both directions.
+ */
+
+#ifndef TIME_SYNC_H_
+#define TIME_SYNC_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "seqlock.h"
+
+#include <atomic>
+#include <stdint.h>
+
+#include <common/mavlink.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// round trips kept for the estimate
+#define TIME_SYNC_WINDOW 32
+
+// requests awaiting a reply, the oldest is forgotten beyond this
+#define TIME_SYNC_PENDING 16
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+// Linear map vehicle_usec = vehicle_ref + rate * (host_usec - host_ref)
+struct Time_Sync_Estimate
+{
+	bool     valid;
+	uint64_t host_ref;     // host usec
+	double   vehicle_ref;  // vehicle usec since boot
+	double   rate;         // 1 + skew
+	uint64_t rtt_usec;     // best round trip in the window
+	unsigned samples;      // round trips used
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Time Sync Class
+// ----------------------------------------------------------------------------------
+/*
+ * Time Sync Class
+ *
+ * Each TIMESYNC round trip (host sends ts1 = host time, vehicle answers with
+ * tc1 = its time) gives one sample: the vehicle time tc1 at the host time
+ * midway through the round trip.  The estimate is a least-squares line
+ * through the last TIME_SYNC_WINDOW samples, using only round trips close to
+ * the fastest one in the window; slow round trips are asymmetric and would
+ * bias the offset.  With fewer than four good samples only the offset is
+ * estimated and the rate is taken as 1.
+ *
+ * A reply counts only if its ts1 is one of our own outstanding requests,
+ * and only once.  Other systems on the link get answers to theirs too, and
+ * a reply to someone else's request would pair their send time with ours.
+ *
+ * handle_timesync() runs on the read thread, make_request() on one other
+ * thread (or the same), the conversions may be called from any thread.
+ * All times are in microseconds; TIMESYNC carries nanoseconds on the wire.
+ */
+class Time_Sync
+{
+
+public:
+
+	Time_Sync();
+
+	// Request to send now, host_usec is the current host time
+	void make_request(uint64_t host_usec, mavlink_timesync_t &request);
+
+	/*
+	 * Process a received TIMESYNC.  A reply to one of our requests updates
+	 * the estimate.  A request from the vehicle returns true and fills
+	 * reply, which the caller must send.
+	 */
+	bool handle_timesync(const mavlink_timesync_t &timesync, uint64_t receive_usec,
+	                     mavlink_timesync_t &reply);
+
+	bool is_valid() const;
+	Time_Sync_Estimate get_estimate() const;
+
+	// Conversions, return 0 if no estimate exists yet
+	uint64_t vehicle_to_host_usec(uint64_t vehicle_usec) const;
+	uint64_t host_to_vehicle_usec(uint64_t host_usec) const;
+
+private:
+
+	struct Sample
+	{
+		uint64_t host_usec;     // midpoint of the round trip
+		uint64_t vehicle_usec;
+		uint64_t rtt_usec;
+	};
+
+	// read thread only
+	Sample   samples[TIME_SYNC_WINDOW];
+	unsigned num_samples;
+	unsigned next_sample;
+
+	Seqlock<Time_Sync_Estimate> estimate;
+
+	// ts1 of our requests not answered yet, 0 for a free entry
+	std::atomic<int64_t> pending[TIME_SYNC_PENDING];
+	unsigned             next_pending;   // make_request() only
+
+	bool take_request(int64_t ts1);
+	void update_estimate();
+
+};
+
+#endif // TIME_SYNC_H_
+
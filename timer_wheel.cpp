@@ -0,0 +1,180 @@
+/**
+ * @file timer_wheel.cpp
+ *
+ * @brief Hashed timing wheel, functions
+ *
+ * Constant time schedule and cancel, expiry by tick
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "timer_wheel.h"
+
+
+// ----------------------------------------------------------------------------------
+//   Timer Wheel Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Timer_Wheel::
+Timer_Wheel(uint64_t tick_usec_)
+{
+	tick_usec  = tick_usec_ ? tick_usec_ : 1;
+	last_tick  = 0;
+	num_timers = 0;
+
+	for (int i = 0; i < TIMER_WHEEL_SLOTS; i++)
+		slots[i].next = slots[i].prev = &slots[i];
+}
+
+
+// ------------------------------------------------------------------------------
+//   List Helpers
+// ------------------------------------------------------------------------------
+void
+Timer_Wheel::
+link(Wheel_Timer *head, Wheel_Timer *timer)
+{
+	timer->prev = head->prev;
+	timer->next = head;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+void
+Timer_Wheel::
+unlink(Wheel_Timer *timer)
+{
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = timer->prev = NULL;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Schedule and Cancel
+// ------------------------------------------------------------------------------
+void
+Timer_Wheel::
+schedule(Wheel_Timer *timer, uint64_t deadline_usec)
+{
+	cancel(timer);
+
+	// never into a tick that has already been processed
+	uint64_t tick = deadline_usec / tick_usec;
+	if ( tick <= last_tick )
+		tick = last_tick + 1;
+
+	timer->deadline_usec = deadline_usec;
+	link(&slots[tick & (TIMER_WHEEL_SLOTS - 1)], timer);
+	num_timers++;
+}
+
+void
+Timer_Wheel::
+cancel(Wheel_Timer *timer)
+{
+	if ( not timer->is_scheduled() )
+		return;
+
+	unlink(timer);
+	num_timers--;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Advance
+// ------------------------------------------------------------------------------
+unsigned
+Timer_Wheel::
+advance(uint64_t now_usec)
+{
+	uint64_t target = now_usec / tick_usec;
+	if ( target <= last_tick )
+		return 0;
+
+	// after a long stall one pass over the wheel covers every slot
+	uint64_t ticks = target - last_tick;
+	if ( ticks > TIMER_WHEEL_SLOTS )
+		ticks = TIMER_WHEEL_SLOTS;
+
+	unsigned fired = 0;
+
+	for (uint64_t tick = target - ticks + 1; tick <= target; tick++)
+	{
+		Wheel_Timer *head = &slots[tick & (TIMER_WHEEL_SLOTS - 1)];
+		if ( head->next == head )
+			continue;
+
+		// Move the slot to a local list, so that callbacks can schedule
+		// into it and cancel any timer without upsetting the walk
+		Wheel_Timer pending;
+		pending.next = head->next;
+		pending.prev = head->prev;
+		pending.next->prev = &pending;
+		pending.prev->next = &pending;
+		head->next = head->prev = head;
+
+		// a timer rescheduled for now lands in the next tick
+		last_tick = tick;
+
+		while ( pending.next != &pending )
+		{
+			Wheel_Timer *timer = pending.next;
+			unlink(timer);
+
+			// a later revolution, back into its slot
+			if ( timer->deadline_usec > now_usec )
+			{
+				link(head, timer);
+				continue;
+			}
+
+			num_timers--;
+			fired++;
+			timer->callback(timer, now_usec, timer->context);
+		}
+	}
+
+	// timers later in the current tick are still waiting, visit it again
+	last_tick = target - 1;
+
+	return fired;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Next Deadline
+// ------------------------------------------------------------------------------
+uint64_t
+Timer_Wheel::
+next_deadline() const
+{
+	if ( num_timers == 0 )
+		return UINT64_MAX;
+
+	// first slot holding a timer of the current revolution
+	uint64_t earliest = UINT64_MAX;
+	for (uint64_t tick = last_tick + 1; tick <= last_tick + TIMER_WHEEL_SLOTS; tick++)
+	{
+		const Wheel_Timer *head = &slots[tick & (TIMER_WHEEL_SLOTS - 1)];
+		uint64_t tick_end = (tick + 1) * tick_usec;
+
+		for (const Wheel_Timer *timer = head->next; timer != head; timer = timer->next)
+		{
+			if ( timer->deadline_usec < earliest )
+				earliest = timer->deadline_usec;
+		}
+
+		if ( earliest < tick_end )
+			return earliest;
+	}
+
+	return earliest;
+}
+
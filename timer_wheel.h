@@ -0,0 +1,117 @@
+/**
+ * @file timer_wheel.h
+ *
+ * @brief Hashed timing wheel, definition
+ *
+ * Schedules many periodic jobs (setpoint streams, timeouts) from one thread
+ * with O(1) insert and cancel.
+ */
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// slots in the wheel, a power of two
+#define TIMER_WHEEL_SLOTS 256
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+struct Wheel_Timer;
+
+// Called on the wheel's thread when a timer expires, may reschedule it
+typedef void (*Timer_Callback)(Wheel_Timer *timer, uint64_t now_usec, void *context);
+
+/*
+ * One timer, owned by the caller and linked into the wheel while scheduled.
+ * Set callback and context, then pass it to Timer_Wheel::schedule().
+ */
+struct Wheel_Timer
+{
+	Timer_Callback callback;
+	void          *context;
+	uint64_t       deadline_usec;
+
+	// wheel's list links, NULL while not scheduled
+	Wheel_Timer   *next;
+	Wheel_Timer   *prev;
+
+	Wheel_Timer()
+	{
+		callback = NULL;
+		context  = NULL;
+		deadline_usec = 0;
+		next = prev = NULL;
+	}
+
+	bool is_scheduled() const { return next != NULL; }
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Timer Wheel Class
+// ----------------------------------------------------------------------------------
+/*
+ * Timer Wheel Class
+ *
+ * TIMER_WHEEL_SLOTS lists, one per tick of tick_usec.  A timer goes into the
+ * slot of its deadline tick; deadlines more than one revolution away share
+ * the slot with nearer ones and are skipped until their turn comes.
+ * advance() visits the slots of the ticks that have passed and fires every
+ * timer that is due, in tick order.
+ *
+ * Not thread safe, the wheel belongs to the event loop that advances it.
+ */
+class Timer_Wheel
+{
+
+public:
+
+	Timer_Wheel(uint64_t tick_usec = 1000);
+
+	uint64_t get_tick_usec() const { return tick_usec; }
+
+	// (Re)schedule a timer, a deadline in the past fires on the next advance()
+	void schedule(Wheel_Timer *timer, uint64_t deadline_usec);
+	void cancel(Wheel_Timer *timer);
+
+	// Fire every timer due at now_usec, returns the number fired
+	unsigned advance(uint64_t now_usec);
+
+	// Earliest pending deadline, or UINT64_MAX if nothing is scheduled
+	uint64_t next_deadline() const;
+
+	unsigned size() const { return num_timers; }
+
+private:
+
+	uint64_t tick_usec;
+	uint64_t last_tick;      // every timer up to the end of this tick has fired
+	unsigned num_timers;
+
+	// circular lists with sentinel heads
+	Wheel_Timer slots[TIMER_WHEEL_SLOTS];
+
+	Timer_Wheel(const Timer_Wheel &);
+	Timer_Wheel &operator=(const Timer_Wheel &);
+
+	static void link(Wheel_Timer *head, Wheel_Timer *timer);
+	static void unlink(Wheel_Timer *timer);
+
+};
+
+#endif // TIMER_WHEEL_H_
+
@@ -0,0 +1,220 @@
+/**
+ * @file vehicle_table.cpp
+ *
+ * @brief Telemetry of every sender on the link, functions
+ *
+ * Open-addressed table of Telemetry_Store by system and component id
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "vehicle_table.h"
+
+#include <stdio.h>
+
+
+// ----------------------------------------------------------------------------------
+//   Vehicle Table Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Vehicle_Table::
+Vehicle_Table()
+{
+	for (int i = 0; i < VEHICLE_TABLE_SLOTS; i++)
+	{
+		slots[i].key.store(0, std::memory_order_relaxed);
+		slots[i].store.store(NULL, std::memory_order_relaxed);
+		slots[i].owned = NULL;
+	}
+
+	count.store(0, std::memory_order_relaxed);
+
+	last_key     = 0;
+	last_store   = NULL;
+	warned_full  = false;
+	adopted_slot = -1;
+}
+
+Vehicle_Table::
+~Vehicle_Table()
+{
+	for (int i = 0; i < VEHICLE_TABLE_SLOTS; i++)
+		delete slots[i].owned;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Lookup
+// ------------------------------------------------------------------------------
+Telemetry_Store *
+Vehicle_Table::
+find(int sysid, int compid) const
+{
+	uint32_t key = make_key(sysid, compid);
+
+	for (unsigned i = home_slot(key), probes = 0; probes < VEHICLE_TABLE_SLOTS;
+	     i = (i + 1) & (VEHICLE_TABLE_SLOTS - 1), probes++)
+	{
+		uint32_t slot_key = slots[i].key.load(std::memory_order_acquire);
+
+		if ( slot_key == key )
+			return slots[i].store.load(std::memory_order_acquire);
+
+		// never removed, so an empty slot ends the probe sequence
+		if ( slot_key == 0 )
+			return NULL;
+	}
+
+	return NULL;
+}
+
+Telemetry_Store *
+Vehicle_Table::
+find_or_add(int sysid, int compid)
+{
+	uint32_t key = make_key(sysid, compid);
+
+	// bursts come from one sender, skip the probe
+	if ( key == last_key )
+		return last_store;
+
+	int i = find_or_add_slot(sysid, compid, NULL);
+	if ( i < 0 )
+		return NULL;
+
+	last_key   = key;
+	last_store = slots[i].store.load(std::memory_order_relaxed);
+
+	return last_store;
+}
+
+// Slot of a sender, added with this store (or one of the table's if NULL)
+// if new, -1 if the table is full.  Read thread only
+int
+Vehicle_Table::
+find_or_add_slot(int sysid, int compid, Telemetry_Store *store)
+{
+	uint32_t key = make_key(sysid, compid);
+
+	unsigned i = home_slot(key);
+	for (;;)
+	{
+		uint32_t slot_key = slots[i].key.load(std::memory_order_relaxed);
+
+		if ( slot_key == key )
+			return i;
+
+		if ( slot_key == 0 )
+		{
+			unsigned n = count.load(std::memory_order_relaxed);
+			if ( n >= VEHICLE_TABLE_MAX_ENTRIES )
+			{
+				if ( not warned_full )
+				{
+					fprintf(stderr,"WARNING: more than %d senders, ignoring %d/%d\n",
+					        VEHICLE_TABLE_MAX_ENTRIES, sysid, compid);
+					warned_full = true;
+				}
+				return -1;
+			}
+
+			// publish the store, then make the entry visible to size()
+			set_store(i, key, store);
+			slots[i].key.store(key, std::memory_order_release);
+
+			order[n] = (uint8_t)i;
+			count.store(n + 1, std::memory_order_release);
+			return i;
+		}
+
+		i = (i + 1) & (VEHICLE_TABLE_SLOTS - 1);
+	}
+}
+
+// Serve a slot from this store, or from the table's own if NULL
+void
+Vehicle_Table::
+set_store(int i, uint32_t key, Telemetry_Store *store)
+{
+	if ( store == NULL )
+	{
+		if ( slots[i].owned == NULL )
+			slots[i].owned = new Telemetry_Store();
+		store = slots[i].owned;
+	}
+
+	Message_Source source;
+	source.sysid  = (key - 1) >> 8;
+	source.compid = (key - 1) & 0xff;
+	store->source.store(source);
+
+	slots[i].store.store(store, std::memory_order_release);
+}
+
+Message_Source
+Vehicle_Table::
+get_source(unsigned i) const
+{
+	return slots[order[i]].store.load(std::memory_order_acquire)->source.load();
+}
+
+
+// ------------------------------------------------------------------------------
+//   Adopt
+// ------------------------------------------------------------------------------
+bool
+Vehicle_Table::
+adopt(int sysid, int compid, Telemetry_Store *store)
+{
+	uint32_t key = make_key(sysid, compid);
+
+	if ( adopted_slot >= 0 )
+	{
+		uint32_t adopted_key = slots[adopted_slot].key.load(std::memory_order_relaxed);
+		if ( adopted_key == key and slots[adopted_slot].store.load(std::memory_order_relaxed) == store )
+			return true;
+
+		// the previous sender goes back to a store of the table's
+		set_store(adopted_slot, adopted_key, NULL);
+		adopted_slot = -1;
+	}
+
+	int i = find_or_add_slot(sysid, compid, store);
+	if ( i < 0 )
+		return false;
+
+	// heard before, swap its store
+	set_store(i, key, store);
+	adopted_slot = i;
+
+	// the cached sender may have been either of them
+	last_key   = 0;
+	last_store = NULL;
+
+	return true;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Store
+// ------------------------------------------------------------------------------
+Telemetry_Store *
+Vehicle_Table::
+store(const mavlink_message_t &message, uint64_t time_usec)
+{
+	Telemetry_Store *vehicle = find_or_add(message.sysid, message.compid);
+	if ( not vehicle )
+		return NULL;
+
+	vehicle->store(message, time_usec);
+	vehicle->notify(message.msgid);
+
+	return vehicle;
+}
+
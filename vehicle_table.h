@@ -0,0 +1,127 @@
+/**
+ * @file vehicle_table.h
+ *
+ * @brief Telemetry of every sender on the link, definition
+ *
+ * One Telemetry_Store per (system id, component id), found in O(1).
+ */
+
+#ifndef VEHICLE_TABLE_H_
+#define VEHICLE_TABLE_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "telemetry_store.h"
+
+#include <atomic>
+#include <stdint.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// slots in the table, 1 << VEHICLE_TABLE_BITS
+#define VEHICLE_TABLE_BITS  6
+#define VEHICLE_TABLE_SLOTS (1 << VEHICLE_TABLE_BITS)
+
+// senders kept at most, leaves the table at most 3/4 full
+#define VEHICLE_TABLE_MAX_ENTRIES (VEHICLE_TABLE_SLOTS * 3 / 4)
+
+
+// ----------------------------------------------------------------------------------
+//   Vehicle Table Class
+// ----------------------------------------------------------------------------------
+/*
+ * Vehicle Table Class
+ *
+ * Open-addressed hash table, linear probing, from the 16 bit key
+ * (sysid << 8 | compid) to that sender's Telemetry_Store.  Entries are
+ * added by the read thread the first time a sender is heard and are never
+ * removed, so lookups need no locks: a slot's key is published with release
+ * ordering after its store is constructed.
+ *
+ * One sender at a time may be kept in a store of the caller's instead,
+ * see adopt().  A store it replaces stays allocated until the table is
+ * destroyed, for readers that found it before.
+ *
+ * Senders beyond VEHICLE_TABLE_MAX_ENTRIES are not recorded.
+ */
+class Vehicle_Table
+{
+
+public:
+
+	Vehicle_Table();
+	~Vehicle_Table();
+
+	// Store of a sender, or NULL if it has not been heard.  Any thread.
+	Telemetry_Store *find(int sysid, int compid) const;
+
+	// Store of a sender, added if new.  Read thread only, NULL if full.
+	Telemetry_Store *find_or_add(int sysid, int compid);
+
+	// Decode into the sender's store and wake its waiters.  Read thread only.
+	Telemetry_Store *store(const mavlink_message_t &message, uint64_t time_usec);
+
+	/*
+		Keep this sender's telemetry in the caller's store from now on, and
+		the previously adopted sender's in one of the table's again.  Read
+		thread only, false if the table is full.
+	*/
+	bool adopt(int sysid, int compid, Telemetry_Store *store);
+
+	unsigned size() const { return count.load(std::memory_order_acquire); }
+
+	// Sender of entry i, i < size(), in the order they were first heard
+	Message_Source get_source(unsigned i) const;
+
+private:
+
+	// key + 1, so that sysid 0 compid 0 is distinguishable from empty
+	struct Slot
+	{
+		std::atomic<uint32_t>          key;
+		std::atomic<Telemetry_Store *> store;
+		Telemetry_Store               *owned;   // the table's, NULL if never needed
+	};
+
+	Slot slots[VEHICLE_TABLE_SLOTS];
+
+	// slot index of each entry, by arrival
+	uint8_t               order[VEHICLE_TABLE_MAX_ENTRIES];
+	std::atomic<unsigned> count;
+
+	// read thread only, the sender of the previous message
+	uint32_t         last_key;
+	Telemetry_Store *last_store;
+
+	int adopted_slot;   // -1 for none
+
+	bool warned_full;
+
+	Vehicle_Table(const Vehicle_Table &);
+	Vehicle_Table &operator=(const Vehicle_Table &);
+
+	int  find_or_add_slot(int sysid, int compid, Telemetry_Store *store);
+	void set_store(int i, uint32_t key, Telemetry_Store *store);
+
+	static uint32_t
+	make_key(int sysid, int compid)
+	{
+		return ( ((uint32_t)(sysid & 0xff) << 8) | (uint32_t)(compid & 0xff) ) + 1;
+	}
+
+	// multiplicative hash, the top bits spread sysid and compid evenly
+	static unsigned
+	home_slot(uint32_t key)
+	{
+		return ( key * 2654435761u ) >> (32 - VEHICLE_TABLE_BITS);
+	}
+
+};
+
+#endif // VEHICLE_TABLE_H_
+